@@ -126,15 +126,15 @@ float poissonShadowValue(in sampler2DShadow shadowMap, vec3 shadowCoords) {
     float sum = 0.0;
     vec2 offset;
 
+#if NGN_SHADOW_PCF == 2
     for(int i = 0; i < ngn_light.shadowPCFEarlyBailSamples; ++i) {
         offset = poissonDisk[i + ngn_light.shadowPCFEarlyBailSamples] * radius;
         sum += texture(shadowMap, shadowCoords + vec3(offsetRotation * offset, 0.0));
     }
 
+    // only in the permutation with early bail samples (NGN_SHADOW_PCF == 2), so the others don't branch at all
     float bailShadowFactor = sum / ngn_light.shadowPCFEarlyBailSamples;
-    // I think this branching might be slow, especially with ngn_light.shadowPCFEarlyBailSamples == 0, I hope this somehow gets optimized out, even if
-    // we only branch on a (homogeneous) uniform
-    if(ngn_light.shadowPCFEarlyBailSamples == 0 || bailShadowFactor > 0.1 && bailShadowFactor < 0.9) {
+    if(bailShadowFactor > 0.1 && bailShadowFactor < 0.9) {
         for(int i = 0; i < ngn_light.shadowPCFSamples - ngn_light.shadowPCFEarlyBailSamples; ++i) {
             offset = poissonDisk[i + ngn_light.shadowPCFEarlyBailSamples] * radius;
             sum += texture(shadowMap, shadowCoords + vec3(offsetRotation * offset, 0.0));
@@ -143,6 +143,13 @@ float poissonShadowValue(in sampler2DShadow shadowMap, vec3 shadowCoords) {
     } else {
         return bailShadowFactor;
     }
+#else
+    for(int i = 0; i < ngn_light.shadowPCFSamples; ++i) {
+        offset = poissonDisk[i] * radius;
+        sum += texture(shadowMap, shadowCoords + vec3(offsetRotation * offset, 0.0));
+    }
+    return sum / ngn_light.shadowPCFSamples;
+#endif
 
 }
 
@@ -155,11 +162,12 @@ vec4 colors[6] = vec4[6](
     vec4(0.0, 1.0, 1.0, 1.0)
 );
 
+// The light type and the kind of shadow are known at compile time (see ShaderPermutation), so every permutation is straight-line code
 void getLightDirAndAtten(out vec3 lightDir, out float lightAtten) {
-    if(ngn_light.type == NGN_LIGHT_TYPE_DIRECTIONAL) {
+    #if NGN_LIGHT_TYPE == NGN_LIGHT_TYPE_DIRECTIONAL
         lightDir = -ngn_light.direction;
         lightAtten = 1.0;
-    } else if(ngn_light.type == NGN_LIGHT_TYPE_POINT || ngn_light.type == NGN_LIGHT_TYPE_SPOT) {
+    #else
         lightDir = ngn_light.position + vsOut.eye;
         float dist = length(lightDir);
         lightDir = lightDir / dist;
@@ -167,25 +175,27 @@ void getLightDirAndAtten(out vec3 lightDir, out float lightAtten) {
         lightAtten = dist / ngn_light.radius + 1.0;
         lightAtten = 1.0 / (lightAtten*lightAtten);
 
-        if(ngn_light.type == NGN_LIGHT_TYPE_SPOT) {
+        #if NGN_LIGHT_TYPE == NGN_LIGHT_TYPE_SPOT
             lightAtten *= 1.0 - smoothstep(ngn_light.innerAngle, ngn_light.outerAngle, dot(-lightDir, ngn_light.direction));
-        }
+        #endif
 
         // attenCutoff represents only the cutoff of the attenuation function (or the cutoff of the actual RGB values outputted)
         // if we have light sources with luminance > 1, these values will obviously be wrong. therefore we have to rescale
         // also note, that we use max(r,g,b) as our luminance function, but just to make sure, that no component will exceed the cutoff
         float cutoff = ngn_light.attenCutoff / max(max(ngn_light.color.r, ngn_light.color.g), ngn_light.color.b);
         lightAtten = max(0, (lightAtten - cutoff) / (1.0 - cutoff));
-    }
+    #endif
 
-    if(ngn_light.shadowed) {
+    #if NGN_SHADOWED
         int cascadeIndex = 0;
-        for(int i = 0; i < ngn_light.shadowCascadeCount; ++i) {
+        #if NGN_SHADOW_CASCADES > 1
+        for(int i = 0; i < NGN_SHADOW_CASCADES; ++i) {
             if(abs(vsOut.eye.z) < ngn_light.shadowCascadeSplitDistance[i]) {
                 cascadeIndex = i;
                 break;
             }
         }
+        #endif
         /*if(ngn_light.type == NGN_LIGHT_TYPE_DIRECTIONAL) {
             ngn_fragColor = colors[cascadeIndex]; return;
         }*/
@@ -213,10 +223,14 @@ void getLightDirAndAtten(out vec3 lightDir, out float lightAtten) {
 
         shadowCoords.xy = (shadowCoords.xy + ngn_light.shadowMapUVOffset[cascadeIndex]) * ngn_light.shadowMapUVScale;
 
+        #if NGN_SHADOW_PCF > 0
         float shadow = poissonShadowValue(ngn_light.shadowMap, shadowCoords);
+        #else
+        float shadow = shadowValue(ngn_light.shadowMap, shadowCoords);
+        #endif
         //ngn_fragColor = vec4(shadow); return;
         lightAtten *= shadow;
-    }
+    #endif
 }
 
 #pragma ngn slot
@@ -61,6 +61,7 @@ int main(int argc, char** args) {
     ngn::setupDefaultLogging();
 
     ngn::Window window("ngn test", 1600, 900, false, false);
+    ngn::ShaderCache::setBinaryCacheDirectory("shadercache");
 
     ngn::Renderer renderer;
     renderer.clearColor = glm::vec4(0.4f, 0.4f, 0.4f, 1.0f);
@@ -0,0 +1,260 @@
+#include <cassert>
+
+#include "aabbtree.hpp"
+
+namespace ngn {
+    const int AABBTree::NULL_NODE;
+
+    int AABBTree::allocateNode() {
+        if(mFreeList == NULL_NODE) {
+            Node node;
+            node.next = NULL_NODE;
+            node.height = -1;
+            mNodes.push_back(node);
+            mFreeList = mNodes.size() - 1;
+        }
+
+        int index = mFreeList;
+        Node& node = mNodes[index];
+        mFreeList = node.next;
+        node.parent = NULL_NODE;
+        node.child1 = NULL_NODE;
+        node.child2 = NULL_NODE;
+        node.height = 0;
+        node.userData = nullptr;
+        return index;
+    }
+
+    void AABBTree::freeNode(int index) {
+        mNodes[index].next = mFreeList;
+        mNodes[index].height = -1;
+        mFreeList = index;
+    }
+
+    int AABBTree::createProxy(const AABoundingBox& box, void* userData) {
+        int proxy = allocateNode();
+        Node& node = mNodes[proxy];
+        node.box.min = box.min - glm::vec3(mFatMargin);
+        node.box.max = box.max + glm::vec3(mFatMargin);
+        node.userData = userData;
+        insertLeaf(proxy);
+        return proxy;
+    }
+
+    void AABBTree::destroyProxy(int proxy) {
+        assert(mNodes[proxy].isLeaf());
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+
+    bool AABBTree::moveProxy(int proxy, const AABoundingBox& box) {
+        assert(mNodes[proxy].isLeaf());
+        if(contains(mNodes[proxy].box, box)) return false;
+
+        removeLeaf(proxy);
+        mNodes[proxy].box.min = box.min - glm::vec3(mFatMargin);
+        mNodes[proxy].box.max = box.max + glm::vec3(mFatMargin);
+        insertLeaf(proxy);
+        return true;
+    }
+
+    void AABBTree::insertLeaf(int leaf) {
+        if(mRoot == NULL_NODE) {
+            mRoot = leaf;
+            mNodes[leaf].parent = NULL_NODE;
+            return;
+        }
+
+        // Find the best sibling by descending the tree and choosing the child that increases the surface area the least
+        AABoundingBox leafBox = mNodes[leaf].box;
+        int index = mRoot;
+        while(!mNodes[index].isLeaf()) {
+            const Node& node = mNodes[index];
+            int child1 = node.child1;
+            int child2 = node.child2;
+
+            float area = surfaceArea(node.box);
+            float combinedArea = surfaceArea(combine(node.box, leafBox));
+
+            // cost of creating a new parent for this node and the new leaf
+            float cost = 2.0f * combinedArea;
+            // minimum cost of pushing the leaf further down the tree
+            float inheritanceCost = 2.0f * (combinedArea - area);
+
+            float cost1 = surfaceArea(combine(leafBox, mNodes[child1].box)) + inheritanceCost;
+            if(!mNodes[child1].isLeaf()) cost1 -= surfaceArea(mNodes[child1].box);
+            float cost2 = surfaceArea(combine(leafBox, mNodes[child2].box)) + inheritanceCost;
+            if(!mNodes[child2].isLeaf()) cost2 -= surfaceArea(mNodes[child2].box);
+
+            if(cost < cost1 && cost < cost2) break;
+
+            index = cost1 < cost2 ? child1 : child2;
+        }
+        int sibling = index;
+
+        // mNodes might be reallocated in here
+        int oldParent = mNodes[sibling].parent;
+        int newParent = allocateNode();
+        mNodes[newParent].parent = oldParent;
+        mNodes[newParent].box = combine(leafBox, mNodes[sibling].box);
+        mNodes[newParent].height = mNodes[sibling].height + 1;
+        mNodes[newParent].child1 = sibling;
+        mNodes[newParent].child2 = leaf;
+        mNodes[sibling].parent = newParent;
+        mNodes[leaf].parent = newParent;
+
+        if(oldParent != NULL_NODE) {
+            if(mNodes[oldParent].child1 == sibling)
+                mNodes[oldParent].child1 = newParent;
+            else
+                mNodes[oldParent].child2 = newParent;
+        } else {
+            mRoot = newParent;
+        }
+
+        // walk back up and fix heights and boxes
+        index = mNodes[leaf].parent;
+        while(index != NULL_NODE) {
+            index = balance(index);
+
+            int child1 = mNodes[index].child1;
+            int child2 = mNodes[index].child2;
+            mNodes[index].height = 1 + glm::max(mNodes[child1].height, mNodes[child2].height);
+            mNodes[index].box = combine(mNodes[child1].box, mNodes[child2].box);
+
+            index = mNodes[index].parent;
+        }
+    }
+
+    void AABBTree::removeLeaf(int leaf) {
+        if(leaf == mRoot) {
+            mRoot = NULL_NODE;
+            return;
+        }
+
+        int parent = mNodes[leaf].parent;
+        int grandParent = mNodes[parent].parent;
+        int sibling = mNodes[parent].child1 == leaf ? mNodes[parent].child2 : mNodes[parent].child1;
+
+        if(grandParent != NULL_NODE) {
+            // replace the parent with the sibling
+            if(mNodes[grandParent].child1 == parent)
+                mNodes[grandParent].child1 = sibling;
+            else
+                mNodes[grandParent].child2 = sibling;
+            mNodes[sibling].parent = grandParent;
+            freeNode(parent);
+
+            int index = grandParent;
+            while(index != NULL_NODE) {
+                index = balance(index);
+
+                int child1 = mNodes[index].child1;
+                int child2 = mNodes[index].child2;
+                mNodes[index].box = combine(mNodes[child1].box, mNodes[child2].box);
+                mNodes[index].height = 1 + glm::max(mNodes[child1].height, mNodes[child2].height);
+
+                index = mNodes[index].parent;
+            }
+        } else {
+            mRoot = sibling;
+            mNodes[sibling].parent = NULL_NODE;
+            freeNode(parent);
+        }
+    }
+
+    // Performs a left or right rotation if node A is imbalanced and returns the new root of the subtree
+    int AABBTree::balance(int iA) {
+        Node* A = &mNodes[iA];
+        if(A->isLeaf() || A->height < 2) return iA;
+
+        int iB = A->child1;
+        int iC = A->child2;
+        Node* B = &mNodes[iB];
+        Node* C = &mNodes[iC];
+
+        int balance = C->height - B->height;
+
+        // rotate C up
+        if(balance > 1) {
+            int iF = C->child1;
+            int iG = C->child2;
+            Node* F = &mNodes[iF];
+            Node* G = &mNodes[iG];
+
+            C->child1 = iA;
+            C->parent = A->parent;
+            A->parent = iC;
+
+            if(C->parent != NULL_NODE) {
+                if(mNodes[C->parent].child1 == iA)
+                    mNodes[C->parent].child1 = iC;
+                else
+                    mNodes[C->parent].child2 = iC;
+            } else {
+                mRoot = iC;
+            }
+
+            if(F->height > G->height) {
+                C->child2 = iF;
+                A->child2 = iG;
+                G->parent = iA;
+                A->box = combine(B->box, G->box);
+                C->box = combine(A->box, F->box);
+                A->height = 1 + glm::max(B->height, G->height);
+                C->height = 1 + glm::max(A->height, F->height);
+            } else {
+                C->child2 = iG;
+                A->child2 = iF;
+                F->parent = iA;
+                A->box = combine(B->box, F->box);
+                C->box = combine(A->box, G->box);
+                A->height = 1 + glm::max(B->height, F->height);
+                C->height = 1 + glm::max(A->height, G->height);
+            }
+            return iC;
+        }
+
+        // rotate B up
+        if(balance < -1) {
+            int iD = B->child1;
+            int iE = B->child2;
+            Node* D = &mNodes[iD];
+            Node* E = &mNodes[iE];
+
+            B->child1 = iA;
+            B->parent = A->parent;
+            A->parent = iB;
+
+            if(B->parent != NULL_NODE) {
+                if(mNodes[B->parent].child1 == iA)
+                    mNodes[B->parent].child1 = iB;
+                else
+                    mNodes[B->parent].child2 = iB;
+            } else {
+                mRoot = iB;
+            }
+
+            if(D->height > E->height) {
+                B->child2 = iD;
+                A->child1 = iE;
+                E->parent = iA;
+                A->box = combine(C->box, E->box);
+                B->box = combine(A->box, D->box);
+                A->height = 1 + glm::max(C->height, E->height);
+                B->height = 1 + glm::max(A->height, D->height);
+            } else {
+                B->child2 = iE;
+                A->child1 = iD;
+                D->parent = iA;
+                A->box = combine(C->box, D->box);
+                B->box = combine(A->box, E->box);
+                A->height = 1 + glm::max(C->height, D->height);
+                B->height = 1 + glm::max(A->height, E->height);
+            }
+            return iB;
+        }
+
+        return iA;
+    }
+}
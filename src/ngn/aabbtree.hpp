@@ -0,0 +1,177 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+#include "culling.hpp"
+
+namespace ngn {
+    // Dynamic AABB tree (bounding volume hierarchy), inspired by Box2D's b2DynamicTree
+    // Leaves store "fat" boxes, that are a little larger than the box passed in, so that small movements don't need a reinsertion.
+    // Inserting tries to minimize the total surface area of the tree and the tree is kept balanced with AVL-style rotations.
+    class AABBTree {
+    public:
+        static const int NULL_NODE = -1;
+
+    private:
+        struct Node {
+            AABoundingBox box;
+            void* userData;
+            // next is used for the free list
+            union {
+                int parent;
+                int next;
+            };
+            int child1, child2;
+            // leaf = 0, free node = -1
+            int height;
+
+            bool isLeaf() const {return child1 == NULL_NODE;}
+        };
+
+        std::vector<Node> mNodes;
+        int mRoot;
+        int mFreeList;
+        float mFatMargin;
+
+        int allocateNode();
+        void freeNode(int node);
+        void insertLeaf(int leaf);
+        void removeLeaf(int leaf);
+        int balance(int node);
+
+        static AABoundingBox combine(const AABoundingBox& a, const AABoundingBox& b) {
+            AABoundingBox ret;
+            ret.min = glm::min(a.min, b.min);
+            ret.max = glm::max(a.max, b.max);
+            return ret;
+        }
+
+        static float surfaceArea(const AABoundingBox& box) {
+            glm::vec3 size = box.max - box.min;
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        static bool contains(const AABoundingBox& outer, const AABoundingBox& inner) {
+            return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::lessThanEqual(inner.max, outer.max));
+        }
+
+        // Calls callback(userData) for every leaf, whose fat box passes test(box). Interior nodes failing the test are skipped with their subtrees
+        template<typename Test, typename Callback>
+        void query(Test test, Callback callback) const {
+            if(mRoot == NULL_NODE) return;
+            // the tree is balanced, so this is deep enough for a lot of proxies
+            int stack[256];
+            int stackSize = 0;
+            stack[stackSize++] = mRoot;
+            while(stackSize > 0) {
+                const Node& node = mNodes[stack[--stackSize]];
+                if(!test(node.box)) continue;
+                if(node.isLeaf()) {
+                    callback(node.userData);
+                } else {
+                    stack[stackSize++] = node.child1;
+                    stack[stackSize++] = node.child2;
+                }
+            }
+        }
+
+    public:
+        AABBTree(float fatMargin = 0.1f) : mRoot(NULL_NODE), mFreeList(NULL_NODE), mFatMargin(fatMargin) {}
+
+        // returns a proxy id, which is stable until the proxy is destroyed
+        int createProxy(const AABoundingBox& box, void* userData);
+        void destroyProxy(int proxy);
+        // returns true if the proxy had to be reinserted (i.e. the box left the fat box)
+        bool moveProxy(int proxy, const AABoundingBox& box);
+
+        void* getUserData(int proxy) const {return mNodes[proxy].userData;}
+        const AABoundingBox& getFatAABB(int proxy) const {return mNodes[proxy].box;}
+
+        float getFatMargin() const {return mFatMargin;}
+        // only affects proxies created or reinserted afterwards
+        void setFatMargin(float margin) {mFatMargin = margin;}
+
+        int getHeight() const {return mRoot == NULL_NODE ? 0 : mNodes[mRoot].height;}
+
+        template<typename Callback>
+        void queryAABB(const AABoundingBox& box, Callback callback) const {
+            query([&box](const AABoundingBox& nodeBox) {return nodeBox.overlaps(box);}, callback);
+        }
+
+        template<typename Callback>
+        void queryFrustum(const Frustum& frustum, Callback callback) const {
+            query([&frustum](const AABoundingBox& nodeBox) {
+                glm::vec3 center = (nodeBox.min + nodeBox.max) * 0.5f;
+                glm::vec3 extent = (nodeBox.max - nodeBox.min) * 0.5f;
+                for(int p = 0; p < 6; ++p) {
+                    const glm::vec4& plane = frustum.planes[p];
+                    float dist = glm::dot(glm::vec3(plane), center) + plane.w;
+                    float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                    if(dist < -radius) return false;
+                }
+                return true;
+            }, callback);
+        }
+
+        template<typename Callback>
+        void querySphere(const glm::vec3& center, float radius, Callback callback) const {
+            query([&center, radius](const AABoundingBox& nodeBox) {
+                glm::vec3 closest = glm::clamp(center, nodeBox.min, nodeBox.max);
+                glm::vec3 diff = closest - center;
+                return glm::dot(diff, diff) <= radius * radius;
+            }, callback);
+        }
+
+        // The box is approximated by it's bounding sphere, so this is conservative
+        // cosAngle is the cosine of the half opening angle, direction has to be normalized
+        template<typename Callback>
+        void queryCone(const glm::vec3& apex, const glm::vec3& direction, float cosAngle, float range, Callback callback) const {
+            float sinAngle = std::sqrt(glm::max(0.0f, 1.0f - cosAngle * cosAngle));
+            query([&apex, &direction, cosAngle, sinAngle, range](const AABoundingBox& nodeBox) {
+                glm::vec3 center = (nodeBox.min + nodeBox.max) * 0.5f;
+                float radius = glm::length(nodeBox.max - nodeBox.min) * 0.5f;
+                // https://bartwronski.com/2017/04/13/cull-that-cone/
+                glm::vec3 v = center - apex;
+                float vLenSq = glm::dot(v, v);
+                float v1Len = glm::dot(v, direction);
+                float distanceClosestPoint = cosAngle * std::sqrt(glm::max(0.0f, vLenSq - v1Len * v1Len)) - v1Len * sinAngle;
+                bool angleCull = distanceClosestPoint > radius;
+                bool frontCull = v1Len > radius + range;
+                bool backCull = v1Len < -radius;
+                return !(angleCull || frontCull || backCull);
+            }, callback);
+        }
+
+        // callback(userData, maxDistance) is called for every leaf hit by the ray within maxDistance and returns the new maxDistance
+        // (e.g. the distance to the closest hit found so far, or 0 to stop). direction has to be normalized
+        template<typename Callback>
+        void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Callback callback) const {
+            if(mRoot == NULL_NODE) return;
+            glm::vec3 invDir = 1.0f / direction;
+            int stack[256];
+            int stackSize = 0;
+            stack[stackSize++] = mRoot;
+            while(stackSize > 0 && maxDistance > 0.0f) {
+                const Node& node = mNodes[stack[--stackSize]];
+                // slab test
+                glm::vec3 t1 = (node.box.min - origin) * invDir;
+                glm::vec3 t2 = (node.box.max - origin) * invDir;
+                glm::vec3 tmin = glm::min(t1, t2), tmax = glm::max(t1, t2);
+                float enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+                float exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxDistance));
+                if(enter > exit) continue;
+
+                if(node.isLeaf()) {
+                    maxDistance = callback(node.userData, maxDistance);
+                } else {
+                    stack[stackSize++] = node.child1;
+                    stack[stackSize++] = node.child2;
+                }
+            }
+        }
+    };
+}
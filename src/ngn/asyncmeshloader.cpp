@@ -0,0 +1,157 @@
+#include <chrono>
+#include <algorithm>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "asyncmeshloader.hpp"
+#include "mesh_cache.hpp"
+
+namespace ngn {
+    AsyncMeshLoader::FileJob::FileJob(const char* filename, bool merge, const VertexFormat& format, bool optimize, bool cache, const Callback& callback) :
+            filename(filename), merge(merge), format(format), optimize(optimize), cache(cache), callback(callback),
+            cacheKey(0), scene(nullptr), pendingMeshes(0), compiledMeshes(0) {}
+
+    // here, because Assimp::Importer is incomplete in the header
+    AsyncMeshLoader::FileJob::~FileJob() {}
+
+    AsyncMeshLoader::AsyncMeshLoader(unsigned int threadCount) : mQuit(false) {
+        if(threadCount == 0) {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+        for(unsigned int i = 0; i < threadCount; ++i) mThreads.emplace_back(&AsyncMeshLoader::workerLoop, this);
+    }
+
+    AsyncMeshLoader::~AsyncMeshLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+            mTasks.clear();
+        }
+        mTaskAvailable.notify_all();
+        for(auto& thread : mThreads) thread.join();
+
+        for(auto job : mJobs) {
+            for(auto& mesh : job->meshes) delete mesh.second;
+            delete job;
+        }
+    }
+
+    void AsyncMeshLoader::load(const char* filename, bool merge, const VertexFormat& format, const Callback& callback, bool optimize, bool cache) {
+        FileJob* job = new FileJob(filename, merge, format, optimize, cache, callback);
+        mJobs.push_back(job);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.push_back(Task{job, -1});
+        }
+        mTaskAvailable.notify_one();
+    }
+
+    void AsyncMeshLoader::workerLoop() {
+        while(true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mTaskAvailable.wait(lock, [this]() {return mQuit || !mTasks.empty();});
+                if(mQuit) return;
+                task = mTasks.front();
+                mTasks.pop_front();
+            }
+            if(task.meshIndex < 0)
+                importFile(task.job);
+            else
+                convertMesh(task.job, task.meshIndex);
+        }
+    }
+
+    void AsyncMeshLoader::importFile(FileJob* job) {
+        if(job->cache) {
+            job->cacheKey = getAssimpMeshCacheKey(job->filename.c_str(), job->merge, job->format, job->optimize);
+            job->cache = job->cacheKey != 0;
+            if(job->cache && loadMeshCache((job->filename + ".ngnmesh").c_str(), job->cacheKey, job->meshes)) {
+                finishJob(job);
+                return;
+            }
+        }
+
+        job->importer.reset(new Assimp::Importer);
+        job->scene = job->importer->ReadFile(job->filename.c_str(), getAssimpImportFlags(job->merge));
+        if(!job->scene || job->scene->mNumMeshes == 0) {
+            if(!job->scene) LOG_ERROR("Mesh file '%s' could not be loaded: %s", job->filename.c_str(), job->importer->GetErrorString());
+            job->importer.reset();
+            finishJob(job);
+            return;
+        }
+
+        size_t meshCount = job->scene->mNumMeshes;
+        job->meshes.resize(meshCount, std::make_pair(std::string(), static_cast<Mesh*>(nullptr)));
+        job->pendingMeshes = meshCount;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(size_t i = 0; i < meshCount; ++i) mTasks.push_back(Task{job, static_cast<int>(i)});
+        }
+        mTaskAvailable.notify_all();
+    }
+
+    void AsyncMeshLoader::convertMesh(FileJob* job, int meshIndex) {
+        aiMesh* mesh = job->scene->mMeshes[meshIndex];
+        // the workers already use every core, more threads per mesh would only compete with them
+        job->meshes[meshIndex] = std::make_pair(std::string(mesh->mName.C_Str()), assimpMesh(mesh, job->format, job->optimize, 1));
+
+        // the last one cleans up
+        if(--job->pendingMeshes == 0) {
+            job->importer.reset();
+            job->scene = nullptr;
+            if(job->cache && !saveMeshCache((job->filename + ".ngnmesh").c_str(), job->cacheKey, job->meshes)) {
+                LOG_WARNING("Could not write mesh cache for '%s'.", job->filename.c_str());
+            }
+            finishJob(job);
+        }
+    }
+
+    void AsyncMeshLoader::finishJob(FileJob* job) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinished.push_back(job);
+    }
+
+    size_t AsyncMeshLoader::update(float budgetMs) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCompiling.insert(mCompiling.end(), mFinished.begin(), mFinished.end());
+            mFinished.clear();
+        }
+
+        size_t delivered = 0;
+        while(!mCompiling.empty()) {
+            FileJob* job = mCompiling.front();
+            while(job->compiledMeshes < job->meshes.size()) {
+                // uploads the buffers too
+                job->meshes[job->compiledMeshes++].second->compile();
+                std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                if(elapsed.count() >= budgetMs) break;
+            }
+            // out of time
+            if(job->compiledMeshes < job->meshes.size()) break;
+
+            mCompiling.pop_front();
+            mJobs.erase(std::find(mJobs.begin(), mJobs.end(), job));
+            if(job->callback) {
+                job->callback(job->filename, job->meshes);
+            } else {
+                for(auto& mesh : job->meshes) delete mesh.second;
+            }
+            delete job;
+            ++delivered;
+        }
+        return delivered;
+    }
+
+    void AsyncMeshLoader::finish() {
+        while(!mJobs.empty()) {
+            update(1000.0f);
+            if(!mJobs.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
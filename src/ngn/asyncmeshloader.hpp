@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <utility>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "mesh.hpp"
+
+struct aiScene;
+namespace Assimp {
+    class Importer;
+}
+
+namespace ngn {
+    // Loads mesh files like assimpMeshes, but on worker threads: the mesh cache lookup, the import and the conversion and optimization
+    // of every mesh (one task per mesh, so big files use multiple threads too). The GL work (uploading the buffers and compiling the VAOs)
+    // is done in update, which has to be called on the thread with the GL context (e.g. once per frame) and only works for as long as
+    // the given time budget allows. When all meshes of a file are uploaded, the callback is called (also from update) and gets ownership of them.
+    class AsyncMeshLoader {
+    public:
+        using MeshList = std::vector<std::pair<std::string, Mesh*> >;
+        using Callback = std::function<void(const std::string& filename, MeshList& meshes)>;
+
+    private:
+        struct FileJob {
+            std::string filename;
+            bool merge;
+            VertexFormat format;
+            bool optimize;
+            bool cache;
+            Callback callback;
+
+            uint64_t cacheKey;
+            std::unique_ptr<Assimp::Importer> importer;
+            const aiScene* scene;
+            MeshList meshes;
+            std::atomic<size_t> pendingMeshes;
+            // only touched by update
+            size_t compiledMeshes;
+
+            FileJob(const char* filename, bool merge, const VertexFormat& format, bool optimize, bool cache, const Callback& callback);
+            ~FileJob();
+        };
+
+        struct Task {
+            FileJob* job;
+            // -1 means import the file
+            int meshIndex;
+        };
+
+        std::vector<std::thread> mThreads;
+        std::mutex mMutex;
+        std::condition_variable mTaskAvailable;
+        std::deque<Task> mTasks;
+        bool mQuit;
+        // guarded by mMutex, moved to mCompiling in update
+        std::vector<FileJob*> mFinished;
+
+        // only used by the thread calling load and update
+        std::deque<FileJob*> mCompiling;
+        std::vector<FileJob*> mJobs;
+
+        void workerLoop();
+        void importFile(FileJob* job);
+        void convertMesh(FileJob* job, int meshIndex);
+        void finishJob(FileJob* job);
+
+    public:
+        // threadCount = 0 uses one thread less than there are hardware threads (so the render thread has one for itself), but at least one
+        AsyncMeshLoader(unsigned int threadCount = 0);
+        // Waits for the running tasks, drops the queued ones and deletes all meshes, that were not handed to a callback yet
+        ~AsyncMeshLoader();
+
+        AsyncMeshLoader(const AsyncMeshLoader& other) = delete;
+        AsyncMeshLoader& operator=(const AsyncMeshLoader& other) = delete;
+
+        // Parameters like assimpMeshes
+        void load(const char* filename, bool merge, const VertexFormat& format, const Callback& callback, bool optimize = false, bool cache = true);
+
+        // Compiles meshes of finished files until budgetMs milliseconds are used up (at least one mesh is compiled every call, if there is one),
+        // then calls the callbacks of the files that are completely compiled. Returns the number of files that were handed out
+        size_t update(float budgetMs = 2.0f);
+        // Calls update until everything that was requested is handed out (e.g. for a loading screen that can't show anything anyways)
+        void finish();
+
+        // Files that were requested, but not handed to their callback yet
+        size_t getPendingCount() const {return mJobs.size();}
+    };
+}
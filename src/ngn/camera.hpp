@@ -1,11 +1,15 @@
 #pragma once
 
 #include "scenenode.hpp"
+#include "culling.hpp"
+#include "mesh_vertexlayout.hpp"
 
 namespace ngn {
     //TODO: Camera has to account for parent transforms
     class Camera : public SceneNode {
     protected:
+        using DebugMeshLayout = VertexLayout<Position<> >;
+
         glm::mat4 mProjectionMatrix;
         Mesh* mDebugMesh;
         float mNear, mFar;
@@ -37,14 +41,16 @@ namespace ngn {
             return glm::inverse(getProjectionMatrix());
         }
 
+        // world space
+        Frustum getFrustum() const {
+            return Frustum(getProjectionMatrix() * getViewMatrix());
+        }
+
         virtual void updateProjectionMatrix() = 0;
 
         void addDebugMesh() {
-            VertexFormat vFormat;
-            vFormat.add(AttributeType::POSITION, 3, AttributeDataType::F32);
-
             mDebugMesh = new Mesh(Mesh::DrawMode::LINES);
-            mDebugMesh->addVertexBuffer(vFormat, 24, UsageHint::DYNAMIC);
+            mDebugMesh->addVertexBuffer(DebugMeshLayout::getVertexFormat(), 24, UsageHint::DYNAMIC);
             updateDebugMesh();
             setMesh(mDebugMesh);
             setMaterial(Material::fallback);
@@ -52,7 +58,8 @@ namespace ngn {
 
         void updateDebugMesh() {
             if(mDebugMesh) {
-                auto position = mDebugMesh->getAccessor<glm::vec3>(AttributeType::POSITION);
+                VertexBuffer* vBuf = mDebugMesh->hasAttribute(AttributeType::POSITION);
+                DebugMeshLayout::Vertex* vertices = DebugMeshLayout::getVertices(*vBuf);
                 glm::mat4 inverseProject = getInverseProjectionMatrix();
                 glm::vec3 frustumCorners[8]; // view space
                 // near
@@ -71,20 +78,20 @@ namespace ngn {
                 for(int i = 0; i < 4; ++i) {
                     int next = i<3 ? i+1 : i-3;
                     // near
-                    position[index++] = frustumCorners[i];
-                    position[index++] = frustumCorners[next];
+                    vertices[index++].position = frustumCorners[i];
+                    vertices[index++].position = frustumCorners[next];
                     // far
-                    position[index++] = frustumCorners[i+4];
-                    position[index++] = frustumCorners[next+4];
+                    vertices[index++].position = frustumCorners[i+4];
+                    vertices[index++].position = frustumCorners[next+4];
                 }
 
                 // frustum edges between near and far
                 for(int i = 0; i < 4; ++i) {
-                    position[index++] = frustumCorners[i];
-                    position[index++] = frustumCorners[i+4];
+                    vertices[index++].position = frustumCorners[i];
+                    vertices[index++].position = frustumCorners[i+4];
                 }
 
-                mDebugMesh->hasAttribute(AttributeType::POSITION)->upload();
+                vBuf->upload();
                 mDebugMesh->updateBoundingBox();
             }
         }
@@ -0,0 +1,130 @@
+#include <cstring>
+#include <algorithm>
+
+#include "compression.hpp"
+
+namespace ngn {
+    static const size_t MIN_MATCH = 4;
+    static const size_t MAX_OFFSET = 65535;
+    static const int HASH_BITS = 14;
+
+    static uint32_t read32(const uint8_t* data) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    // lengths that don't fit into the 4 bits of the token are continued in bytes of 255 until one is smaller
+    static void writeLength(std::vector<uint8_t>& out, size_t length) {
+        for(; length >= 255; length -= 255) out.push_back(255);
+        out.push_back(static_cast<uint8_t>(length));
+    }
+
+    static bool readLength(const uint8_t*& in, const uint8_t* end, size_t& length) {
+        uint8_t byte;
+        do {
+            if(in >= end) return false;
+            byte = *in++;
+            length += byte;
+        } while(byte == 255);
+        return true;
+    }
+
+    static void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+        size_t matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+        out.push_back(static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+        if(literalCount >= 15) writeLength(out, literalCount - 15);
+        out.insert(out.end(), literals, literals + literalCount);
+        // the last sequence has only literals
+        if(matchLength == 0) return;
+        out.push_back(static_cast<uint8_t>(offset & 0xff));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if(matchCode >= 15) writeLength(out, matchCode - 15);
+    }
+
+    std::vector<uint8_t> compressElements(const void* data, size_t size, size_t elementSize) {
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        if(elementSize == 0) elementSize = 1;
+        size_t count = size / elementSize;
+
+        // byte planes, delta coded (a trailing partial element is copied as it is)
+        std::vector<uint8_t> filtered(size);
+        for(size_t b = 0; b < elementSize; ++b) {
+            uint8_t* plane = filtered.data() + b * count;
+            uint8_t previous = 0;
+            for(size_t i = 0; i < count; ++i) {
+                uint8_t value = src[i * elementSize + b];
+                plane[i] = value - previous;
+                previous = value;
+            }
+        }
+        std::memcpy(filtered.data() + count * elementSize, src + count * elementSize, size - count * elementSize);
+
+        std::vector<uint8_t> out;
+        out.reserve(size / 2 + 16);
+        // position + 1 of the last occurence of a hash of 4 bytes, 0 is empty
+        std::vector<uint32_t> table(1 << HASH_BITS, 0);
+        const uint8_t* in = filtered.data();
+        size_t pos = 0, anchor = 0;
+        while(pos + MIN_MATCH <= size) {
+            uint32_t hash = (read32(in + pos) * 2654435761u) >> (32 - HASH_BITS);
+            size_t candidate = table[hash];
+            table[hash] = pos + 1;
+            if(candidate > 0 && pos - (candidate - 1) <= MAX_OFFSET && read32(in + candidate - 1) == read32(in + pos)) {
+                candidate -= 1;
+                size_t length = MIN_MATCH;
+                while(pos + length < size && in[candidate + length] == in[pos + length]) ++length;
+                writeSequence(out, in + anchor, pos - anchor, pos - candidate, length);
+                pos += length;
+                anchor = pos;
+            } else {
+                ++pos;
+            }
+        }
+        writeSequence(out, in + anchor, size - anchor, 0, 0);
+        out.shrink_to_fit();
+        return out;
+    }
+
+    bool decompressElements(const uint8_t* compressed, size_t compressedSize, void* data, size_t size, size_t elementSize) {
+        if(elementSize == 0) elementSize = 1;
+        std::vector<uint8_t> filtered(size);
+        const uint8_t* in = compressed;
+        const uint8_t* end = compressed + compressedSize;
+        size_t pos = 0;
+        while(in < end) {
+            uint8_t token = *in++;
+            size_t literalCount = token >> 4;
+            if(literalCount == 15 && !readLength(in, end, literalCount)) return false;
+            if(literalCount > static_cast<size_t>(end - in) || literalCount > size - pos) return false;
+            std::memcpy(filtered.data() + pos, in, literalCount);
+            in += literalCount;
+            pos += literalCount;
+            if(in == end) break;
+
+            if(end - in < 2) return false;
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t length = token & 15;
+            if(length == 15 && !readLength(in, end, length)) return false;
+            length += MIN_MATCH;
+            if(offset == 0 || offset > pos || length > size - pos) return false;
+            // byte by byte, because the match may overlap with itself
+            for(size_t i = 0; i < length; ++i, ++pos) filtered[pos] = filtered[pos - offset];
+        }
+        if(pos != size) return false;
+
+        uint8_t* dst = static_cast<uint8_t*>(data);
+        size_t count = size / elementSize;
+        for(size_t b = 0; b < elementSize; ++b) {
+            const uint8_t* plane = filtered.data() + b * count;
+            uint8_t value = 0;
+            for(size_t i = 0; i < count; ++i) {
+                value += plane[i];
+                dst[i * elementSize + b] = value;
+            }
+        }
+        std::memcpy(dst + count * elementSize, filtered.data() + count * elementSize, size - count * elementSize);
+        return true;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ngn {
+    // Lossless compression for arrays of fixed size elements (vertices, indices), that are kept in memory, but rarely read
+    // (see ResidencyPolicy in mesh_vertexdata.hpp). The bytes are grouped by their position in the element first (byte 0 of every
+    // element, then byte 1, ...) and delta coded, which turns similar neighbouring values (positions, normals, ascending indices)
+    // into runs of small numbers, then they are compressed with a simple LZ77 coder (like LZ4). This is fast rather than small.
+    std::vector<uint8_t> compressElements(const void* data, size_t size, size_t elementSize);
+
+    // size is the uncompressed size, returns false if the compressed data is corrupt
+    bool decompressElements(const uint8_t* compressed, size_t compressedSize, void* data, size_t size, size_t elementSize);
+}
@@ -0,0 +1,158 @@
+#include <cmath>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "culling.hpp"
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define NGN_CULLING_AVX
+    #define NGN_CULLING_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define NGN_CULLING_SSE
+#endif
+
+namespace ngn {
+    Frustum::Frustum(const glm::mat4& viewProjection) {
+        // Gribb/Hartmann: http://www.cs.otago.ac.nz/postgrads/alexis/planeExtraction.pdf
+        // glm matrices are column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for(int i = 0; i < 4; ++i) rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        planes[0] = rows[3] + rows[0];
+        planes[1] = rows[3] - rows[0];
+        planes[2] = rows[3] + rows[1];
+        planes[3] = rows[3] - rows[1];
+        planes[4] = rows[3] + rows[2];
+        planes[5] = rows[3] - rows[2];
+
+        for(int i = 0; i < 6; ++i) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    inline void transformAABB(const AABBArray& src, const glm::mat4& matrix, AABBArray& dst, size_t i) {
+    #ifdef NGN_CULLING_SSE
+        // The boxes have different matrices, so here we vectorize over the components of a single box instead
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        float center[4], extent[4];
+        const float* m = glm::value_ptr(matrix);
+        __m128 col0 = _mm_loadu_ps(m + 0);
+        __m128 col1 = _mm_loadu_ps(m + 4);
+        __m128 col2 = _mm_loadu_ps(m + 8);
+        __m128 col3 = _mm_loadu_ps(m + 12);
+
+        __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(src.centerX[i])), _mm_mul_ps(col1, _mm_set1_ps(src.centerY[i]))),
+                              _mm_add_ps(_mm_mul_ps(col2, _mm_set1_ps(src.centerZ[i])), col3));
+        __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(col0, absMask), _mm_set1_ps(src.extentX[i])),
+                                         _mm_mul_ps(_mm_and_ps(col1, absMask), _mm_set1_ps(src.extentY[i]))),
+                              _mm_mul_ps(_mm_and_ps(col2, absMask), _mm_set1_ps(src.extentZ[i])));
+        _mm_storeu_ps(center, c);
+        _mm_storeu_ps(extent, e);
+
+        dst.centerX[i] = center[0]; dst.centerY[i] = center[1]; dst.centerZ[i] = center[2];
+        dst.extentX[i] = extent[0]; dst.extentY[i] = extent[1]; dst.extentZ[i] = extent[2];
+    #else
+        const glm::mat4& m = matrix;
+        float cx = src.centerX[i], cy = src.centerY[i], cz = src.centerZ[i];
+        float ex = src.extentX[i], ey = src.extentY[i], ez = src.extentZ[i];
+        for(int j = 0; j < 3; ++j) {
+            float c = m[0][j] * cx + m[1][j] * cy + m[2][j] * cz + m[3][j];
+            float e = std::fabs(m[0][j]) * ex + std::fabs(m[1][j]) * ey + std::fabs(m[2][j]) * ez;
+            (j == 0 ? dst.centerX : (j == 1 ? dst.centerY : dst.centerZ))[i] = c;
+            (j == 0 ? dst.extentX : (j == 1 ? dst.extentY : dst.extentZ))[i] = e;
+        }
+    #endif
+    }
+
+    void transformAABBs(const AABBArray& src, const glm::mat4* matrices, AABBArray& dst) {
+        size_t count = src.size();
+        if(dst.size() != count) dst.resize(count);
+        for(size_t i = 0; i < count; ++i) transformAABB(src, matrices[i], dst, i);
+    }
+
+    void transformAABBs(const AABBArray& src, const glm::mat4* matrices, AABBArray& dst, const uint32_t* indices, size_t indexCount) {
+        if(dst.size() < src.size()) dst.resize(src.size());
+        for(size_t i = 0; i < indexCount; ++i) transformAABB(src, matrices[indices[i]], dst, indices[i]);
+    }
+
+    // A box is outside of a plane if the center is further behind it than the box's extent projected onto the plane normal
+    inline bool cullAABBScalar(const AABBArray& boxes, const Frustum& frustum, size_t i) {
+        for(int p = 0; p < 6; ++p) {
+            const glm::vec4& plane = frustum.planes[p];
+            float dist = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+            float radius = std::fabs(plane.x) * boxes.extentX[i] + std::fabs(plane.y) * boxes.extentY[i] + std::fabs(plane.z) * boxes.extentZ[i];
+            if(dist < -radius) return false;
+        }
+        return true;
+    }
+
+    void cullAABBs(const AABBArray& boxes, const Frustum& frustum, std::vector<uint32_t>& visibleMask) {
+        size_t count = boxes.size();
+        visibleMask.assign((count + 31) / 32, 0);
+
+        size_t i = 0;
+    #if defined(NGN_CULLING_AVX)
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+        for(int p = 0; p < 6; ++p) {
+            planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+            absPlaneX[p] = _mm256_and_ps(planeX[p], absMask);
+            absPlaneY[p] = _mm256_and_ps(planeY[p], absMask);
+            absPlaneZ[p] = _mm256_and_ps(planeZ[p], absMask);
+        }
+
+        for(; i + 8 <= count; i += 8) {
+            __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]), cy = _mm256_loadu_ps(&boxes.centerY[i]), cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]), ey = _mm256_loadu_ps(&boxes.extentY[i]), ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+            __m256 outside = _mm256_setzero_ps();
+            for(int p = 0; p < 6; ++p) {
+                __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy)),
+                                            _mm256_add_ps(_mm256_mul_ps(planeZ[p], cz), planeW[p]));
+                __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absPlaneX[p], ex), _mm256_mul_ps(absPlaneY[p], ey)),
+                                              _mm256_mul_ps(absPlaneZ[p], ez));
+                // dist + radius < 0
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(dist, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            uint32_t visible = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFFu;
+            visibleMask[i / 32] |= visible << (i % 32);
+        }
+    #elif defined(NGN_CULLING_SSE)
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+        for(int p = 0; p < 6; ++p) {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+            absPlaneX[p] = _mm_and_ps(planeX[p], absMask);
+            absPlaneY[p] = _mm_and_ps(planeY[p], absMask);
+            absPlaneZ[p] = _mm_and_ps(planeZ[p], absMask);
+        }
+
+        for(; i + 4 <= count; i += 4) {
+            __m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+            __m128 outside = _mm_setzero_ps();
+            for(int p = 0; p < 6; ++p) {
+                __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absPlaneX[p], ex), _mm_mul_ps(absPlaneY[p], ey)),
+                                           _mm_mul_ps(absPlaneZ[p], ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+            }
+            uint32_t visible = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xFu;
+            visibleMask[i / 32] |= visible << (i % 32);
+        }
+    #endif
+
+        // scalar fallback and remainder
+        for(; i < count; ++i) {
+            if(cullAABBScalar(boxes, frustum, i)) visibleMask[i / 32] |= 1u << (i % 32);
+        }
+    }
+}
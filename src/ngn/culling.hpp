@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+
+namespace ngn {
+    // Axis aligned boxes in center/extent form as a structure of arrays, so the kernels below can process 4 (SSE) or 8 (AVX) boxes at once
+    struct AABBArray {
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+
+        size_t size() const {return centerX.size();}
+
+        void resize(size_t size) {
+            centerX.resize(size); centerY.resize(size); centerZ.resize(size);
+            extentX.resize(size); extentY.resize(size); extentZ.resize(size);
+        }
+
+        void push_back(const AABoundingBox& box) {
+            resize(size() + 1);
+            set(size() - 1, box);
+        }
+
+        // Moves the last box into index and shrinks by one (like the rest of SceneNodeStorage)
+        void swapRemove(size_t index) {
+            size_t last = size() - 1;
+            centerX[index] = centerX[last]; centerY[index] = centerY[last]; centerZ[index] = centerZ[last];
+            extentX[index] = extentX[last]; extentY[index] = extentY[last]; extentZ[index] = extentZ[last];
+            resize(last);
+        }
+
+        void set(size_t index, const AABoundingBox& box) {
+            glm::vec3 center = (box.min + box.max) / 2.0f;
+            glm::vec3 extent = (box.max - box.min) / 2.0f;
+            centerX[index] = center.x; centerY[index] = center.y; centerZ[index] = center.z;
+            extentX[index] = extent.x; extentY[index] = extent.y; extentZ[index] = extent.z;
+        }
+
+        AABoundingBox get(size_t index) const {
+            glm::vec3 center(centerX[index], centerY[index], centerZ[index]);
+            glm::vec3 extent(extentX[index], extentY[index], extentZ[index]);
+            AABoundingBox ret;
+            ret.min = center - extent;
+            ret.max = center + extent;
+            return ret;
+        }
+    };
+
+    struct Frustum {
+        // left, right, bottom, top, near, far - normals point inwards and are normalized
+        // a point p is inside of a plane if dot(plane.xyz, p) + plane.w >= 0
+        glm::vec4 planes[6];
+
+        Frustum() {}
+        // pass projection * view to get world space planes
+        Frustum(const glm::mat4& viewProjection);
+    };
+
+    // Transforms every box in src by the matrix with the same index and writes the result to dst (which is resized if necessary)
+    // src and dst may be the same. Unlike AABoundingBox::transform there is no perspective divide, so only use affine matrices
+    void transformAABBs(const AABBArray& src, const glm::mat4* matrices, AABBArray& dst);
+    // Same, but only for the boxes with the given indices (the others in dst are left untouched)
+    void transformAABBs(const AABBArray& src, const glm::mat4* matrices, AABBArray& dst, const uint32_t* indices, size_t indexCount);
+
+    // Sets bit i of visibleMask (bit i % 32 of visibleMask[i / 32]) if box i intersects the frustum or is inside of it
+    // This is conservative: boxes close to the frustum corners might be reported as visible, even though they are not
+    void cullAABBs(const AABBArray& boxes, const Frustum& frustum, std::vector<uint32_t>& visibleMask);
+
+    inline bool isVisible(const std::vector<uint32_t>& visibleMask, size_t index) {
+        return (visibleMask[index / 32] & (1u << (index % 32))) != 0;
+    }
+}
@@ -0,0 +1,275 @@
+#include <algorithm>
+
+#include "geometryarena.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    size_t RangeAllocator::allocate(size_t size) {
+        for(size_t i = 0; i < mFreeRanges.size(); ++i) {
+            std::pair<size_t, size_t>& range = mFreeRanges[i];
+            if(range.second >= size) {
+                size_t offset = range.first;
+                range.first += size;
+                range.second -= size;
+                if(range.second == 0) mFreeRanges.erase(mFreeRanges.begin() + i);
+                return offset;
+            }
+        }
+        return INVALID;
+    }
+
+    void RangeAllocator::free(size_t offset, size_t size) {
+        if(size == 0) return;
+        auto next = std::lower_bound(mFreeRanges.begin(), mFreeRanges.end(), std::make_pair(offset, size_t(0)));
+        // merge with the following range
+        if(next != mFreeRanges.end() && offset + size == next->first) {
+            next->first = offset;
+            next->second += size;
+        } else {
+            next = mFreeRanges.insert(next, std::make_pair(offset, size));
+        }
+        // and the previous one
+        if(next != mFreeRanges.begin()) {
+            auto prev = next - 1;
+            if(prev->first + prev->second == next->first) {
+                prev->second += next->second;
+                mFreeRanges.erase(next);
+            }
+        }
+    }
+
+    void RangeAllocator::grow(size_t capacity) {
+        if(capacity <= mCapacity) return;
+        size_t oldCapacity = mCapacity;
+        mCapacity = capacity;
+        free(oldCapacity, capacity - oldCapacity);
+    }
+
+    GeometryArena::Pool::Pool(const VertexFormat& format, IndexBufferType indexType, UsageHint usage, size_t vertexCapacity, size_t indexCapacity) :
+            mFormat(format), mIndexType(indexType), mUsage(usage), mVBO(0), mIBO(0), mVAO(0) {
+        growBuffer(mVBO, 0, vertexCapacity, mFormat.getStride());
+        growBuffer(mIBO, 0, indexCapacity, getIndexBufferTypeSize(mIndexType));
+        mVertices.grow(vertexCapacity);
+        mIndices.grow(indexCapacity);
+        compile();
+    }
+
+    GeometryArena::Pool::~Pool() {
+        Mesh::deleteVAO(mVAO);
+        glDeleteBuffers(1, &mVBO);
+        glDeleteBuffers(1, &mIBO);
+    }
+
+    void GeometryArena::Pool::compile() {
+        if(mVAO == 0) glGenVertexArrays(1, &mVAO);
+        Mesh::bindVAO(mVAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+        const std::vector<VertexAttribute>& attributes = mFormat.getAttributes();
+        for(size_t i = 0; i < attributes.size(); ++i) {
+            const VertexAttribute& attr = attributes[i];
+            int location = static_cast<int>(attr.type);
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, attr.alignedNum, static_cast<GLenum>(attr.dataType),
+                                  attr.normalized ? GL_TRUE : GL_FALSE,
+                                  mFormat.getStride(), reinterpret_cast<GLvoid*>(mFormat.getAttributeOffset(i)));
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO);
+
+        Mesh::bindVAO(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    bool GeometryArena::Pool::growBuffer(GLuint& buffer, size_t oldCapacity, size_t capacity, size_t elementSize) {
+        if(capacity <= oldCapacity && buffer != 0) return false;
+
+        GLuint newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * elementSize, nullptr, static_cast<GLenum>(mUsage));
+        if(buffer != 0) {
+            // the copy stays on the GPU
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity * elementSize);
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = newBuffer;
+        return true;
+    }
+
+    size_t GeometryArena::Pool::allocateVertices(size_t count) {
+        size_t offset = mVertices.allocate(count);
+        if(offset == RangeAllocator::INVALID) {
+            size_t capacity = std::max(mVertices.getCapacity() * 2, mVertices.getCapacity() + count);
+            growBuffer(mVBO, mVertices.getCapacity(), capacity, mFormat.getStride());
+            mVertices.grow(capacity);
+            // the VAO still points to the old buffer
+            compile();
+            offset = mVertices.allocate(count);
+        }
+        return offset;
+    }
+
+    size_t GeometryArena::Pool::allocateIndices(size_t count) {
+        size_t offset = mIndices.allocate(count);
+        if(offset == RangeAllocator::INVALID) {
+            size_t capacity = std::max(mIndices.getCapacity() * 2, mIndices.getCapacity() + count);
+            growBuffer(mIBO, mIndices.getCapacity(), capacity, getIndexBufferTypeSize(mIndexType));
+            mIndices.grow(capacity);
+            compile();
+            offset = mIndices.allocate(count);
+        }
+        return offset;
+    }
+
+    void GeometryArena::Pool::uploadVertices(size_t offset, size_t count, const void* data) {
+        size_t stride = mFormat.getStride();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mVBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset * stride, count * stride, data);
+    }
+
+    void GeometryArena::Pool::uploadIndices(size_t offset, size_t count, const void* data) {
+        size_t size = getIndexBufferTypeSize(mIndexType);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mIBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset * size, count * size, data);
+    }
+
+    GeometryArena::Allocation GeometryArena::allocate(const VertexFormat& format, size_t vertexCount, size_t indexCount) {
+        Allocation allocation;
+        // the indices are relative to the base vertex
+        IndexBufferType indexType = vertexCount <= (1 << 16) ? IndexBufferType::UI16 : IndexBufferType::UI32;
+
+        Pool* pool = nullptr;
+        for(auto& p : mPools) {
+            if(p->getIndexType() == indexType && p->getVertexFormat() == format) {
+                pool = p.get();
+                break;
+            }
+        }
+        if(!pool) {
+            mPools.emplace_back(new Pool(format, indexType, mUsage,
+                std::max(mInitialVertexCapacity, vertexCount), std::max(mInitialIndexCapacity, indexCount)));
+            pool = mPools.back().get();
+        }
+
+        allocation.vertexOffset = pool->allocateVertices(vertexCount);
+        allocation.indexOffset = pool->allocateIndices(indexCount);
+        if(allocation.vertexOffset == RangeAllocator::INVALID || allocation.indexOffset == RangeAllocator::INVALID) {
+            LOG_ERROR("Could not allocate %d vertices and %d indices in the geometry arena.", static_cast<int>(vertexCount), static_cast<int>(indexCount));
+            if(allocation.vertexOffset != RangeAllocator::INVALID) pool->freeVertices(allocation.vertexOffset, vertexCount);
+            if(allocation.indexOffset != RangeAllocator::INVALID) pool->freeIndices(allocation.indexOffset, indexCount);
+            return Allocation();
+        }
+        allocation.pool = pool;
+        allocation.vertexCount = vertexCount;
+        allocation.indexCount = indexCount;
+        return allocation;
+    }
+
+    void GeometryArena::free(Allocation& allocation) {
+        if(!allocation.pool) return;
+        allocation.pool->freeVertices(allocation.vertexOffset, allocation.vertexCount);
+        allocation.pool->freeIndices(allocation.indexOffset, allocation.indexCount);
+        allocation = Allocation();
+    }
+
+    template<typename T>
+    static void appendIndices(std::vector<T>& dst, const IndexBuffer& indexBuffer) {
+        for(size_t i = 0; i < indexBuffer.getNumIndices(); ++i) dst.push_back(static_cast<T>(indexBuffer[i]));
+    }
+
+    template<typename T>
+    static void uploadArenaIndices(GeometryArena::Pool& pool, size_t offset, const IndexBuffer& indexBuffer,
+            const std::vector<const IndexBuffer*>& lodIndexBuffers) {
+        std::vector<T> indices;
+        appendIndices(indices, indexBuffer);
+        for(auto lodIndices : lodIndexBuffers) appendIndices(indices, *lodIndices);
+        pool.uploadIndices(offset, indices.size(), indices.data());
+    }
+
+    bool Mesh::setArena(GeometryArena* arena) {
+        if(mArena) {
+            mArena->free(mArenaAllocation);
+            mArenaIndexRanges.clear();
+            mArena = nullptr;
+        }
+        if(!arena) return true;
+
+        if(mVertexBuffers.size() != 1 || !mIndexBuffer) {
+            LOG_ERROR("Only meshes with exactly one vertex buffer and an index buffer can be placed in a geometry arena.");
+            return false;
+        }
+        const VertexBuffer& vBuf = *mVertexBuffers[0];
+        for(auto& attr : vBuf.getVertexFormat().getAttributes()) {
+            if(attr.divisor > 0) {
+                LOG_ERROR("Meshes with instanced attributes can not be placed in a geometry arena.");
+                return false;
+            }
+        }
+        if(!vBuf.canRestoreLocal() || !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("The mesh needs a local copy of it's data to be placed in a geometry arena.");
+            return false;
+        }
+
+        std::vector<const IndexBuffer*> lodIndexBuffers;
+        size_t indexCount = mIndexBuffer->getNumIndices();
+        for(auto& lod : mLods) {
+            lodIndexBuffers.push_back(lod.indexBuffer.get());
+            indexCount += lod.indexBuffer->getNumIndices();
+        }
+
+        GeometryArena::Allocation allocation = arena->allocate(vBuf.getVertexFormat(), vBuf.getNumVertices(), indexCount);
+        if(!allocation.pool) return false;
+
+        allocation.pool->uploadVertices(allocation.vertexOffset, allocation.vertexCount, vBuf.getData());
+        if(allocation.pool->getIndexType() == IndexBufferType::UI16) {
+            uploadArenaIndices<uint16_t>(*allocation.pool, allocation.indexOffset, *mIndexBuffer, lodIndexBuffers);
+        } else {
+            uploadArenaIndices<uint32_t>(*allocation.pool, allocation.indexOffset, *mIndexBuffer, lodIndexBuffers);
+        }
+
+        size_t offset = allocation.indexOffset;
+        mArenaIndexRanges.push_back(std::make_pair(offset, mIndexBuffer->getNumIndices()));
+        offset += mIndexBuffer->getNumIndices();
+        for(auto lodIndices : lodIndexBuffers) {
+            mArenaIndexRanges.push_back(std::make_pair(offset, lodIndices->getNumIndices()));
+            offset += lodIndices->getNumIndices();
+        }
+
+        mArena = arena;
+        mArenaAllocation = allocation;
+        // nothing is uploaded to the buffers of the mesh itself
+        applyResidencyPolicy();
+        return true;
+    }
+
+    bool MultiDraw::add(const Mesh& mesh, int lod) {
+        const GeometryArena::Allocation& allocation = mesh.getArenaAllocation();
+        GLenum mode = static_cast<GLenum>(mesh.getDrawMode());
+        if(!mesh.getArena()) return false;
+        if(mPool && (allocation.pool != mPool || mode != mMode)) return false;
+        mPool = allocation.pool;
+        mMode = mode;
+
+        const std::pair<size_t, size_t>& range = mesh.getArenaIndexRange(lod);
+        mCounts.push_back(range.second);
+        mOffsets.push_back(reinterpret_cast<const void*>(range.first * getIndexBufferTypeSize(mPool->getIndexType())));
+        mBaseVertices.push_back(allocation.vertexOffset);
+        return true;
+    }
+
+    void MultiDraw::clear() {
+        mPool = nullptr;
+        mCounts.clear();
+        mOffsets.clear();
+        mBaseVertices.clear();
+    }
+
+    void MultiDraw::draw() const {
+        if(mCounts.empty()) return;
+        Mesh::bindVAO(mPool->getVAO());
+        glMultiDrawElementsBaseVertex(mMode, mCounts.data(), static_cast<GLenum>(mPool->getIndexType()),
+            mOffsets.data(), mCounts.size(), mBaseVertices.data());
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstddef>
+
+#include <glad/glad.h>
+
+#include "mesh_vertexdata.hpp"
+
+namespace ngn {
+    class Mesh;
+
+    // First fit allocator for ranges of [0, capacity). Adjacent free ranges are merged when freeing.
+    class RangeAllocator {
+    private:
+        // sorted by offset
+        std::vector<std::pair<size_t, size_t> > mFreeRanges;
+        size_t mCapacity;
+
+    public:
+        static const size_t INVALID = static_cast<size_t>(-1);
+
+        RangeAllocator(size_t capacity = 0) : mCapacity(0) {grow(capacity);}
+
+        // Returns INVALID if there is no free range big enough
+        size_t allocate(size_t size);
+        void free(size_t offset, size_t size);
+        // Makes [old capacity, capacity) available
+        void grow(size_t capacity);
+
+        size_t getCapacity() const {return mCapacity;}
+    };
+
+    // Large vertex and index buffers that are shared by many meshes (see Mesh::setArena), so that all meshes with the same vertex format
+    // use the same VAO and can be drawn one after another without rebinding it (with glDrawElementsBaseVertex) or with a single
+    // glMultiDrawElementsBaseVertex (see MultiDraw). There is one pool per vertex format and index type (16 bit indices are used for
+    // meshes with less than 65536 vertices, since the indices are relative to the base vertex).
+    // The arena has to outlive all meshes that were placed in it.
+    class GeometryArena {
+    public:
+        class Pool {
+        private:
+            VertexFormat mFormat;
+            IndexBufferType mIndexType;
+            UsageHint mUsage;
+            GLuint mVBO, mIBO, mVAO;
+            RangeAllocator mVertices, mIndices;
+
+            void compile();
+            // Reallocates the buffer (and copies the old contents over) if it's smaller than capacity, returns false if it was big enough
+            bool growBuffer(GLuint& buffer, size_t oldCapacity, size_t capacity, size_t elementSize);
+
+        public:
+            Pool(const VertexFormat& format, IndexBufferType indexType, UsageHint usage, size_t vertexCapacity, size_t indexCapacity);
+            ~Pool();
+
+            Pool(const Pool& other) = delete;
+            Pool& operator=(const Pool& other) = delete;
+
+            const VertexFormat& getVertexFormat() const {return mFormat;}
+            IndexBufferType getIndexType() const {return mIndexType;}
+            GLuint getVAO() const {return mVAO;}
+            size_t getVertexCapacity() const {return mVertices.getCapacity();}
+            size_t getIndexCapacity() const {return mIndices.getCapacity();}
+
+            // Grows the buffers if needed. Returns RangeAllocator::INVALID if it failed
+            size_t allocateVertices(size_t count);
+            size_t allocateIndices(size_t count);
+            void freeVertices(size_t offset, size_t count) {mVertices.free(offset, count);}
+            void freeIndices(size_t offset, size_t count) {mIndices.free(offset, count);}
+
+            void uploadVertices(size_t offset, size_t count, const void* data);
+            void uploadIndices(size_t offset, size_t count, const void* data);
+        };
+
+        struct Allocation {
+            Pool* pool;
+            size_t vertexOffset, vertexCount;
+            size_t indexOffset, indexCount;
+
+            Allocation() : pool(nullptr), vertexOffset(0), vertexCount(0), indexOffset(0), indexCount(0) {}
+        };
+
+    private:
+        UsageHint mUsage;
+        size_t mInitialVertexCapacity, mInitialIndexCapacity;
+        std::vector<std::unique_ptr<Pool> > mPools;
+
+    public:
+        // Pools start with space for this many vertices/indices (or as much as the first mesh needs) and double in size when they are full
+        GeometryArena(UsageHint usage = UsageHint::STATIC, size_t initialVertexCapacity = 1 << 16, size_t initialIndexCapacity = 1 << 18) :
+                mUsage(usage), mInitialVertexCapacity(initialVertexCapacity), mInitialIndexCapacity(initialIndexCapacity) {}
+
+        GeometryArena(const GeometryArena& other) = delete;
+        GeometryArena& operator=(const GeometryArena& other) = delete;
+
+        // Returns an allocation with pool = nullptr if it failed
+        Allocation allocate(const VertexFormat& format, size_t vertexCount, size_t indexCount);
+        void free(Allocation& allocation);
+
+        size_t getPoolCount() const {return mPools.size();}
+        const Pool* getPool(size_t index) const {return mPools[index].get();}
+    };
+
+    // A list of draws from the same pool that is submitted as a single glMultiDrawElementsBaseVertex.
+    // Useful for passes that don't need any uniforms per mesh, e.g. a depth pre-pass of static geometry
+    class MultiDraw {
+    private:
+        const GeometryArena::Pool* mPool;
+        GLenum mMode;
+        std::vector<GLsizei> mCounts;
+        std::vector<const void*> mOffsets;
+        std::vector<GLint> mBaseVertices;
+
+    public:
+        MultiDraw() : mPool(nullptr), mMode(GL_TRIANGLES) {}
+
+        // Returns false if the mesh is not in an arena or in another pool or has another draw mode than the meshes already added
+        bool add(const Mesh& mesh, int lod = 0);
+        void clear();
+        void draw() const;
+
+        size_t getDrawCount() const {return mCounts.size();}
+    };
+}
@@ -5,6 +5,7 @@
 #include <cstdio>
 #include <stdio.h>
 #include <sstream>
+#include <mutex>
 
 #include "log.hpp"
 
@@ -71,7 +72,11 @@ namespace ngn {
 		return &tm;
 	}
 
+    // log is called from the mesh loader threads too (localtime and the handlers are not thread safe)
+    static std::mutex logMutex;
+
     void log(LogLevel level, const char* filename, int line, const char* format, ...) {
+        std::lock_guard<std::mutex> lock(logMutex);
         std::unordered_map<std::string, std::string> formatArguments;
         unsigned intLevel = static_cast<unsigned>(level);
         formatArguments["levelname"] = intLevel < 5 ? levelNameMap[intLevel] : std::to_string(intLevel);
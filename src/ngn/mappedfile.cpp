@@ -0,0 +1,85 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+
+namespace ngn {
+#ifdef _WIN32
+    MappedFile::MappedFile() : mData(nullptr), mSize(0), mFileHandle(INVALID_HANDLE_VALUE), mMappingHandle(nullptr) {}
+
+    bool MappedFile::open(const char* filename) {
+        close();
+
+        mFileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(mFileHandle == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(mFileHandle, &size) || size.QuadPart == 0) {
+            close();
+            return false;
+        }
+
+        mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mMappingHandle) {
+            close();
+            return false;
+        }
+
+        mData = static_cast<const uint8_t*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if(!mData) {
+            close();
+            return false;
+        }
+        mSize = static_cast<size_t>(size.QuadPart);
+        return true;
+    }
+
+    void MappedFile::close() {
+        if(mData) UnmapViewOfFile(mData);
+        if(mMappingHandle) CloseHandle(mMappingHandle);
+        if(mFileHandle != INVALID_HANDLE_VALUE) CloseHandle(mFileHandle);
+        mData = nullptr;
+        mSize = 0;
+        mMappingHandle = nullptr;
+        mFileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    MappedFile::MappedFile() : mData(nullptr), mSize(0), mFileDescriptor(-1) {}
+
+    bool MappedFile::open(const char* filename) {
+        close();
+
+        mFileDescriptor = ::open(filename, O_RDONLY);
+        if(mFileDescriptor < 0) return false;
+
+        struct stat fileStat;
+        if(fstat(mFileDescriptor, &fileStat) != 0 || fileStat.st_size == 0) {
+            close();
+            return false;
+        }
+
+        void* data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, mFileDescriptor, 0);
+        if(data == MAP_FAILED) {
+            close();
+            return false;
+        }
+        mData = static_cast<const uint8_t*>(data);
+        mSize = fileStat.st_size;
+        return true;
+    }
+
+    void MappedFile::close() {
+        if(mData) munmap(const_cast<uint8_t*>(mData), mSize);
+        if(mFileDescriptor >= 0) ::close(mFileDescriptor);
+        mData = nullptr;
+        mSize = 0;
+        mFileDescriptor = -1;
+    }
+#endif
+}
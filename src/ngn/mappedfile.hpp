@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ngn {
+    // Read-only memory mapping of a whole file. The pages are only read from disk when they are touched
+    class MappedFile {
+    private:
+        const uint8_t* mData;
+        size_t mSize;
+#ifdef _WIN32
+        void* mFileHandle;
+        void* mMappingHandle;
+#else
+        int mFileDescriptor;
+#endif
+
+    public:
+        MappedFile();
+        ~MappedFile() {close();}
+
+        MappedFile(const MappedFile& other) = delete;
+        MappedFile& operator=(const MappedFile& other) = delete;
+
+        // Returns false if the file does not exist, is empty or could not be mapped
+        bool open(const char* filename);
+        void close();
+
+        bool isOpen() const {return mData != nullptr;}
+        const uint8_t* getData() const {return mData;}
+        size_t getSize() const {return mSize;}
+    };
+}
@@ -67,19 +67,20 @@ namespace ngn {
             ResourceHandle<FragmentShader> mFragmentShader;
             ResourceHandle<VertexShader> mVertexShader;
 
-            mutable const ShaderProgram* mShaderProgram; // just used as cache
+            // just used as cache, permutation key -> program (see getShaderProgram)
+            mutable std::unordered_map<uint64_t, const ShaderProgram*> mShaderPrograms;
 
         public:
             //mMaterial(mat), mPassIndex(index), mStateBlock(nullptr), mShadersDirty(true),
             //mVertexShader(nullptr), mFragmentShader(nullptr), mShaderProgram(nullptr)
             Pass(const Material& mat, int index) : mMaterial(mat), mPassIndex(index), mStateBlock(nullptr),
-                    mFragmentShader(mat.getFragmentShader()), mVertexShader(mat.getVertexShader()), mShaderProgram(nullptr) {
+                    mFragmentShader(mat.getFragmentShader()), mVertexShader(mat.getVertexShader()) {
             }
 
             Pass(const Pass& other) = delete;
 
             Pass(const Material& mat, const Pass& other) : mMaterial(mat), mPassIndex(other.mPassIndex), mStateBlock(nullptr),
-                    mFragmentShader(other.getFragmentShader()), mVertexShader(other.getVertexShader()), mShaderProgram(other.mShaderProgram) {
+                    mFragmentShader(other.getFragmentShader()), mVertexShader(other.getVertexShader()), mShaderPrograms(other.mShaderPrograms) {
                 if(other.mStateBlock) mStateBlock = new RenderStateBlock(*other.mStateBlock);
             }
 
@@ -112,13 +113,20 @@ namespace ngn {
 
             int getPassIndex() const {return mPassIndex;}
 
-            const ShaderProgram* getShaderProgram() const {
+            // features are the bits of a ShaderPermutation key except for the pass, which is added here (e.g. the light type in the light pass).
+            // Every variant is compiled on first use
+            const ShaderProgram* getShaderProgram(uint64_t features = 0) const {
                 if(mFragmentShader.dirty() || mVertexShader.dirty()) { // handles point to different resource
-                    std::string defines = "#define NGN_PASS " + std::to_string(mPassIndex) + "\n";
-                    uint64_t permutationHash = mPassIndex;
-                    mShaderProgram = shaderCache.getShaderPermutation(permutationHash, mFragmentShader.getResource(), mVertexShader.getResource(), defines, defines);
+                    mShaderPrograms.clear();
                 }
-                return mShaderProgram;
+                uint64_t permutationKey = ShaderPermutation::pass(mPassIndex) | features;
+                auto it = mShaderPrograms.find(permutationKey);
+                if(it != mShaderPrograms.end()) return it->second;
+
+                std::string defines = ShaderPermutation::getDefines(permutationKey);
+                const ShaderProgram* program = shaderCache.getShaderPermutation(permutationKey, mFragmentShader.getResource(), mVertexShader.getResource(), defines, defines);
+                mShaderPrograms.insert(std::make_pair(permutationKey, program));
+                return program;
             }
         };
     private:
@@ -1,3 +1,7 @@
+#include <cstring>
+#include <cmath>
+#include <memory>
+
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <assimp/Importer.hpp>
@@ -5,13 +9,62 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mappedfile.hpp"
+#include "misc.hpp"
 
 namespace ngn {
-    GLuint Mesh::lastBoundVAO = 0;
+    GLuint Mesh::currentVAO = 0;
+    Mesh* Mesh::fallback = nullptr;
+
+    Mesh* Mesh::fromFile(const char* filename, const VertexFormat& format, bool optimize) {
+        std::vector<std::pair<std::string, Mesh*> > meshes = assimpMeshes(filename, true, format, optimize);
+        if(meshes.empty()) return nullptr;
+
+        Mesh* mesh = meshes[0].second;
+        if(meshes.size() > 1) {
+            // meshes with different materials are not merged by assimp
+            std::vector<const Mesh*> others;
+            for(size_t i = 1; i < meshes.size(); ++i) others.push_back(meshes[i].second);
+            bool merged = mesh->merge(others, std::vector<glm::mat4>(others.size(), glm::mat4()));
+            for(auto other : others) delete other;
+            if(!merged) {
+                LOG_ERROR("The meshes in '%s' could not be merged.", filename);
+                delete mesh;
+                return nullptr;
+            }
+            if(optimize) mesh->optimize();
+        }
+        return mesh;
+    }
 
-    void Mesh::compile() {
-        if(mVAO == 0) glGenVertexArrays(1, &mVAO);
-        glBindVertexArray(mVAO);
+    void Mesh::deleteVAO(GLuint& vao) {
+        if(vao == 0) return;
+        // deleting the bound VAO binds 0
+        if(currentVAO == vao) currentVAO = 0;
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+
+    uint32_t Mesh::getBufferObjectGeneration() const {
+        uint32_t generation = mIndexBuffer ? mIndexBuffer->getBufferObjectGeneration() : 0;
+        for(auto& vBuffer : mVertexBuffers) generation += vBuffer->getBufferObjectGeneration();
+        for(auto& lod : mLods) generation += lod.indexBuffer->getBufferObjectGeneration();
+        return generation;
+    }
+
+    Mesh::~Mesh() {
+        setArena(nullptr);
+        deleteVAO(mVAO);
+        for(auto& lod : mLods) deleteVAO(lod.vao);
+    }
+
+    void Mesh::compile(GLuint& vao, IndexBuffer* indexBuffer) {
+        // the first upload might free the positions
+        keepDerivedData();
+
+        if(vao == 0) glGenVertexArrays(1, &vao);
+        bindVAO(vao);
 
         // Not sure if this should be in VertexFormat
         for(auto& vData : mVertexBuffers) {
@@ -33,12 +86,46 @@ namespace ngn {
         // so unbind now.
         mVertexBuffers.back()->unbind();
 
-        if(mIndexBuffer != nullptr) mIndexBuffer->bind();
+        if(indexBuffer != nullptr) indexBuffer->bind();
 
-        glBindVertexArray(0);
+        bindVAO(0);
 
         // VAO stores the last bound ELEMENT_BUFFER state, so as soon as the VAO is unbound, unbind the VBO
-        if(mIndexBuffer != nullptr) mIndexBuffer->unbind();
+        if(indexBuffer != nullptr) indexBuffer->unbind();
+    }
+
+    void Mesh::keepDerivedData() const {
+        VertexBuffer* posBuffer = hasAttribute(AttributeType::POSITION);
+        if(mBBoxDirty && posBuffer && posBuffer->getNumVertices() > 0 && posBuffer->getResidencyPolicy() != ResidencyPolicy::KEEP) {
+            boundingBox();
+        }
+    }
+
+    void Mesh::setResidencyPolicy(ResidencyPolicy policy) {
+        for(auto& vBuf : mVertexBuffers) vBuf->setResidencyPolicy(policy);
+        if(mIndexBuffer) mIndexBuffer->setResidencyPolicy(policy);
+        for(auto& lod : mLods) lod.indexBuffer->setResidencyPolicy(policy);
+    }
+
+    void Mesh::applyResidencyPolicy() {
+        keepDerivedData();
+        for(auto& vBuf : mVertexBuffers) vBuf->applyResidencyPolicy();
+        if(mIndexBuffer) mIndexBuffer->applyResidencyPolicy();
+        for(auto& lod : mLods) lod.indexBuffer->applyResidencyPolicy();
+    }
+
+    void Mesh::releaseRestoredData() const {
+        for(auto& vBuf : mVertexBuffers) vBuf->releaseRestored();
+        if(mIndexBuffer) mIndexBuffer->releaseRestored();
+        for(auto& lod : mLods) lod.indexBuffer->releaseRestored();
+    }
+
+    size_t Mesh::getLocalSize() const {
+        size_t size = 0;
+        for(auto& vBuf : mVertexBuffers) size += vBuf->getLocalSize();
+        if(mIndexBuffer) size += mIndexBuffer->getLocalSize();
+        for(auto& lod : mLods) size += lod.indexBuffer->getLocalSize();
+        return size;
     }
 
     // Transform positions, normals, tangents and bitangents
@@ -46,19 +133,227 @@ namespace ngn {
                          const std::vector<AttributeType>& vectorAttributes) {
         for(auto attrType : pointAttributes) {
             if(!hasAttribute(attrType)) continue;
-            auto attr = getAccessor<glm::vec3>(attrType);
-            for(size_t i = 0; i < attr.getCount(); ++i) {
-                attr[i] = glm::vec3(transform * glm::vec4(attr.get(i), 1.0f));
-            }
+            getAccessor<glm::vec3>(attrType).transform(transform, true);
         }
 
         for(auto attrType : vectorAttributes) {
             if(!hasAttribute(attrType)) continue;
-            auto attr = getAccessor<glm::vec3>(attrType);
-            for(size_t i = 0; i < attr.getCount(); ++i) {
-                attr[i] = glm::vec3(transform * glm::vec4(attr.get(i), 0.0f));
+            getAccessor<glm::vec3>(attrType).transform(transform, false);
+        }
+        updateBoundingBox();
+    }
+
+    bool Mesh::merge(const std::vector<const Mesh*>& meshes, const std::vector<glm::mat4>& transforms) {
+        assert(meshes.size() == transforms.size());
+        if(mMode != DrawMode::POINTS && mMode != DrawMode::LINES && mMode != DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::POINTS, LINES or TRIANGLES can be merged.");
+            return false;
+        }
+        if(mVertexBuffers.empty()) {
+            LOG_ERROR("A mesh needs at least one vertex buffer to merge other meshes into it.");
+            return false;
+        }
+
+        // check everything first, so the mesh is not left half merged
+        size_t oldVertexCount = getVertexCount(), vertexCount = oldVertexCount;
+        bool indexed = mIndexBuffer != nullptr;
+        for(auto& vBuf : mVertexBuffers) {
+            if(oldVertexCount > 0 && !vBuf->canRestoreLocal()) {
+                LOG_ERROR("The mesh needs a local copy of it's vertex data to merge other meshes into it.");
+                return false;
+            }
+        }
+        if(mIndexBuffer && !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("The mesh needs a local copy of it's index data to merge other meshes into it.");
+            return false;
+        }
+        for(auto mesh : meshes) {
+            if(mesh->mMode != mMode) {
+                LOG_ERROR("Only meshes with the same draw mode can be merged.");
+                return false;
+            }
+            for(auto& vBuf : mesh->mVertexBuffers) {
+                if(vBuf->getNumVertices() > 0 && !vBuf->canRestoreLocal()) {
+                    LOG_ERROR("Meshes need a local copy of their vertex data to be merged into another mesh.");
+                    return false;
+                }
+            }
+            if(mesh->mIndexBuffer && !mesh->mIndexBuffer->canRestoreLocal()) {
+                LOG_ERROR("Meshes need a local copy of their index data to be merged into another mesh.");
+                return false;
+            }
+            vertexCount += mesh->getVertexCount();
+            indexed = indexed || mesh->mIndexBuffer != nullptr;
+        }
+
+        for(auto& vBuf : mVertexBuffers) {
+            vBuf->reallocate(vertexCount, true);
+            int stride = vBuf->getVertexFormat().getStride();
+            std::memset(static_cast<uint8_t*>(vBuf->getData()) + oldVertexCount * stride, 0, (vertexCount - oldVertexCount) * stride);
+        }
+
+        size_t vertexOffset = oldVertexCount;
+        for(size_t m = 0; m < meshes.size(); ++m) {
+            const Mesh* mesh = meshes[m];
+            size_t count = mesh->getVertexCount();
+            for(auto& vBuf : mVertexBuffers) {
+                for(auto& otherBuf : mesh->mVertexBuffers) vBuf->fillFromOtherBuffer(*otherBuf, vertexOffset);
+            }
+
+            const glm::mat4& transform = transforms[m];
+            glm::mat3 vectorMatrix = glm::mat3(transform);
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(vectorMatrix));
+            if(hasAttribute(AttributeType::POSITION)) {
+                auto position = getAccessor<glm::vec3>(AttributeType::POSITION);
+                for(size_t i = vertexOffset; i < vertexOffset + count; ++i) {
+                    position[i] = glm::vec3(transform * glm::vec4(position.get(i), 1.0f));
+                }
+            }
+            for(auto attrType : {AttributeType::NORMAL, AttributeType::TANGENT, AttributeType::BITANGENT}) {
+                if(!hasAttribute(attrType)) continue;
+                const glm::mat3& matrix = attrType == AttributeType::NORMAL ? normalMatrix : vectorMatrix;
+                auto attr = getAccessor<glm::vec3>(attrType);
+                for(size_t i = vertexOffset; i < vertexOffset + count; ++i) {
+                    glm::vec3 vec = matrix * attr.get(i);
+                    float length = glm::length(vec);
+                    attr[i] = length > 0.0f ? vec / length : vec;
+                }
             }
+            vertexOffset += count;
         }
+
+        if(indexed) {
+            // the vertex count of this mesh changed already, so it is passed explicitly
+            size_t indexCount = mIndexBuffer ? mIndexBuffer->getNumIndices() : oldVertexCount;
+            for(auto mesh : meshes) indexCount += mesh->mIndexBuffer ? mesh->mIndexBuffer->getNumIndices() : mesh->getVertexCount();
+
+            std::unique_ptr<IndexBuffer> indices(new IndexBuffer(getIndexBufferType(vertexCount), indexCount));
+            size_t index = 0, baseVertex = 0;
+            auto append = [&](const IndexBuffer* meshIndices, size_t meshVertexCount) {
+                if(meshIndices) {
+                    for(size_t i = 0; i < meshIndices->getNumIndices(); ++i) (*indices)[index++] = baseVertex + (*meshIndices)[i];
+                } else {
+                    for(size_t i = 0; i < meshVertexCount; ++i) (*indices)[index++] = baseVertex + i;
+                }
+                baseVertex += meshVertexCount;
+            };
+            append(mIndexBuffer.get(), oldVertexCount);
+            for(auto mesh : meshes) append(mesh->mIndexBuffer.get(), mesh->getVertexCount());
+            mIndexBuffer.reset(indices.release());
+        }
+        for(auto mesh : meshes) mesh->releaseRestoredData();
+        // they only cover the old vertices
+        clearLods();
+        clearClusters();
+
+        // if this mesh was drawn already, the GPU copies have to be updated
+        for(auto& vBuf : mVertexBuffers) {
+            if(vBuf->getUploadCount() > 0) vBuf->upload();
+        }
+        if(mVAO != 0) compile();
+
+        updateBoundingBox();
+        return true;
+    }
+
+    bool Mesh::setVertexFormat(const VertexFormat& format, UsageHint usage) {
+        for(auto& vBuf : mVertexBuffers) {
+            if(vBuf->getNumVertices() > 0 && !vBuf->canRestoreLocal()) {
+                LOG_ERROR("The mesh needs a local copy of it's vertex data to change it's vertex format.");
+                return false;
+            }
+        }
+
+        size_t vertexCount = getVertexCount();
+        std::unique_ptr<VertexBuffer> converted(new VertexBuffer(format, vertexCount, usage));
+        std::memset(converted->getData(), 0, format.getStride() * vertexCount);
+        for(auto& vBuf : mVertexBuffers) converted->fillFromOtherBuffer(*vBuf);
+        mVertexBuffers.clear();
+        mVertexBuffers.emplace_back(converted.release());
+
+        // the old VAOs might have attributes enabled, that are not present anymore
+        deleteVAO(mVAO);
+        for(auto& lod : mLods) deleteVAO(lod.vao);
+        // the positions might have lost precision
+        updateBoundingBox();
+        return true;
+    }
+
+    VertexFormat getCompactVertexFormat(const Mesh& mesh, float positionTolerance) {
+        auto inUnitRange = [&mesh](AttributeType type) {
+            // const, because the non-const getData marks the whole buffer as dirty
+            const VertexBuffer* vBuf = mesh.hasAttribute(type);
+            const VertexFormat& format = vBuf->getVertexFormat();
+            const VertexAttribute* attr = format.getAttribute(type);
+            const uint8_t* data = static_cast<const uint8_t*>(vBuf->getData()) + format.getAttributeOffset(attr - format.getAttributes().data());
+            float values[4];
+            for(size_t i = 0; i < vBuf->getNumVertices(); ++i) {
+                decodeVertexAttribute(*attr, data + i * format.getStride(), values);
+                for(int c = 0; c < attr->num; ++c) {
+                    if(values[c] < 0.0f || values[c] > 1.0f) return false;
+                }
+            }
+            return true;
+        };
+
+        VertexFormat format;
+        for(int t = 0; t < static_cast<int>(AttributeType::FINAL_COUNT_ENTRY); ++t) {
+            AttributeType type = static_cast<AttributeType>(t);
+            VertexBuffer* vBuf = mesh.hasAttribute(type);
+            if(!vBuf) continue;
+            const VertexAttribute& attr = *vBuf->getVertexFormat().getAttribute(type);
+
+            // only float attributes with local data are compressed, everything else is probably like that on purpose
+            if(attr.dataType != AttributeDataType::F32 || attr.divisor > 0 || !vBuf->canRestoreLocal()) {
+                format.add(type, attr.num, attr.dataType, attr.normalized, attr.divisor);
+                continue;
+            }
+
+            switch(type) {
+                case AttributeType::POSITION: {
+                    // half floats have 11 significant bits, so the rounding error is at most 2^-11 of the magnitude
+                    const AABoundingBox& box = mesh.boundingBox();
+                    glm::vec3 maxAbs = glm::max(glm::abs(box.min), glm::abs(box.max));
+                    float maxMagnitude = glm::max(maxAbs.x, glm::max(maxAbs.y, maxAbs.z));
+                    if(positionTolerance > 0.0f && maxMagnitude * std::ldexp(1.0f, -11) <= positionTolerance)
+                        format.add(type, attr.num, AttributeDataType::F16);
+                    else
+                        format.add(type, attr.num, attr.dataType);
+                    break;
+                }
+                case AttributeType::NORMAL:
+                case AttributeType::TANGENT:
+                case AttributeType::BITANGENT:
+                    // GL needs 4 components for the packed types, the shader can still take a vec3
+                    if(attr.num >= 3)
+                        format.add(type, 4, AttributeDataType::I2_10_10_10, true);
+                    else
+                        format.add(type, attr.num, attr.dataType);
+                    break;
+                case AttributeType::TEXCOORD0:
+                case AttributeType::TEXCOORD1:
+                case AttributeType::TEXCOORD2:
+                case AttributeType::TEXCOORD3:
+                    if(inUnitRange(type))
+                        format.add(type, attr.num, AttributeDataType::UI16, true);
+                    else
+                        format.add(type, attr.num, AttributeDataType::F16);
+                    break;
+                case AttributeType::COLOR0:
+                case AttributeType::COLOR1:
+                    // HDR colors would be clamped
+                    if(inUnitRange(type))
+                        format.add(type, attr.num, AttributeDataType::UI8, true);
+                    else
+                        format.add(type, attr.num, AttributeDataType::F16);
+                    break;
+                default:
+                    format.add(type, attr.num, attr.dataType, attr.normalized, attr.divisor);
+                    break;
+            }
+        }
+        mesh.releaseRestoredData();
+        return format;
     }
 
     void Mesh::normalize(bool rescale) {
@@ -81,40 +376,79 @@ namespace ngn {
 
     const AABoundingBox& Mesh::boundingBox() const {
         if(mBBoxDirty) {
+            // positions that had to be restored for this are freed again afterwards (see ResidencyPolicy)
+            VertexBuffer* posBuffer = hasAttribute(AttributeType::POSITION);
             auto position = getAccessor<glm::vec3>(AttributeType::POSITION);
             mBoundingBox.min = mBoundingBox.max = position.get(0);
-            for(size_t i = 1; i < position.getCount(); ++i) mBoundingBox.fitPoint(position.get(i));
+            // in chunks, so the data type is only checked once per chunk
+            const size_t chunkSize = 256;
+            glm::vec3 chunk[chunkSize];
+            for(size_t first = 0; first < position.getCount(); first += chunkSize) {
+                size_t count = std::min(chunkSize, position.getCount() - first);
+                position.copyTo(chunk, first, count);
+                for(size_t i = 0; i < count; ++i) mBoundingBox.fitPoint(chunk[i]);
+            }
             mBBoxDirty = false;
+            if(posBuffer) posBuffer->releaseRestored();
         }
         return mBoundingBox;
     }
 
-    Mesh* assimpMesh(aiMesh* mesh, const VertexFormat& format) {
+    const MeshBVH& Mesh::getBVH() const {
+        if(!mBVH) {
+            mBVH.reset(new MeshBVH);
+            mBVH->build(*this);
+            releaseRestoredData();
+        }
+        return *mBVH;
+    }
+
+    // Copies the first components of every vector, directly if the attribute is made of floats, with the bulk conversion of the accessor otherwise.
+    // Float attributes with more components than the vectors get the rest filled with 0 (w with 1), like decodeVertexAttribute does
+    static void copyAssimpAttribute(VertexBuffer& vBuf, AttributeType type, const aiVector3D* vectors, int components) {
+        const VertexFormat& format = vBuf.getVertexFormat();
+        const std::vector<VertexAttribute>& attributes = format.getAttributes();
+        size_t attrIndex = format.getAttribute(type) - attributes.data();
+        const VertexAttribute& attr = attributes[attrIndex];
+        size_t count = vBuf.getNumVertices();
+
+        if(attr.dataType == AttributeDataType::F32 && attr.num >= components) {
+            uint8_t* dst = static_cast<uint8_t*>(vBuf.getData()) + format.getAttributeOffset(attrIndex);
+            size_t stride = format.getStride();
+            if(attr.num == components) {
+                for(size_t i = 0; i < count; ++i) std::memcpy(dst + i * stride, &vectors[i], components * sizeof(float));
+            } else {
+                float value[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+                size_t size = std::min(attr.num, 4) * sizeof(float);
+                for(size_t i = 0; i < count; ++i) {
+                    std::memcpy(value, &vectors[i], components * sizeof(float));
+                    std::memcpy(dst + i * stride, value, size);
+                }
+            }
+        } else if(components == 3) {
+            // aiVector3D is just 3 floats
+            vBuf.getAccessor<glm::vec3>(type).copyFrom(reinterpret_cast<const glm::vec3*>(vectors));
+        } else {
+            std::vector<glm::vec2> values(count);
+            for(size_t i = 0; i < count; ++i) values[i] = glm::vec2(vectors[i].x, vectors[i].y);
+            vBuf.getAccessor<glm::vec2>(type).copyFrom(values.data());
+        }
+    }
+
+    Mesh* assimpMesh(aiMesh* mesh, const VertexFormat& format, bool optimize, unsigned int threadCount) {
         auto ngnMesh = new Mesh(Mesh::DrawMode::TRIANGLES);
-        ngnMesh->addVertexBuffer(format, mesh->mNumVertices);
+        VertexBuffer* vBuf = ngnMesh->addVertexBuffer(format, mesh->mNumVertices);
 
         if(mesh->HasPositions() && format.hasAttribute(AttributeType::POSITION)) {
-            auto position = ngnMesh->getAccessor<glm::vec3>(AttributeType::POSITION);
-            for(size_t i = 0; i < mesh->mNumVertices; ++i) {
-                aiVector3D& vec = mesh->mVertices[i];
-                position[i] = glm::vec3(vec.x, vec.y, vec.z);
-            }
+            copyAssimpAttribute(*vBuf, AttributeType::POSITION, mesh->mVertices, 3);
         }
 
         if(mesh->HasNormals() && format.hasAttribute(AttributeType::NORMAL)) {
-            auto normal = ngnMesh->getAccessor<glm::vec3>(AttributeType::NORMAL);
-            for(size_t i = 0; i < mesh->mNumVertices; ++i) {
-                aiVector3D& vec = mesh->mNormals[i];
-                normal[i] = glm::vec3(vec.x, vec.y, vec.z);
-            }
+            copyAssimpAttribute(*vBuf, AttributeType::NORMAL, mesh->mNormals, 3);
         }
 
         if(mesh->HasTextureCoords(0) && format.hasAttribute(AttributeType::TEXCOORD0)) {
-            auto texCoord = ngnMesh->getAccessor<glm::vec2>(AttributeType::TEXCOORD0);
-            for(size_t i = 0; i < mesh->mNumVertices; ++i) {
-                aiVector3D& vec = mesh->mTextureCoords[0][i];
-                texCoord[i] = glm::vec2(vec.x, vec.y);
-            }
+            copyAssimpAttribute(*vBuf, AttributeType::TEXCOORD0, mesh->mTextureCoords[0], 2);
         }
 
         if(mesh->HasFaces()) {
@@ -127,24 +461,69 @@ namespace ngn {
             }
         }
 
+        if(!mesh->HasNormals() && format.hasAttribute(AttributeType::NORMAL)) ngnMesh->calculateVertexNormals(true, threadCount);
+        // our own instead of assimp's, so they match what the shaders expect (MikkTSpace) and w has the sign of the bitangent
+        if(mesh->HasTextureCoords(0) && format.hasAttribute(AttributeType::TANGENT) && format.hasAttribute(AttributeType::TEXCOORD0)) {
+            ngnMesh->calculateTangents(threadCount);
+        }
+
+        if(optimize) {
+            VertexCacheStats before = ngnMesh->analyzeVertexCache();
+            if(ngnMesh->optimize()) {
+                VertexCacheStats after = ngnMesh->analyzeVertexCache();
+                LOG_DEBUG("Optimized mesh '%s': ACMR %f -> %f, ATVR %f -> %f", mesh->mName.C_Str(), before.acmr, after.acmr, before.atvr, after.atvr);
+            }
+        }
+
         return ngnMesh;
     }
 
-    std::vector<std::pair<std::string, Mesh*> > assimpMeshes(const char* filename, bool merge, const VertexFormat& format) {
+    unsigned int getAssimpImportFlags(bool merge) {
+        return aiProcessPreset_TargetRealtime_Fast | aiProcess_OptimizeMeshes | (merge ? aiProcess_OptimizeGraph : 0);
+    }
+
+    uint64_t getAssimpMeshCacheKey(const char* filename, bool merge, const VertexFormat& format, bool optimize) {
+        MappedFile source;
+        if(!source.open(filename)) return 0;
+
+        // everything that changes the result has to go into the key
+        uint64_t key = hashBytes(source.getData(), source.getSize());
+        uint32_t settings[2] = {getAssimpImportFlags(merge), optimize ? 1u : 0u};
+        key = hashBytes(settings, sizeof(settings), key);
+        for(auto& attr : format.getAttributes()) {
+            uint32_t attribute[5] = {static_cast<uint32_t>(attr.type), static_cast<uint32_t>(attr.num),
+                static_cast<uint32_t>(attr.dataType), attr.normalized ? 1u : 0u, attr.divisor};
+            key = hashBytes(attribute, sizeof(attribute), key);
+        }
+        return key;
+    }
+
+    std::vector<std::pair<std::string, Mesh*> > assimpMeshes(const char* filename, bool merge, const VertexFormat& format, bool optimize, bool cache) {
+        std::vector<std::pair<std::string, Mesh*> > meshes;
+
+        std::string cacheFilename = std::string(filename) + ".ngnmesh";
+        uint64_t cacheKey = cache ? getAssimpMeshCacheKey(filename, merge, format, optimize) : 0;
+        // if the key is 0, the source can't be read anyways
+        cache = cacheKey != 0;
+        if(cache && loadMeshCache(cacheFilename.c_str(), cacheKey, meshes)) return meshes;
+
         Assimp::Importer importer;
         /*importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
             aiComponent_NORMALS | aiComponent_TANGENTS_AND_BITANGENTS | aiComponent_COLORS |
             aiComponent_LIGHTS | aiComponent_CAMERAS);*/
-        const aiScene *scene = importer.ReadFile(filename, aiProcessPreset_TargetRealtime_Fast | aiProcess_OptimizeMeshes | (merge ? aiProcess_OptimizeGraph : 0));
+        const aiScene *scene = importer.ReadFile(filename, getAssimpImportFlags(merge));
         if(!scene) {
             LOG_ERROR("Mesh file '%s' could not be loaded!\n", importer.GetErrorString());
+            return meshes;
         }
 
-        std::vector<std::pair<std::string, Mesh*> > meshes;
         for(size_t i = 0; i < scene->mNumMeshes; ++i) {
-            meshes.push_back(std::make_pair(std::string(scene->mMeshes[i]->mName.C_Str()), assimpMesh(scene->mMeshes[i], format)));
+            meshes.push_back(std::make_pair(std::string(scene->mMeshes[i]->mName.C_Str()), assimpMesh(scene->mMeshes[i], format, optimize)));
         }
 
+        if(cache && !saveMeshCache(cacheFilename.c_str(), cacheKey, meshes)) {
+            LOG_WARNING("Could not write mesh cache for '%s'.", filename);
+        }
         return meshes;
     }
 
@@ -235,7 +614,7 @@ namespace ngn {
             }
         }
 
-        //if(format.hasAttribute(AttributeType::TANGENT)) vData->calculateTangents();
+        if(format.hasAttribute(AttributeType::TANGENT) && format.hasAttribute(AttributeType::TEXCOORD0)) mesh->calculateTangents();
 
         return mesh;
     }
@@ -249,6 +628,9 @@ namespace ngn {
         auto position = mesh->getAccessor<glm::vec3>(AttributeType::POSITION);
         auto normal = mesh->getAccessor<glm::vec3>(AttributeType::NORMAL);
         auto texCoord = mesh->getAccessor<glm::vec2>(AttributeType::TEXCOORD0);
+        // generated into these, then copied over at once
+        std::vector<glm::vec3> positions(slices*stacks), normals(slices*stacks);
+        std::vector<glm::vec2> texCoords(slices*stacks);
 
         /* This should probably be:
         auto normal = VertexAttributeAccessor();
@@ -267,11 +649,11 @@ namespace ngn {
             float y = glm::cos(stackAngle) * radius;
             for(int slice = 0; slice < slices; ++slice) {
                 float sliceAngle = 2.0f * glm::pi<float>() / (slices - 1) * slice;
-                position[index] = glm::vec3(glm::cos(sliceAngle) * xzRadius, y, glm::sin(sliceAngle) * xzRadius);
-                normal[index] = glm::normalize(position.get(index));
+                positions[index] = glm::vec3(glm::cos(sliceAngle) * xzRadius, y, glm::sin(sliceAngle) * xzRadius);
+                normals[index] = glm::normalize(positions[index]);
                 if(cubeProjectionTexCoords) {
                     // http://www.gamedev.net/topic/443878-texture-lookup-in-cube-map/
-                    glm::vec3 dir = normal.get(index);
+                    glm::vec3 dir = normals[index];
                     glm::vec3 absDir = glm::abs(dir);
                     int majorDirIndex = 0;
                     if(absDir.x >= absDir.y && absDir.x >= absDir.z) majorDirIndex = 0;
@@ -296,12 +678,15 @@ namespace ngn {
                             break;
                     }
 
-                    texCoord[index++] = glm::vec2((v.x/glm::abs(v.z) + 1.0f) / 2.0f, (v.y/glm::abs(v.z) + 1.0f) / 2.0f);
+                    texCoords[index++] = glm::vec2((v.x/glm::abs(v.z) + 1.0f) / 2.0f, (v.y/glm::abs(v.z) + 1.0f) / 2.0f);
                 } else {
-                    texCoord[index++] = glm::vec2(sliceAngle / 2.0f / glm::pi<float>(), stackAngle / glm::pi<float>());
+                    texCoords[index++] = glm::vec2(sliceAngle / 2.0f / glm::pi<float>(), stackAngle / glm::pi<float>());
                 }
             }
         }
+        position.copyFrom(positions.data());
+        normal.copyFrom(normals.data());
+        texCoord.copyFrom(texCoords.data());
 
         int triangles = 2 * (slices - 1) * (stacks - 1);
 
@@ -323,7 +708,7 @@ namespace ngn {
             }
         }
 
-        //if(format.hasAttribute(AttributeType::TANGENT)) vData->calculateTangents();
+        if(format.hasAttribute(AttributeType::TANGENT) && format.hasAttribute(AttributeType::TEXCOORD0)) mesh->calculateTangents();
 
         return mesh;
     }
@@ -337,18 +722,23 @@ namespace ngn {
         auto position = mesh->getAccessor<glm::vec3>(AttributeType::POSITION);
         auto normal = mesh->getAccessor<glm::vec3>(AttributeType::NORMAL);
         auto texCoord = mesh->getAccessor<glm::vec2>(AttributeType::TEXCOORD0);
+        size_t vertexCount = (segmentsX+1)*(segmentsY+1);
+        std::vector<glm::vec3> positions(vertexCount), normals(vertexCount, glm::vec3(0.0f, 1.0f, 0.0f));
+        std::vector<glm::vec2> texCoords(vertexCount);
 
         int index = 0;
         glm::vec2 size(width, height);
         for(int y = 0; y <= segmentsY; ++y) {
             for(int x = 0; x <= segmentsX; ++x) {
                 glm::vec2 pos2D = glm::vec2((float)x / segmentsX, (float)y / segmentsY);
-                texCoord[index] = pos2D;
+                texCoords[index] = pos2D;
                 pos2D = pos2D * size - 0.5f * size;
-                position[index] = glm::vec3(pos2D.x, 0.0f, pos2D.y);
-                normal[index++] = glm::vec3(0.0f, 1.0f, 0.0f);
+                positions[index++] = glm::vec3(pos2D.x, 0.0f, pos2D.y);
             }
         }
+        position.copyFrom(positions.data());
+        normal.copyFrom(normals.data());
+        texCoord.copyFrom(texCoords.data());
 
         IndexBuffer* iData = mesh->setIndexBuffer(IndexBufferType::UI16, segmentsX*segmentsY*2*3);
         uint16_t* indexBuffer = iData->getData<uint16_t>();
@@ -367,6 +757,8 @@ namespace ngn {
             }
         }
 
+        if(format.hasAttribute(AttributeType::TANGENT) && format.hasAttribute(AttributeType::TEXCOORD0)) mesh->calculateTangents();
+
         return mesh;
     }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <utility>
+#include <initializer_list>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -11,9 +12,18 @@
 #include "shaderprogram.hpp"
 #include "log.hpp"
 #include "aabb.hpp"
+#include "meshbvh.hpp"
+#include "mesh_optimize.hpp"
+#include "mesh_simplify.hpp"
+#include "mesh_normals.hpp"
+#include "mesh_clusters.hpp"
+#include "geometryarena.hpp"
+#include "resource.hpp"
+
+struct aiMesh;
 
 namespace ngn {
-    class Mesh {
+    class Mesh : public Resource {
     public:
         enum class DrawMode : GLenum {
             POINTS = GL_POINTS,
@@ -26,8 +36,6 @@ namespace ngn {
         };
 
     private:
-        static GLuint lastBoundVAO;
-
         DrawMode mMode;
         GLuint mVAO;
         std::vector<std::unique_ptr<VertexBuffer> > mVertexBuffers;
@@ -35,9 +43,69 @@ namespace ngn {
 
         mutable AABoundingBox mBoundingBox;
         mutable bool mBBoxDirty;
+        // incremented by updateBoundingBox, so scene nodes can tell if their cached bounds are stale
+        mutable uint32_t mBoundsVersion;
+        mutable std::unique_ptr<MeshBVH> mBVH;
+
+        // Simplified versions of the index buffer, that share the vertex buffers with the full detail mesh (see generateLods)
+        struct Lod {
+            std::unique_ptr<IndexBuffer> indexBuffer;
+            GLuint vao;
+            // maximum distance to the surface of the full detail mesh
+            float error;
+        };
+        std::vector<Lod> mLods;
+
+        // see buildClusters, they cover the full detail index buffer
+        std::vector<MeshCluster> mClusters;
+
+        // see setArena
+        GeometryArena* mArena;
+        GeometryArena::Allocation mArenaAllocation;
+        // offset and count in the index buffer of the pool, per LOD (0 is the full detail mesh)
+        std::vector<std::pair<size_t, size_t> > mArenaIndexRanges;
+
+        // The sum of GLBuffer::getBufferObjectGeneration of all buffers when the VAOs were checked last. The generations only increase,
+        // so the sum changes whenever one of them does
+        uint32_t mBufferObjectGeneration;
+        uint32_t getBufferObjectGeneration() const;
+        // Deletes the VAOs, if a vertex or index buffer got another buffer object since then (see GLBuffer::deduplicate)
+        void checkBufferObjects() {
+            uint32_t generation = getBufferObjectGeneration();
+            if(mBufferObjectGeneration != generation) {
+                deleteVAO(mVAO);
+                for(auto& lod : mLods) deleteVAO(lod.vao);
+                mBufferObjectGeneration = generation;
+            }
+        }
+
+        void compile(GLuint& vao, IndexBuffer* indexBuffer);
+        // Computes what the mesh needs all the time from the local copies (the bounding box), before the residency policy frees them
+        void keepDerivedData() const;
+        // Logs an error and returns false, if the mesh is not a triangle list with local copies of the indices and the attributes
+        bool checkNormalInputs(const char* operation, std::initializer_list<AttributeType> attributes) const;
 
     public:
-        Mesh(DrawMode mode) : mMode(mode), mVAO(0), mIndexBuffer(nullptr), mBBoxDirty(true) {}
+        // All VAOs are bound through these, so binding the VAO that is already bound can be skipped
+        static GLuint currentVAO;
+        static void bindVAO(GLuint vao) {
+            if(currentVAO != vao) {
+                glBindVertexArray(vao);
+                currentVAO = vao;
+            }
+        }
+        // Sets vao to 0
+        static void deleteVAO(GLuint& vao);
+
+        Mesh(DrawMode mode) : mMode(mode), mVAO(0), mIndexBuffer(nullptr), mBBoxDirty(true), mBoundsVersion(0), mArena(nullptr),
+                mBufferObjectGeneration(0) {}
+        ~Mesh();
+
+        // nullptr, nodes with a handle to a mesh that could not be loaded are just not drawn
+        static Mesh* fallback;
+        // All meshes in the file merged into one (see assimpMeshes, the mesh cache is used too).
+        // Through Resource::getPrepare every file is only loaded once and shared by all handles to it
+        static Mesh* fromFile(const char* filename, const VertexFormat& format, bool optimize = false);
 
         // I'm not really sure what I want these to do
         Mesh(const Mesh& other) = delete;
@@ -62,9 +130,17 @@ namespace ngn {
         IndexBuffer* setIndexBuffer(Ts&&... args) {
             IndexBuffer* iData = new IndexBuffer(std::forward<Ts>(args)...);
             mIndexBuffer.reset(iData);
+            clearLods();
+            clearClusters();
             return iData;
         }
 
+        DrawMode getDrawMode() const {return mMode;}
+        size_t getVertexCount() const {return mVertexBuffers.size() > 0 ? mVertexBuffers[0]->getNumVertices() : 0;}
+        size_t getVertexBufferCount() const {return mVertexBuffers.size();}
+        const VertexBuffer* getVertexBuffer(size_t index) const {return mVertexBuffers[index].get();}
+        const IndexBuffer* getIndexBuffer() const {return mIndexBuffer.get();}
+
         // returns nullptr if the given attribute is not present in any vertexbuffer
         VertexBuffer* hasAttribute(AttributeType attrType) const {
             for(auto& vBuffer : mVertexBuffers) {
@@ -83,26 +159,47 @@ namespace ngn {
             return vBuf->getAccessor<T>(id);
         }
 
-        void compile();
+        void compile() {compile(mVAO, mIndexBuffer.get());}
 
         // In the header because of the slim possibility that it might be inlined
         // instanceCount = 0 means, that the draw commands will not be instanced
-        inline void draw(size_t instanceCount = 0) {
-            if(mVAO == 0) {
-                compile();
+        // lod = 0 is the full detail mesh, invalid LODs also draw that
+        inline void draw(size_t instanceCount = 0, int lod = 0) {
+            GLenum mode = static_cast<GLenum>(mMode);
+            if(mArena) {
+                // the VAO is shared with all the other meshes of the pool
+                const GeometryArena::Pool* pool = mArenaAllocation.pool;
+                bindVAO(pool->getVAO());
+                const std::pair<size_t, size_t>& range = getArenaIndexRange(lod);
+                GLenum indexType = static_cast<GLenum>(pool->getIndexType());
+                const void* offset = reinterpret_cast<const void*>(range.first * getIndexBufferTypeSize(pool->getIndexType()));
+                if(instanceCount > 0) {
+                    glDrawElementsInstancedBaseVertex(mode, range.second, indexType, offset, instanceCount, mArenaAllocation.vertexOffset);
+                } else {
+                    glDrawElementsBaseVertex(mode, range.second, indexType, offset, mArenaAllocation.vertexOffset);
+                }
+                return;
+            }
+
+            checkBufferObjects();
+            // every LOD has it's own VAO, because the index buffer binding is part of it
+            Lod* lodData = lod > 0 && lod <= static_cast<int>(mLods.size()) ? &mLods[lod - 1] : nullptr;
+            GLuint& vao = lodData ? lodData->vao : mVAO;
+            IndexBuffer* indexBuffer = lodData ? lodData->indexBuffer.get() : mIndexBuffer.get();
+            if(vao == 0) {
+                compile(vao, indexBuffer);
             }
 
-            if(lastBoundVAO != mVAO) glBindVertexArray(mVAO);
+            bindVAO(vao);
 
             // A lof of this can go wrong if someone compiles this Mesh without an index buffer attached, then attaches one and compiles it with another
             // shader, while both are in use
-            GLenum mode = static_cast<GLenum>(mMode);
-            if(mIndexBuffer != nullptr) {
-                GLenum indexType = static_cast<GLenum>(mIndexBuffer->getDataType());
+            if(indexBuffer != nullptr) {
+                GLenum indexType = static_cast<GLenum>(indexBuffer->getDataType());
                 if(instanceCount > 0) {
-                    glDrawElementsInstanced(mode, mIndexBuffer->getNumIndices(), indexType, nullptr, instanceCount);
+                    glDrawElementsInstanced(mode, indexBuffer->getNumIndices(), indexType, nullptr, instanceCount);
                 } else {
-                    glDrawElements(mode, mIndexBuffer->getNumIndices(), indexType, nullptr);
+                    glDrawElements(mode, indexBuffer->getNumIndices(), indexType, nullptr);
                 }
             } else {
                 // If someone had the great idea of having multiple VertexBuffer objects attached and changing their size after attaching
@@ -122,21 +219,104 @@ namespace ngn {
         // for example read positions and write normals or read normals and write tangents, which might
         // reside in different buffers
 
-        /*TODO*/ void calculateVertexNormals(bool faceAreaWeighted = true);
+        // Only for DrawMode::TRIANGLES with local copies of the index buffer and the attributes that are read and written.
+        // Big meshes are processed on up to threadCount threads (see mesh_normals.hpp, 0 means one per hardware thread), the results are
+        // the same for any number of threads. Pass 1 on threads that already run in parallel with others (e.g. the AsyncMeshLoader workers).
+        // faceAreaWeighted = false weights by the angles of the triangles instead (see calculateVertexNormals in mesh_normals.hpp)
+        bool calculateVertexNormals(bool faceAreaWeighted = true, unsigned int threadCount = 0);
         // sets normals so that in the fragment shader the normals can be interpolated using a "flat" varying - https://www.opengl.org/wiki/Type_Qualifier_(GLSL)
-        /*TODO*/ void calculateFaceNormals(bool lastVertexConvention = true);
-        /*TODO*/ void calculateTangents();
+        // Vertices that are the provoking vertex of multiple triangles are duplicated, so this needs local copies of all vertex buffers then.
+        // The LODs keep using the original vertices and a mesh in a geometry arena has to be placed again
+        bool calculateFaceNormals(bool lastVertexConvention = true, unsigned int threadCount = 0);
+        // MikkTSpace style tangents from the positions, normals and TEXCOORD0 (see calculateTangents in mesh_normals.hpp).
+        // The sign of the bitangent is written to w, if the tangent attribute has 4 components, and the bitangents are written too, if there are any
+        bool calculateTangents(unsigned int threadCount = 0);
 
         // moves center to 0, 0, 0 and radius to 1.0 if rescale = true
         void normalize(bool rescale = false);
         void transform(const glm::mat4& transform,
            const std::vector<AttributeType>& pointAttributes = {AttributeType::POSITION},
            const std::vector<AttributeType>& vectorAttributes = {AttributeType::NORMAL, AttributeType::TANGENT, AttributeType::BITANGENT});
-        // I don't think this is the proper prototype of this function, maybe merge with another Mesh?
-        /*TODO*/ void merge(const VertexBuffer& other, const glm::mat4& transform);
+        // Appends the vertices and indices of the other meshes to this one, each transformed by the matrix with the same index
+        // (positions as points, normals with the normal matrix, tangents and bitangents as vectors).
+        // All meshes need a local copy of their data and the same draw mode (and only lists, i.e. POINTS, LINES or TRIANGLES)
+        // Attributes of this mesh that another mesh doesn't have are zeroed for it's vertices.
+        // Pass all meshes at once if you have many, because every call reallocates the buffers
+        bool merge(const std::vector<const Mesh*>& meshes, const std::vector<glm::mat4>& transforms);
+        bool merge(const Mesh& other, const glm::mat4& transform) {
+            return merge(std::vector<const Mesh*>{&other}, std::vector<glm::mat4>{transform});
+        }
+
+        // Replaces all vertex buffers with a single one in the given format and converts the data (see VertexBuffer::fillFromOtherBuffer)
+        // Attributes that are not in the format are dropped. All vertex buffers need a local copy of their data
+        bool setVertexFormat(const VertexFormat& format, UsageHint usage = UsageHint::STATIC);
 
-        void updateBoundingBox() const {mBBoxDirty = true;}
+        // Reorders the triangles for vertex cache locality, then optionally clusters of them for less overdraw and the vertices
+        // in the order they are used for vertex fetch locality (see mesh_optimize.hpp).
+        // Only for DrawMode::TRIANGLES with an index buffer and local copies of all the data
+        bool optimize(bool overdraw = true, bool vertexFetch = true);
+        // To measure the effect of optimize()
+        VertexCacheStats analyzeVertexCache(int cacheSize = 16) const;
+
+        // ---- level of detail
+        // Generates up to lodCount simplified index buffers (see simplifyMesh in mesh_simplify.hpp) with about reduction times
+        // the triangles of the previous level each, that share the vertex buffers with the full detail mesh.
+        // maxError is relative to the radius of the bounding sphere. Stops early if a level can't be simplified much further.
+        // Only for DrawMode::TRIANGLES with an index buffer and local copies of it and the positions.
+        // Setting a new index buffer, merge and changing the positions remove or invalidate the LODs
+        bool generateLods(int lodCount = 3, float reduction = 0.5f, float maxError = 0.05f);
+        void clearLods();
+        // including the full detail mesh (lod 0)
+        int getLodCount() const {return mLods.size() + 1;}
+        float getLodError(int lod) const {return lod > 0 && lod <= static_cast<int>(mLods.size()) ? mLods[lod - 1].error : 0.0f;}
+        // Returns the coarsest LOD whose error, projected to the screen, is at most maxPixelError pixels.
+        // pixelsPerUnit is how many pixels a unit of the mesh (in model space) covers at it's distance to the camera
+        int selectLod(float pixelsPerUnit, float maxPixelError = 1.0f) const;
+
+        // ---- clusters
+        // Splits the full detail index buffer into clusters of about maxTriangles triangles with bounds and normal cones (see buildMeshClusters
+        // in mesh_clusters.hpp) and reorders it accordingly, so renderers can cull them individually (see cullMeshClusters) and draw the
+        // remaining ranges with drawRanges. Only for DrawMode::TRIANGLES with an index buffer and local copies of it and the positions.
+        // setIndexBuffer, merge and optimize remove the clusters, after changing the positions call this again
+        bool buildClusters(size_t maxVertices = 64, size_t maxTriangles = 124);
+        void clearClusters() {mClusters.clear();}
+        const std::vector<MeshCluster>& getClusters() const {return mClusters;}
+        // Draws ranges (offset, count) of the full detail index buffer with a single glMultiDrawElements (also from a geometry arena)
+        void drawRanges(const std::vector<std::pair<size_t, size_t> >& ranges, size_t instanceCount = 0);
+
+        // ---- geometry arena
+        // Copies the vertices and indices (including the LODs) into the shared buffers of the arena (see geometryarena.hpp) and draws from
+        // there from now on. Needs exactly one vertex buffer without instanced attributes, an index buffer and local copies of both.
+        // Changes to the mesh are not picked up automatically, call this again to re-upload it. nullptr moves it back to it's own buffers
+        bool setArena(GeometryArena* arena);
+        GeometryArena* getArena() const {return mArena;}
+        const GeometryArena::Allocation& getArenaAllocation() const {return mArenaAllocation;}
+        // Offset and count in the index buffer of the pool (invalid LODs return the full detail mesh, like draw)
+        const std::pair<size_t, size_t>& getArenaIndexRange(int lod) const {
+            return lod > 0 && lod < static_cast<int>(mArenaIndexRanges.size()) ? mArenaIndexRanges[lod] : mArenaIndexRanges[0];
+        }
+
+        // ---- residency (see ResidencyPolicy in mesh_vertexdata.hpp)
+        // For all vertex and index buffers, including the LODs. The policy is applied after every upload (and setArena), the bounding box
+        // is computed before that and the BVH, clusters and LODs are kept, so only functions that change the mesh restore the local copies
+        void setResidencyPolicy(ResidencyPolicy policy);
+        // Frees or compresses the local copies again, after they were restored (e.g. to build a BVH or to save a mesh cache)
+        void applyResidencyPolicy();
+        // Like applyResidencyPolicy, but only for the buffers that were restored on demand (see GLBuffer::releaseRestored).
+        // Everything that reads the local copies calls this when it's done
+        void releaseRestoredData() const;
+        // The memory used by the local copies of all buffers right now
+        size_t getLocalSize() const;
+
+        // Call this after changing the positions. It also invalidates the BVH
+        void updateBoundingBox() const {mBBoxDirty = true; mBVH.reset(); ++mBoundsVersion;}
+        // For meshes without a local copy of their positions (e.g. loaded from a mesh cache) this is the only way to get bounds
+        void setBoundingBox(const AABoundingBox& box) const {mBoundingBox = box; mBBoxDirty = false; mBVH.reset(); ++mBoundsVersion;}
         const AABoundingBox& boundingBox() const;
+        uint32_t getBoundsVersion() const {return mBoundsVersion;}
+        // Built lazily from the local copy of the positions and the index buffer on first use.
+        // Not thread safe, so build it before raycasting from multiple threads
+        const MeshBVH& getBVH() const;
         // Centroid of the bounding box
         glm::vec3 center() const;
         // position and radius
@@ -144,7 +324,24 @@ namespace ngn {
     };
 
     Mesh* assimpMesh(const char* filename, const VertexFormat& format);
-    std::vector<std::pair<std::string, Mesh*> > assimpMeshes(const char* filename, bool merge, const VertexFormat& format);
+    // optimize calls Mesh::optimize on the result. This does not touch any GL state, so it can be called from any thread.
+    // threadCount is passed on to the normal and tangent generation
+    Mesh* assimpMesh(aiMesh* mesh, const VertexFormat& format, bool optimize = false, unsigned int threadCount = 0);
+    unsigned int getAssimpImportFlags(bool merge);
+    // The key for the mesh cache of assimpMeshes, 0 if the file can't be read
+    uint64_t getAssimpMeshCacheKey(const char* filename, bool merge, const VertexFormat& format, bool optimize);
+    // Returns a vertex format with the same attributes as the mesh, but compressed where it's (almost) lossless:
+    // - positions as half floats, if the absolute error is not bigger than positionTolerance (0 keeps floats)
+    // - normals, tangents and bitangents packed into I2_10_10_10 (w of tangents is kept in the 2 bit component)
+    // - texture coordinates as normalized unsigned shorts if they are all in [0, 1], as half floats otherwise
+    // - colors as normalized unsigned bytes
+    // Use it with Mesh::setVertexFormat. Most of the time this halves the size of the vertex data
+    VertexFormat getCompactVertexFormat(const Mesh& mesh, float positionTolerance = 0.0f);
+
+    // optimize calls Mesh::optimize on every mesh
+    // With cache = true the result is written to filename + ".ngnmesh" (see mesh_cache.hpp) and loaded from there next time,
+    // as long as the source file and the parameters did not change
+    std::vector<std::pair<std::string, Mesh*> > assimpMeshes(const char* filename, bool merge, const VertexFormat& format, bool optimize = false, bool cache = true);
 
     // width, height, depth along x, y, z, center is 0, 0, 0
     Mesh* boxMesh(float width, float height, float depth, const VertexFormat& format);
@@ -0,0 +1,306 @@
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+
+#include "mesh_cache.hpp"
+#include "mappedfile.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    // All of these only contain 4 and 8 byte members, ordered so that there is no padding
+
+    struct MeshCacheFileHeader {
+        char magic[8];
+        uint32_t version;
+        // written as 0x01020304, to reject files from machines with another byte order
+        uint32_t byteOrder;
+        uint64_t key;
+        uint32_t meshCount;
+        uint32_t reserved;
+    };
+
+    struct MeshCacheMeshHeader {
+        uint32_t nameLength;
+        uint32_t drawMode;
+        uint32_t vertexBufferCount;
+        // 0 if the mesh has no index buffer
+        uint32_t indexType;
+        uint32_t indexUsage;
+        uint32_t reserved;
+        uint64_t indexCount;
+        uint64_t indexOffset;
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    struct MeshCacheVertexBufferHeader {
+        uint32_t attributeCount;
+        uint32_t usage;
+        uint64_t vertexCount;
+        uint64_t dataOffset;
+    };
+
+    struct MeshCacheAttribute {
+        uint32_t type;
+        uint32_t num;
+        uint32_t dataType;
+        uint32_t normalized;
+        uint32_t divisor;
+    };
+
+    static const char MESH_CACHE_MAGIC[8] = {'N', 'G', 'N', 'M', 'E', 'S', 'H', '\0'};
+    static const uint32_t MESH_CACHE_BYTE_ORDER = 0x01020304;
+    static const size_t MESH_CACHE_ALIGNMENT = 16;
+
+    template<typename T>
+    static size_t appendStruct(std::vector<uint8_t>& buffer, const T& value) {
+        size_t offset = buffer.size();
+        buffer.resize(offset + sizeof(T));
+        std::memcpy(buffer.data() + offset, &value, sizeof(T));
+        return offset;
+    }
+
+    static size_t appendBlock(std::vector<uint8_t>& buffer, const void* data, size_t size) {
+        size_t offset = (buffer.size() + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+        buffer.resize(offset + size, 0);
+        if(size > 0) std::memcpy(buffer.data() + offset, data, size);
+        return offset;
+    }
+
+    bool saveMeshCache(const char* filename, uint64_t key, const std::vector<std::pair<std::string, Mesh*> >& meshes) {
+        for(auto& entry : meshes) {
+            const Mesh* mesh = entry.second;
+            for(size_t b = 0; b < mesh->getVertexBufferCount(); ++b) {
+                const VertexBuffer* vBuf = mesh->getVertexBuffer(b);
+                if(vBuf->getNumVertices() > 0 && !vBuf->canRestoreLocal()) {
+                    LOG_ERROR("Mesh '%s' can not be cached without a local copy of it's vertex data.", entry.first.c_str());
+                    return false;
+                }
+            }
+            const IndexBuffer* iBuf = mesh->getIndexBuffer();
+            if(iBuf && iBuf->getNumIndices() > 0 && !iBuf->canRestoreLocal()) {
+                LOG_ERROR("Mesh '%s' can not be cached without a local copy of it's index data.", entry.first.c_str());
+                return false;
+            }
+        }
+
+        std::vector<uint8_t> buffer;
+        MeshCacheFileHeader fileHeader;
+        std::memcpy(fileHeader.magic, MESH_CACHE_MAGIC, sizeof(fileHeader.magic));
+        fileHeader.version = MESH_CACHE_VERSION;
+        fileHeader.byteOrder = MESH_CACHE_BYTE_ORDER;
+        fileHeader.key = key;
+        fileHeader.meshCount = meshes.size();
+        fileHeader.reserved = 0;
+        appendStruct(buffer, fileHeader);
+
+        // All headers come first, so they are in the first few pages and the blocks can be read without seeking around.
+        // The offsets of the blocks are patched into the headers once they are known
+        struct PendingBlock {
+            size_t offsetPosition;
+            const void* data;
+            size_t size;
+        };
+        std::vector<PendingBlock> pendingBlocks;
+
+        for(auto& entry : meshes) {
+            const Mesh* mesh = entry.second;
+            const IndexBuffer* iBuf = mesh->getIndexBuffer();
+
+            MeshCacheMeshHeader meshHeader;
+            meshHeader.nameLength = entry.first.size();
+            meshHeader.drawMode = static_cast<uint32_t>(mesh->getDrawMode());
+            meshHeader.vertexBufferCount = mesh->getVertexBufferCount();
+            meshHeader.indexType = iBuf ? static_cast<uint32_t>(iBuf->getDataType()) : 0;
+            meshHeader.indexUsage = iBuf ? static_cast<uint32_t>(iBuf->getUsage()) : 0;
+            meshHeader.reserved = 0;
+            meshHeader.indexCount = iBuf ? iBuf->getNumIndices() : 0;
+            meshHeader.indexOffset = 0;
+            const AABoundingBox& bounds = mesh->boundingBox();
+            for(int i = 0; i < 3; ++i) {
+                meshHeader.boundsMin[i] = bounds.min[i];
+                meshHeader.boundsMax[i] = bounds.max[i];
+            }
+            size_t meshHeaderOffset = appendStruct(buffer, meshHeader);
+            buffer.insert(buffer.end(), entry.first.begin(), entry.first.end());
+            if(iBuf) pendingBlocks.push_back({meshHeaderOffset + offsetof(MeshCacheMeshHeader, indexOffset), iBuf->getData(), static_cast<size_t>(iBuf->getSize())});
+
+            for(size_t b = 0; b < mesh->getVertexBufferCount(); ++b) {
+                const VertexBuffer* vBuf = mesh->getVertexBuffer(b);
+                const std::vector<VertexAttribute>& attributes = vBuf->getVertexFormat().getAttributes();
+                MeshCacheVertexBufferHeader bufferHeader;
+                bufferHeader.attributeCount = attributes.size();
+                bufferHeader.usage = static_cast<uint32_t>(vBuf->getUsage());
+                bufferHeader.vertexCount = vBuf->getNumVertices();
+                bufferHeader.dataOffset = 0;
+                size_t bufferHeaderOffset = appendStruct(buffer, bufferHeader);
+                pendingBlocks.push_back({bufferHeaderOffset + offsetof(MeshCacheVertexBufferHeader, dataOffset), vBuf->getData(), static_cast<size_t>(vBuf->getSize())});
+                for(auto& attr : attributes) {
+                    MeshCacheAttribute cacheAttr;
+                    cacheAttr.type = static_cast<uint32_t>(attr.type);
+                    cacheAttr.num = attr.num;
+                    cacheAttr.dataType = static_cast<uint32_t>(attr.dataType);
+                    cacheAttr.normalized = attr.normalized ? 1 : 0;
+                    cacheAttr.divisor = attr.divisor;
+                    appendStruct(buffer, cacheAttr);
+                }
+            }
+        }
+
+        for(auto& block : pendingBlocks) {
+            uint64_t offset = appendBlock(buffer, block.data, block.size);
+            std::memcpy(buffer.data() + block.offsetPosition, &offset, sizeof(offset));
+        }
+        for(auto& entry : meshes) entry.second->releaseRestoredData();
+
+        FILE* file = std::fopen(filename, "wb");
+        if(!file) {
+            LOG_ERROR("Mesh cache file '%s' could not be opened for writing.", filename);
+            return false;
+        }
+        bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+        written = std::fclose(file) == 0 && written;
+        if(!written) {
+            LOG_ERROR("Mesh cache file '%s' could not be written.", filename);
+            // don't leave a truncated file behind
+            std::remove(filename);
+        }
+        return written;
+    }
+
+    // Reads from a memory range and fails on everything that would read outside of it
+    class MeshCacheReader {
+    private:
+        const uint8_t* mData;
+        size_t mSize;
+        size_t mOffset;
+
+    public:
+        MeshCacheReader(const uint8_t* data, size_t size) : mData(data), mSize(size), mOffset(0) {}
+
+        template<typename T>
+        bool read(T& value) {
+            if(mSize - mOffset < sizeof(T)) return false;
+            std::memcpy(&value, mData + mOffset, sizeof(T));
+            mOffset += sizeof(T);
+            return true;
+        }
+
+        const uint8_t* skip(size_t size) {
+            if(mSize - mOffset < size) return nullptr;
+            const uint8_t* data = mData + mOffset;
+            mOffset += size;
+            return data;
+        }
+
+        // returns nullptr if the block is not completely inside of the file
+        const uint8_t* block(uint64_t offset, uint64_t size) const {
+            if(offset > mSize || mSize - offset < size) return nullptr;
+            return mData + offset;
+        }
+    };
+
+    static bool isValidAttributeDataType(uint32_t dataType) {
+        switch(static_cast<AttributeDataType>(dataType)) {
+            case AttributeDataType::I8: case AttributeDataType::UI8:
+            case AttributeDataType::I16: case AttributeDataType::UI16:
+            case AttributeDataType::I32: case AttributeDataType::UI32:
+            case AttributeDataType::F16: case AttributeDataType::F32:
+            case AttributeDataType::I2_10_10_10: case AttributeDataType::UI2_10_10_10:
+                return true;
+        }
+        return false;
+    }
+
+    static bool isValidIndexType(uint32_t indexType) {
+        return indexType == static_cast<uint32_t>(IndexBufferType::UI8) || indexType == static_cast<uint32_t>(IndexBufferType::UI16)
+            || indexType == static_cast<uint32_t>(IndexBufferType::UI32);
+    }
+
+    bool loadMeshCache(const char* filename, uint64_t key, std::vector<std::pair<std::string, Mesh*> >& meshes, bool keepLocalData) {
+        MappedFile file;
+        if(!file.open(filename)) return false;
+        MeshCacheReader reader(file.getData(), file.getSize());
+
+        MeshCacheFileHeader fileHeader;
+        if(!reader.read(fileHeader)) return false;
+        if(std::memcmp(fileHeader.magic, MESH_CACHE_MAGIC, sizeof(fileHeader.magic)) != 0 || fileHeader.version != MESH_CACHE_VERSION
+                || fileHeader.byteOrder != MESH_CACHE_BYTE_ORDER) {
+            LOG_DEBUG("Mesh cache file '%s' has another version or byte order, ignoring it.", filename);
+            return false;
+        }
+        if(fileHeader.key != key) return false;
+
+        std::vector<std::pair<std::string, Mesh*> > loaded;
+        bool valid = true;
+        for(uint32_t m = 0; m < fileHeader.meshCount && valid; ++m) {
+            MeshCacheMeshHeader meshHeader;
+            const uint8_t* name = nullptr;
+            valid = reader.read(meshHeader) && (name = reader.skip(meshHeader.nameLength)) != nullptr;
+            if(!valid) break;
+
+            Mesh* mesh = new Mesh(static_cast<Mesh::DrawMode>(meshHeader.drawMode));
+            loaded.push_back(std::make_pair(std::string(reinterpret_cast<const char*>(name), meshHeader.nameLength), mesh));
+
+            for(uint32_t b = 0; b < meshHeader.vertexBufferCount && valid; ++b) {
+                MeshCacheVertexBufferHeader bufferHeader;
+                valid = reader.read(bufferHeader);
+                VertexFormat format;
+                for(uint32_t a = 0; a < bufferHeader.attributeCount && valid; ++a) {
+                    MeshCacheAttribute cacheAttr;
+                    valid = reader.read(cacheAttr) && cacheAttr.type < static_cast<uint32_t>(AttributeType::FINAL_COUNT_ENTRY)
+                        && !format.hasAttribute(static_cast<AttributeType>(cacheAttr.type))
+                        && cacheAttr.num >= 1 && cacheAttr.num <= 4 && isValidAttributeDataType(cacheAttr.dataType);
+                    if(valid) format.add(static_cast<AttributeType>(cacheAttr.type), cacheAttr.num,
+                        static_cast<AttributeDataType>(cacheAttr.dataType), cacheAttr.normalized != 0, cacheAttr.divisor);
+                }
+                if(!valid) break;
+
+                const uint8_t* data = reader.block(bufferHeader.dataOffset, bufferHeader.vertexCount * format.getStride());
+                valid = data != nullptr;
+                if(!valid) break;
+                UsageHint usage = static_cast<UsageHint>(bufferHeader.usage);
+                VertexBuffer* vBuf;
+                if(keepLocalData) {
+                    vBuf = mesh->addVertexBuffer(format, bufferHeader.vertexCount, usage);
+                    if(vBuf) std::memcpy(vBuf->getData(), data, vBuf->getSize());
+                } else {
+                    vBuf = mesh->addVertexBuffer(format, usage);
+                    if(vBuf) vBuf->uploadFrom(data, bufferHeader.vertexCount);
+                }
+                valid = vBuf != nullptr;
+            }
+            if(!valid) break;
+
+            if(meshHeader.indexType != 0) {
+                valid = isValidIndexType(meshHeader.indexType);
+                if(!valid) break;
+                IndexBufferType indexType = static_cast<IndexBufferType>(meshHeader.indexType);
+                const uint8_t* data = reader.block(meshHeader.indexOffset, meshHeader.indexCount * getIndexBufferTypeSize(indexType));
+                valid = data != nullptr;
+                if(!valid) break;
+                UsageHint usage = static_cast<UsageHint>(meshHeader.indexUsage);
+                if(keepLocalData) {
+                    IndexBuffer* iBuf = mesh->setIndexBuffer(indexType, meshHeader.indexCount, usage);
+                    std::memcpy(iBuf->getData<uint8_t>(), data, iBuf->getSize());
+                } else {
+                    mesh->setIndexBuffer(indexType, usage)->uploadFrom(data, meshHeader.indexCount);
+                }
+            }
+
+            AABoundingBox bounds;
+            bounds.min = glm::vec3(meshHeader.boundsMin[0], meshHeader.boundsMin[1], meshHeader.boundsMin[2]);
+            bounds.max = glm::vec3(meshHeader.boundsMax[0], meshHeader.boundsMax[1], meshHeader.boundsMax[2]);
+            mesh->setBoundingBox(bounds);
+        }
+
+        if(!valid) {
+            LOG_ERROR("Mesh cache file '%s' is broken, ignoring it.", filename);
+            for(auto& entry : loaded) delete entry.second;
+            return false;
+        }
+
+        meshes.insert(meshes.end(), loaded.begin(), loaded.end());
+        return true;
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace ngn {
+    class Mesh;
+
+    // .ngnmesh files cache imported meshes, so the slow import (e.g. assimpMeshes) only has to happen once.
+    // They contain a header with a version and a key, that identifies what was imported (e.g. a hash of the source file and
+    // the import settings), then per mesh: name, draw mode, bounds, the vertex formats and the raw vertex and index blocks.
+    // The blocks are aligned to 16 bytes, so they can be uploaded directly from the memory mapped file.
+    // The data is stored in the byte order of the machine that wrote it, on another one the file is just rejected.
+    // 2: tangents are generated on import
+    static const uint32_t MESH_CACHE_VERSION = 2;
+
+    // All meshes need a local copy of their data
+    bool saveMeshCache(const char* filename, uint64_t key, const std::vector<std::pair<std::string, Mesh*> >& meshes);
+
+    // Returns false and leaves meshes untouched, if the file does not exist, is broken or has another version or key.
+    // With keepLocalData = false the vertex and index blocks are uploaded straight from the mapped file without keeping
+    // a local copy (so it has to be called with a current GL context), which saves memory and a copy, but the meshes can't be
+    // modified, merged, optimized or raycast anymore (their bounds are still set though).
+    bool loadMeshCache(const char* filename, uint64_t key, std::vector<std::pair<std::string, Mesh*> >& meshes, bool keepLocalData = true);
+}
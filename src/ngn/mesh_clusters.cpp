@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cmath>
+
+#include "mesh_clusters.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    // how much a triangle, whose normal is opposite to the average normal of the cluster, counts in new vertices
+    static const float CLUSTER_NORMAL_WEIGHT = 2.0f;
+
+    static void computeClusterBounds(MeshCluster& cluster, const uint32_t* indices, const glm::vec3* positions, const glm::vec3* triangleNormals) {
+        const uint32_t* clusterIndices = indices + cluster.indexOffset;
+        size_t triangleCount = cluster.indexCount / 3;
+
+        AABoundingBox box;
+        box.min = box.max = positions[clusterIndices[0]];
+        for(size_t i = 1; i < cluster.indexCount; ++i) box.fitPoint(positions[clusterIndices[i]]);
+        cluster.center = (box.min + box.max) * 0.5f;
+        float radiusSq = 0.0f;
+        for(size_t i = 0; i < cluster.indexCount; ++i) {
+            glm::vec3 d = positions[clusterIndices[i]] - cluster.center;
+            radiusSq = std::max(radiusSq, glm::dot(d, d));
+        }
+        cluster.radius = std::sqrt(radiusSq);
+
+        // the normal cone, like in meshoptimizer's meshopt_computeClusterBounds
+        glm::vec3 normalSum(0.0f);
+        for(size_t t = 0; t < triangleCount; ++t) normalSum += triangleNormals[(cluster.indexOffset / 3) + t];
+        float length = glm::length(normalSum);
+        cluster.coneAxis = length > 0.0f ? normalSum / length : glm::vec3(1.0f, 0.0f, 0.0f);
+        cluster.coneApex = cluster.center;
+        cluster.coneCutoff = 1.0f;
+        if(length == 0.0f) return;
+
+        float minDot = 1.0f;
+        for(size_t t = 0; t < triangleCount; ++t) {
+            const glm::vec3& normal = triangleNormals[(cluster.indexOffset / 3) + t];
+            if(normal != glm::vec3(0.0f)) minDot = std::min(minDot, glm::dot(normal, cluster.coneAxis));
+        }
+        // the cone would be wider than 180 degrees (or close to it), so the cluster is never completely backfacing
+        if(minDot <= 0.1f) return;
+
+        // move the apex back along the axis, until it's behind the planes of all triangles
+        float maxT = 0.0f;
+        for(size_t t = 0; t < triangleCount; ++t) {
+            const glm::vec3& normal = triangleNormals[(cluster.indexOffset / 3) + t];
+            if(normal == glm::vec3(0.0f)) continue;
+            float dc = glm::dot(cluster.center - positions[clusterIndices[t*3]], normal);
+            float dn = glm::dot(cluster.coneAxis, normal);
+            maxT = std::max(maxT, dc / dn);
+        }
+        cluster.coneApex = cluster.center - cluster.coneAxis * maxT;
+        cluster.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    std::vector<MeshCluster> buildMeshClusters(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+                                               size_t maxVertices, size_t maxTriangles) {
+        std::vector<MeshCluster> clusters;
+        size_t triangleCount = indexCount / 3;
+        if(triangleCount == 0) return clusters;
+        maxVertices = std::max(maxVertices, static_cast<size_t>(3));
+        maxTriangles = std::max(maxTriangles, static_cast<size_t>(1));
+
+        std::vector<glm::vec3> triangleNormals(triangleCount);
+        for(size_t t = 0; t < triangleCount; ++t) {
+            const glm::vec3& p0 = positions[indices[t*3+0]];
+            glm::vec3 normal = glm::cross(positions[indices[t*3+1]] - p0, positions[indices[t*3+2]] - p0);
+            float length = glm::length(normal);
+            triangleNormals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+        }
+
+        // the triangles using vertex v are adjacentTriangles[adjacencyOffsets[v]] to adjacentTriangles[adjacencyOffsets[v+1]-1]
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0), adjacentTriangles(triangleCount * 3);
+        for(size_t i = 0; i < triangleCount * 3; ++i) ++adjacencyOffsets[indices[i] + 1];
+        for(size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        {
+            std::vector<uint32_t> next(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for(size_t i = 0; i < triangleCount * 3; ++i) adjacentTriangles[next[indices[i]]++] = i / 3;
+        }
+
+        const uint32_t NONE = ~static_cast<uint32_t>(0);
+        std::vector<bool> assigned(triangleCount, false);
+        // the cluster a vertex was last added to, so membership in the current one is a single lookup
+        std::vector<uint32_t> vertexCluster(vertexCount, NONE);
+
+        std::vector<std::vector<uint32_t> > clusterTriangles;
+        std::vector<uint32_t> candidates;
+        size_t seed = 0;
+        while(true) {
+            while(seed < triangleCount && assigned[seed]) ++seed;
+            if(seed == triangleCount) break;
+
+            uint32_t clusterIndex = clusterTriangles.size();
+            clusterTriangles.emplace_back();
+            std::vector<uint32_t>& triangles = clusterTriangles.back();
+            size_t clusterVertexCount = 0;
+            glm::vec3 normalSum(0.0f);
+            candidates.clear();
+
+            uint32_t triangle = seed;
+            while(triangle != NONE) {
+                assigned[triangle] = true;
+                triangles.push_back(triangle);
+                normalSum += triangleNormals[triangle];
+                for(int c = 0; c < 3; ++c) {
+                    uint32_t v = indices[triangle*3+c];
+                    if(vertexCluster[v] == clusterIndex) continue;
+                    vertexCluster[v] = clusterIndex;
+                    ++clusterVertexCount;
+                    for(uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a) {
+                        if(!assigned[adjacentTriangles[a]]) candidates.push_back(adjacentTriangles[a]);
+                    }
+                }
+                if(triangles.size() >= maxTriangles) break;
+
+                float normalLength = glm::length(normalSum);
+                glm::vec3 clusterNormal = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+                triangle = NONE;
+                float bestScore = 0.0f;
+                size_t writeIndex = 0;
+                for(size_t i = 0; i < candidates.size(); ++i) {
+                    uint32_t candidate = candidates[i];
+                    // drop the ones that were taken in the meantime
+                    if(assigned[candidate]) continue;
+                    candidates[writeIndex++] = candidate;
+
+                    int newVertices = 0;
+                    for(int c = 0; c < 3; ++c) newVertices += vertexCluster[indices[candidate*3+c]] != clusterIndex ? 1 : 0;
+                    if(clusterVertexCount + newVertices > maxVertices) continue;
+
+                    float score = newVertices + (1.0f - glm::dot(triangleNormals[candidate], clusterNormal)) * CLUSTER_NORMAL_WEIGHT;
+                    if(triangle == NONE || score < bestScore) {
+                        triangle = candidate;
+                        bestScore = score;
+                    }
+                }
+                candidates.resize(writeIndex);
+            }
+        }
+
+        // write the clusters one after another, their triangles in the original order
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+        std::vector<glm::vec3> outputNormals;
+        outputNormals.reserve(triangleCount);
+        clusters.resize(clusterTriangles.size());
+        for(size_t c = 0; c < clusterTriangles.size(); ++c) {
+            std::vector<uint32_t>& triangles = clusterTriangles[c];
+            std::sort(triangles.begin(), triangles.end());
+            clusters[c].indexOffset = output.size();
+            clusters[c].indexCount = triangles.size() * 3;
+            for(auto t : triangles) {
+                output.insert(output.end(), indices + t * 3, indices + t * 3 + 3);
+                outputNormals.push_back(triangleNormals[t]);
+            }
+        }
+        std::copy(output.begin(), output.end(), indices);
+
+        for(auto& cluster : clusters) computeClusterBounds(cluster, indices, positions, outputNormals.data());
+        return clusters;
+    }
+
+    size_t cullMeshClusters(const std::vector<MeshCluster>& clusters, const Frustum& frustum, const glm::vec3& viewPosition, bool orthographic,
+                            std::vector<std::pair<size_t, size_t> >& ranges) {
+        size_t visible = 0;
+        size_t firstRange = ranges.size();
+        for(auto& cluster : clusters) {
+            bool inside = true;
+            for(int p = 0; p < 6 && inside; ++p) {
+                inside = glm::dot(glm::vec3(frustum.planes[p]), cluster.center) + frustum.planes[p].w >= -cluster.radius;
+            }
+            if(!inside) continue;
+
+            glm::vec3 viewDir = orthographic ? viewPosition : cluster.coneApex - viewPosition;
+            float viewLength = glm::length(viewDir);
+            if(viewLength > 0.0f && glm::dot(viewDir, cluster.coneAxis) >= cluster.coneCutoff * viewLength) continue;
+
+            ++visible;
+            if(ranges.size() > firstRange && ranges.back().first + ranges.back().second == cluster.indexOffset) {
+                ranges.back().second += cluster.indexCount;
+            } else {
+                ranges.push_back(std::make_pair(static_cast<size_t>(cluster.indexOffset), static_cast<size_t>(cluster.indexCount)));
+            }
+        }
+        return visible;
+    }
+
+    bool Mesh::buildClusters(size_t maxVertices, size_t maxTriangles) {
+        mClusters.clear();
+        if(mMode != DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::TRIANGLES can be split into clusters.");
+            return false;
+        }
+        if(!mIndexBuffer || !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("Only meshes with an index buffer (and a local copy of it) can be split into clusters.");
+            return false;
+        }
+        VertexBuffer* posBuffer = hasAttribute(AttributeType::POSITION);
+        if(!posBuffer || !posBuffer->canRestoreLocal()) {
+            LOG_ERROR("The mesh needs a local copy of it's positions to be split into clusters.");
+            return false;
+        }
+
+        size_t vertexCount = getVertexCount();
+        std::vector<glm::vec3> positions(vertexCount);
+        getAccessor<glm::vec3>(AttributeType::POSITION).copyTo(positions.data());
+
+        IndexBuffer& indexBuffer = *mIndexBuffer;
+        const IndexBuffer& oldIndices = indexBuffer;
+        std::vector<uint32_t> indices(indexBuffer.getNumIndices());
+        for(size_t i = 0; i < indices.size(); ++i) indices[i] = oldIndices[i];
+
+        mClusters = buildMeshClusters(indices.data(), indices.size(), positions.data(), vertexCount, maxVertices, maxTriangles);
+
+        for(size_t i = 0; i < indices.size(); ++i) indexBuffer[i] = indices[i];
+        if(indexBuffer.getUploadCount() > 0) indexBuffer.upload();
+        // the triangle order changed
+        mBVH.reset();
+        releaseRestoredData();
+        return true;
+    }
+
+    void Mesh::drawRanges(const std::vector<std::pair<size_t, size_t> >& ranges, size_t instanceCount) {
+        if(ranges.empty() || !mIndexBuffer) return;
+        GLenum mode = static_cast<GLenum>(mMode);
+        IndexBufferType indexType = mIndexBuffer->getDataType();
+        size_t indexOffset = 0;
+        GLint baseVertex = 0;
+        if(mArena) {
+            bindVAO(mArenaAllocation.pool->getVAO());
+            indexType = mArenaAllocation.pool->getIndexType();
+            indexOffset = getArenaIndexRange(0).first;
+            baseVertex = mArenaAllocation.vertexOffset;
+        } else {
+            checkBufferObjects();
+            if(mVAO == 0) compile();
+            bindVAO(mVAO);
+        }
+        size_t indexSize = getIndexBufferTypeSize(indexType);
+
+        // only used on the thread with the GL context
+        static std::vector<GLsizei> counts;
+        static std::vector<const void*> offsets;
+        static std::vector<GLint> baseVertices;
+        counts.resize(ranges.size());
+        offsets.resize(ranges.size());
+        baseVertices.assign(ranges.size(), baseVertex);
+        for(size_t i = 0; i < ranges.size(); ++i) {
+            counts[i] = ranges[i].second;
+            offsets[i] = reinterpret_cast<const void*>((indexOffset + ranges[i].first) * indexSize);
+        }
+
+        if(instanceCount > 0) {
+            // there is no instanced multi draw in GL 3.3
+            for(size_t i = 0; i < ranges.size(); ++i) {
+                glDrawElementsInstancedBaseVertex(mode, counts[i], static_cast<GLenum>(indexType), offsets[i], instanceCount, baseVertex);
+            }
+        } else if(mArena) {
+            glMultiDrawElementsBaseVertex(mode, counts.data(), static_cast<GLenum>(indexType), offsets.data(), ranges.size(), baseVertices.data());
+        } else {
+            glMultiDrawElements(mode, counts.data(), static_cast<GLenum>(indexType), offsets.data(), ranges.size());
+        }
+    }
+}
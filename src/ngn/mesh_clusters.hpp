@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
+namespace ngn {
+    // A contiguous range of triangles of an index buffer (a "meshlet") with bounds for culling it on the CPU
+    struct MeshCluster {
+        // in indices, not triangles
+        uint32_t indexOffset, indexCount;
+        glm::vec3 center;
+        float radius;
+        // All triangles face away from any point p with dot(normalize(coneApex - p), coneAxis) >= coneCutoff.
+        // coneCutoff is 1 if the normals are spread too far for the cluster to ever be backfacing as a whole
+        glm::vec3 coneApex;
+        glm::vec3 coneAxis;
+        float coneCutoff;
+    };
+
+    // Reorders the triangles of a triangle list, so that they form clusters of at most maxVertices distinct vertices and at most
+    // maxTriangles triangles each, and returns the clusters. Clusters are grown greedily from a seed triangle (in index buffer order)
+    // by adding adjacent triangles that add the fewest new vertices and whose normals are closest to the cluster's, so they are
+    // compact and have narrow normal cones. Inside of a cluster the triangles keep their relative order, so a previous vertex cache
+    // optimization is mostly preserved.
+    std::vector<MeshCluster> buildMeshClusters(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+                                               size_t maxVertices = 64, size_t maxTriangles = 124);
+
+    // Appends the index ranges (offset, count) of the clusters, that intersect the frustum and are not backfacing as seen from
+    // viewPosition, to ranges. Adjacent ranges are merged. All of this has to be in the space of the clusters (i.e. model space).
+    // For orthographic projections pass the view direction instead and orthographic = true. Returns the number of surviving clusters
+    size_t cullMeshClusters(const std::vector<MeshCluster>& clusters, const Frustum& frustum, const glm::vec3& viewPosition, bool orthographic,
+                            std::vector<std::pair<size_t, size_t> >& ranges);
+}
@@ -0,0 +1,314 @@
+#include <cmath>
+#include <cstring>
+
+#include "mesh_normals.hpp"
+#include "mesh.hpp"
+#include "misc.hpp"
+
+namespace ngn {
+    // elements per task of parallelFor, small enough to balance, big enough that the scheduling doesn't matter
+    static const size_t PARALLEL_CHUNK_SIZE = 4096;
+
+    // The corners (positions in the index buffer) that use each vertex are corners[offsets[v]] to corners[offsets[v+1]-1], in index buffer order
+    static void buildVertexCorners(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                   std::vector<uint32_t>& offsets, std::vector<uint32_t>& corners) {
+        offsets.assign(vertexCount + 1, 0);
+        for(size_t i = 0; i < indexCount; ++i) ++offsets[indices[i] + 1];
+        for(size_t v = 0; v < vertexCount; ++v) offsets[v + 1] += offsets[v];
+
+        corners.resize(indexCount);
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < indexCount; ++i) corners[next[indices[i]]++] = i;
+    }
+
+    // 0 for degenerate corners
+    static inline float cornerAngle(const glm::vec3& a, const glm::vec3& b) {
+        return std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+    }
+
+    void calculateVertexNormals(glm::vec3* normals, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+                                bool faceAreaWeighted, unsigned int threadCount) {
+        size_t triangleCount = indexCount / 3;
+        // the weighted face normal for every corner
+        std::vector<glm::vec3> cornerNormals(triangleCount * 3);
+        parallelFor(triangleCount, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t t = begin; t < end; ++t) {
+                const glm::vec3& p0 = positions[indices[t*3+0]];
+                const glm::vec3& p1 = positions[indices[t*3+1]];
+                const glm::vec3& p2 = positions[indices[t*3+2]];
+                glm::vec3 e01 = p1 - p0, e02 = p2 - p0, e12 = p2 - p1;
+                // the length of this is twice the area
+                glm::vec3 normal = glm::cross(e01, e02);
+                if(faceAreaWeighted) {
+                    cornerNormals[t*3+0] = cornerNormals[t*3+1] = cornerNormals[t*3+2] = normal;
+                } else {
+                    float length = glm::length(normal);
+                    if(length > 0.0f) normal /= length;
+                    cornerNormals[t*3+0] = normal * cornerAngle(e01, e02);
+                    cornerNormals[t*3+1] = normal * cornerAngle(e12, -e01);
+                    cornerNormals[t*3+2] = normal * cornerAngle(-e02, -e12);
+                }
+            }
+        }, threadCount);
+
+        std::vector<uint32_t> offsets, corners;
+        buildVertexCorners(indices, triangleCount * 3, vertexCount, offsets, corners);
+
+        parallelFor(vertexCount, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t v = begin; v < end; ++v) {
+                glm::vec3 sum(0.0f);
+                for(uint32_t c = offsets[v]; c < offsets[v + 1]; ++c) sum += cornerNormals[corners[c]];
+                float length = glm::length(sum);
+                if(length > 0.0f) normals[v] = sum / length;
+            }
+        }, threadCount);
+    }
+
+    std::vector<uint32_t> assignProvokingVertices(uint32_t* indices, size_t indexCount, size_t vertexCount, bool lastVertexConvention) {
+        std::vector<uint32_t> duplicates;
+        std::vector<bool> taken(vertexCount, false);
+        int provoking = lastVertexConvention ? 2 : 0;
+        for(size_t t = 0; t < indexCount / 3; ++t) {
+            uint32_t* tri = indices + t * 3;
+            int rotation = -1;
+            for(int r = 0; r < 3; ++r) {
+                if(!taken[tri[(provoking + r) % 3]]) {
+                    rotation = r;
+                    break;
+                }
+            }
+
+            if(rotation < 0) {
+                duplicates.push_back(tri[provoking]);
+                tri[provoking] = vertexCount + duplicates.size() - 1;
+            } else {
+                uint32_t rotated[3] = {tri[rotation], tri[(rotation + 1) % 3], tri[(rotation + 2) % 3]};
+                std::memcpy(tri, rotated, sizeof(rotated));
+                taken[tri[provoking]] = true;
+            }
+        }
+        return duplicates;
+    }
+
+    void calculateFaceNormals(glm::vec3* normals, const uint32_t* indices, size_t indexCount, const glm::vec3* positions,
+                              bool lastVertexConvention, unsigned int threadCount) {
+        int provoking = lastVertexConvention ? 2 : 0;
+        parallelFor(indexCount / 3, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t t = begin; t < end; ++t) {
+                const glm::vec3& p0 = positions[indices[t*3+0]];
+                const glm::vec3& p1 = positions[indices[t*3+1]];
+                const glm::vec3& p2 = positions[indices[t*3+2]];
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float length = glm::length(normal);
+                if(length > 0.0f) normals[indices[t*3+provoking]] = normal / length;
+            }
+        }, threadCount);
+    }
+
+    void calculateTangents(glm::vec4* tangents, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, const glm::vec3* normals,
+                           const glm::vec2* texCoords, size_t vertexCount, unsigned int threadCount) {
+        size_t triangleCount = indexCount / 3;
+        // the angle weighted tangent and bitangent for every corner
+        std::vector<glm::vec3> cornerTangents(triangleCount * 3), cornerBitangents(triangleCount * 3);
+        parallelFor(triangleCount, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t t = begin; t < end; ++t) {
+                const uint32_t* tri = indices + t * 3;
+                glm::vec3 e1 = positions[tri[1]] - positions[tri[0]], e2 = positions[tri[2]] - positions[tri[0]];
+                glm::vec2 d1 = texCoords[tri[1]] - texCoords[tri[0]], d2 = texCoords[tri[2]] - texCoords[tri[0]];
+                float det = d1.x * d2.y - d2.x * d1.y;
+                // like MikkTSpace only the sign of the determinant is used, the directions are normalized per corner anyways
+                float sign = det > 0.0f ? 1.0f : -1.0f;
+                glm::vec3 sDir = (d2.y * e1 - d1.y * e2) * sign;
+                glm::vec3 tDir = (d1.x * e2 - d2.x * e1) * sign;
+                if(det == 0.0f) sDir = tDir = glm::vec3(0.0f);
+
+                for(int c = 0; c < 3; ++c) {
+                    const glm::vec3& n = normals[tri[c]];
+                    const glm::vec3& p = positions[tri[c]];
+                    // the edges are projected to the tangent plane as well, before the angle between them is measured
+                    glm::vec3 a = positions[tri[(c + 1) % 3]] - p, b = positions[tri[(c + 2) % 3]] - p;
+                    a -= n * glm::dot(n, a);
+                    b -= n * glm::dot(n, b);
+                    float weight = cornerAngle(a, b);
+
+                    glm::vec3 s = sDir - n * glm::dot(n, sDir), bi = tDir - n * glm::dot(n, tDir);
+                    float sLength = glm::length(s), bLength = glm::length(bi);
+                    cornerTangents[t*3+c] = sLength > 0.0f ? s * (weight / sLength) : glm::vec3(0.0f);
+                    cornerBitangents[t*3+c] = bLength > 0.0f ? bi * (weight / bLength) : glm::vec3(0.0f);
+                }
+            }
+        }, threadCount);
+
+        std::vector<uint32_t> offsets, corners;
+        buildVertexCorners(indices, triangleCount * 3, vertexCount, offsets, corners);
+
+        parallelFor(vertexCount, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t v = begin; v < end; ++v) {
+                if(offsets[v] == offsets[v + 1]) continue;
+                glm::vec3 tangent(0.0f), bitangent(0.0f);
+                for(uint32_t c = offsets[v]; c < offsets[v + 1]; ++c) {
+                    tangent += cornerTangents[corners[c]];
+                    bitangent += cornerBitangents[corners[c]];
+                }
+
+                const glm::vec3& n = normals[v];
+                tangent -= n * glm::dot(n, tangent);
+                float length = glm::length(tangent);
+                if(length > 0.0f) {
+                    tangent /= length;
+                } else {
+                    glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                    tangent = glm::normalize(axis - n * glm::dot(n, axis));
+                }
+                float sign = glm::dot(glm::cross(n, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+                tangents[v] = glm::vec4(tangent, sign);
+            }
+        }, threadCount);
+    }
+
+    // Copies the indices of the mesh or generates them for a mesh without an index buffer
+    static std::vector<uint32_t> getTriangleIndices(const Mesh& mesh) {
+        std::vector<uint32_t> indices;
+        const IndexBuffer* indexBuffer = mesh.getIndexBuffer();
+        if(indexBuffer) {
+            indices.resize(indexBuffer->getNumIndices());
+            for(size_t i = 0; i < indices.size(); ++i) indices[i] = (*indexBuffer)[i];
+        } else {
+            indices.resize(mesh.getVertexCount());
+            for(size_t i = 0; i < indices.size(); ++i) indices[i] = i;
+        }
+        return indices;
+    }
+
+    bool Mesh::checkNormalInputs(const char* operation, std::initializer_list<AttributeType> attributes) const {
+        if(mMode != DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::TRIANGLES can %s.", operation);
+            return false;
+        }
+        if(mIndexBuffer && !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("The mesh needs a local copy of it's index buffer to %s.", operation);
+            return false;
+        }
+        for(auto attrType : attributes) {
+            VertexBuffer* vBuf = hasAttribute(attrType);
+            if(!vBuf || !vBuf->canRestoreLocal()) {
+                LOG_ERROR("The mesh needs a local copy of it's %s attribute to %s.", getVertexAttributeTypeName(attrType), operation);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void uploadIfUploaded(VertexBuffer* vBuf) {
+        if(vBuf && vBuf->getUploadCount() > 0) vBuf->upload();
+    }
+
+    bool Mesh::calculateVertexNormals(bool faceAreaWeighted, unsigned int threadCount) {
+        if(!checkNormalInputs("calculate normals", {AttributeType::POSITION, AttributeType::NORMAL})) return false;
+
+        size_t vertexCount = getVertexCount();
+        std::vector<uint32_t> indices = getTriangleIndices(*this);
+        std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+        getAccessor<glm::vec3>(AttributeType::POSITION).copyTo(positions.data());
+        auto normal = getAccessor<glm::vec3>(AttributeType::NORMAL);
+        normal.copyTo(normals.data());
+
+        ngn::calculateVertexNormals(normals.data(), indices.data(), indices.size(), positions.data(), vertexCount, faceAreaWeighted, threadCount);
+
+        normal.copyFrom(normals.data());
+        uploadIfUploaded(hasAttribute(AttributeType::NORMAL));
+        releaseRestoredData();
+        return true;
+    }
+
+    bool Mesh::calculateFaceNormals(bool lastVertexConvention, unsigned int threadCount) {
+        if(!checkNormalInputs("calculate normals", {AttributeType::POSITION, AttributeType::NORMAL})) return false;
+
+        size_t vertexCount = getVertexCount();
+        std::vector<uint32_t> indices = getTriangleIndices(*this);
+        // without an index buffer every triangle has it's own vertices anyways
+        if(mIndexBuffer) {
+            std::vector<uint32_t> duplicates = assignProvokingVertices(indices.data(), indices.size(), vertexCount, lastVertexConvention);
+            if(duplicates.size() > 0) {
+                size_t newVertexCount = vertexCount + duplicates.size();
+                int indexSize = getIndexBufferTypeSize(mIndexBuffer->getDataType());
+                if(indexSize < 4 && newVertexCount > (static_cast<size_t>(1) << (indexSize * 8))) {
+                    LOG_ERROR("Flat normals need %d vertices, which is too many for the index buffer type of the mesh.", static_cast<int>(newVertexCount));
+                    return false;
+                }
+                for(auto& vBuf : mVertexBuffers) {
+                    if(!vBuf->canRestoreLocal()) {
+                        LOG_ERROR("The mesh needs a local copy of all of it's vertex buffers to calculate flat normals.");
+                        return false;
+                    }
+                }
+
+                for(auto& vBuf : mVertexBuffers) {
+                    // instanced attributes are not per vertex
+                    bool instanced = false;
+                    for(auto& attr : vBuf->getVertexFormat().getAttributes()) instanced = instanced || attr.divisor > 0;
+                    if(instanced) continue;
+
+                    size_t stride = vBuf->getVertexFormat().getStride();
+                    vBuf->reallocate(newVertexCount, true);
+                    uint8_t* data = static_cast<uint8_t*>(vBuf->getData());
+                    for(size_t i = 0; i < duplicates.size(); ++i) std::memcpy(data + (vertexCount + i) * stride, data + duplicates[i] * stride, stride);
+                }
+                vertexCount = newVertexCount;
+            }
+            for(size_t i = 0; i < indices.size(); ++i) (*mIndexBuffer)[i] = indices[i];
+            if(mIndexBuffer->getUploadCount() > 0) mIndexBuffer->upload();
+        }
+
+        std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+        getAccessor<glm::vec3>(AttributeType::POSITION).copyTo(positions.data());
+        auto normal = getAccessor<glm::vec3>(AttributeType::NORMAL);
+        normal.copyTo(normals.data());
+
+        ngn::calculateFaceNormals(normals.data(), indices.data(), indices.size(), positions.data(), lastVertexConvention, threadCount);
+
+        normal.copyFrom(normals.data());
+        for(auto& vBuf : mVertexBuffers) uploadIfUploaded(vBuf.get());
+        releaseRestoredData();
+        return true;
+    }
+
+    bool Mesh::calculateTangents(unsigned int threadCount) {
+        if(!checkNormalInputs("calculate tangents", {AttributeType::POSITION, AttributeType::NORMAL, AttributeType::TEXCOORD0, AttributeType::TANGENT}))
+            return false;
+        VertexBuffer* tangentBuffer = hasAttribute(AttributeType::TANGENT);
+        const VertexAttribute* tangentAttr = tangentBuffer->getVertexFormat().getAttribute(AttributeType::TANGENT);
+        VertexBuffer* bitangentBuffer = hasAttribute(AttributeType::BITANGENT);
+        if(bitangentBuffer && !bitangentBuffer->canRestoreLocal()) bitangentBuffer = nullptr;
+
+        size_t vertexCount = getVertexCount();
+        std::vector<uint32_t> indices = getTriangleIndices(*this);
+        std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+        std::vector<glm::vec2> texCoords(vertexCount);
+        std::vector<glm::vec4> tangents(vertexCount, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        getAccessor<glm::vec3>(AttributeType::POSITION).copyTo(positions.data());
+        getAccessor<glm::vec3>(AttributeType::NORMAL).copyTo(normals.data());
+        getAccessor<glm::vec2>(AttributeType::TEXCOORD0).copyTo(texCoords.data());
+
+        ngn::calculateTangents(tangents.data(), indices.data(), indices.size(), positions.data(), normals.data(), texCoords.data(), vertexCount, threadCount);
+
+        // the sign is only stored if the attribute has a w component
+        if(tangentAttr->num == 4) {
+            getAccessor<glm::vec4>(AttributeType::TANGENT).copyFrom(tangents.data());
+        } else {
+            std::vector<glm::vec3> tangents3(vertexCount);
+            for(size_t i = 0; i < vertexCount; ++i) tangents3[i] = glm::vec3(tangents[i]);
+            getAccessor<glm::vec3>(AttributeType::TANGENT).copyFrom(tangents3.data());
+        }
+        uploadIfUploaded(tangentBuffer);
+
+        if(bitangentBuffer) {
+            std::vector<glm::vec3> bitangents(vertexCount);
+            for(size_t i = 0; i < vertexCount; ++i) bitangents[i] = glm::cross(normals[i], glm::vec3(tangents[i])) * tangents[i].w;
+            getAccessor<glm::vec3>(AttributeType::BITANGENT).copyFrom(bitangents.data());
+            uploadIfUploaded(bitangentBuffer);
+        }
+        releaseRestoredData();
+        return true;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+namespace ngn {
+    // All of these work on triangle lists and run on multiple threads (see parallelFor in misc.hpp) for big meshes. Every vertex is
+    // computed from the corners that use it in the order they appear in the index buffer, so the results are the same for any thread count.
+    // Vertices that are not used by any triangle keep the value they had in the output array.
+
+    // Smooth normals, area weighted (the unnormalized face normals are summed up) or angle weighted (the face normals are weighted
+    // by the angle of the triangle at the vertex, which doesn't depend on the tessellation). Vertices of only degenerate triangles keep their normal too
+    void calculateVertexNormals(glm::vec3* normals, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+                                bool faceAreaWeighted = true, unsigned int threadCount = 0);
+
+    // Rotates the vertices of every triangle (which keeps the winding), so that it's provoking vertex (the last one with
+    // lastVertexConvention, otherwise the first) is not the provoking vertex of any other triangle. If all three vertices are taken,
+    // the triangle gets a copy of the provoking vertex: the returned vector has the vertices that have to be duplicated and
+    // indices that are >= vertexCount refer to them (vertexCount + the index in the vector).
+    std::vector<uint32_t> assignProvokingVertices(uint32_t* indices, size_t indexCount, size_t vertexCount, bool lastVertexConvention = true);
+
+    // Writes the normal of every triangle to it's provoking vertex, for flat shading (the indices should come from assignProvokingVertices)
+    void calculateFaceNormals(glm::vec3* normals, const uint32_t* indices, size_t indexCount, const glm::vec3* positions,
+                              bool lastVertexConvention = true, unsigned int threadCount = 0);
+
+    // Tangents in the convention of MikkTSpace (http://www.mikktspace.com/): xyz is the tangent, orthogonal to the normal,
+    // w is the sign of the bitangent, which is w * cross(normal, tangent). Like in MikkTSpace the directions of every triangle are
+    // projected onto the tangent plane of the vertex and weighted by the angle of the triangle at the vertex. Unlike MikkTSpace,
+    // vertices are never split, so vertices on a UV seam that are shared by triangles with mirrored texture coordinates get one tangent.
+    // Vertices whose triangles all have degenerate texture coordinates get an arbitrary tangent orthogonal to the normal.
+    void calculateTangents(glm::vec4* tangents, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, const glm::vec3* normals,
+                           const glm::vec2* texCoords, size_t vertexCount, unsigned int threadCount = 0);
+}
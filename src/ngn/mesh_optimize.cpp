@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "mesh_optimize.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize) {
+        VertexCacheStats stats;
+        if(indexCount < 3 || vertexCount == 0) return stats;
+
+        // a vertex is in the cache if it was inserted less than cacheSize misses ago
+        std::vector<size_t> insertedAt(vertexCount, 0);
+        std::vector<bool> used(vertexCount, false);
+        size_t misses = 0, usedCount = 0;
+        for(size_t i = 0; i < indexCount; ++i) {
+            uint32_t v = indices[i];
+            if(!used[v]) {
+                used[v] = true;
+                ++usedCount;
+            }
+            if(insertedAt[v] == 0 || misses - insertedAt[v] >= static_cast<size_t>(cacheSize)) {
+                ++misses;
+                insertedAt[v] = misses;
+            }
+        }
+
+        stats.acmr = static_cast<float>(misses) / (indexCount / 3);
+        stats.atvr = static_cast<float>(misses) / usedCount;
+        return stats;
+    }
+
+    static const int FORSYTH_CACHE_SIZE = 32;
+
+    inline float forsythVertexScore(int cachePosition, int remainingValence) {
+        const float cacheDecayPower = 1.5f;
+        const float lastTriScore = 0.75f;
+        const float valenceBoostScale = 2.0f;
+        const float valenceBoostPower = 0.5f;
+
+        if(remainingValence == 0) return -1.0f;
+
+        float score = 0.0f;
+        if(cachePosition >= 0) {
+            if(cachePosition < 3) {
+                // the last triangle's vertices get a fixed score, so that it's not preferred to just continue with them
+                score = lastTriScore;
+            } else {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, cacheDecayPower);
+            }
+        }
+        // prefer vertices with few triangles left, to get rid of lone triangles early
+        score += valenceBoostScale * std::pow(static_cast<float>(remainingValence), -valenceBoostPower);
+        return score;
+    }
+
+    void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+        size_t triangleCount = indexCount / 3;
+        if(triangleCount == 0) return;
+
+        // vertex -> triangle adjacency as offsets into one array
+        std::vector<uint32_t> valence(vertexCount, 0);
+        for(size_t i = 0; i < triangleCount * 3; ++i) ++valence[indices[i]];
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for(size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] = adjacencyOffsets[v] + valence[v];
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for(size_t t = 0; t < triangleCount; ++t) {
+                for(int c = 0; c < 3; ++c) adjacency[fill[indices[t*3+c]]++] = t;
+            }
+        }
+
+        // the triangles of a vertex that are not emitted yet are kept at the front of it's adjacency range
+        std::vector<uint32_t> remaining(valence);
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for(size_t v = 0; v < vertexCount; ++v) vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+        for(size_t t = 0; t < triangleCount; ++t) {
+            triangleScore[t] = vertexScore[indices[t*3+0]] + vertexScore[indices[t*3+1]] + vertexScore[indices[t*3+2]];
+        }
+
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+
+        // the cache has 3 extra slots for the vertices pushed out by the last triangle
+        uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+        int cacheCount = 0;
+        size_t scanCursor = 0;
+
+        int bestTriangle = -1;
+        float bestScore = -1.0f;
+        for(size_t t = 0; t < triangleCount; ++t) {
+            if(triangleScore[t] > bestScore) {
+                bestScore = triangleScore[t];
+                bestTriangle = t;
+            }
+        }
+
+        while(bestTriangle >= 0) {
+            emitted[bestTriangle] = true;
+            const uint32_t* tri = indices + bestTriangle * 3;
+            for(int c = 0; c < 3; ++c) output.push_back(tri[c]);
+
+            // remove the triangle from the adjacency of it's vertices
+            for(int c = 0; c < 3; ++c) {
+                uint32_t v = tri[c];
+                uint32_t* begin = adjacency.data() + adjacencyOffsets[v];
+                uint32_t* end = begin + remaining[v];
+                uint32_t* it = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+                std::swap(*it, *(end - 1));
+                --remaining[v];
+            }
+
+            // move the triangle's vertices to the front of the cache (LRU)
+            uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+            int newCacheCount = 0;
+            for(int c = 0; c < 3; ++c) newCache[newCacheCount++] = tri[c];
+            for(int i = 0; i < cacheCount; ++i) {
+                uint32_t v = cache[i];
+                if(v != tri[0] && v != tri[1] && v != tri[2]) newCache[newCacheCount++] = v;
+            }
+
+            // update the scores of everything that was in the cache and of their triangles
+            for(int i = 0; i < newCacheCount; ++i) {
+                uint32_t v = newCache[i];
+                cachePosition[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+                vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+            }
+
+            bestTriangle = -1;
+            bestScore = -1.0f;
+            for(int i = 0; i < newCacheCount; ++i) {
+                uint32_t v = newCache[i];
+                for(uint32_t a = 0; a < remaining[v]; ++a) {
+                    uint32_t t = adjacency[adjacencyOffsets[v] + a];
+                    float score = vertexScore[indices[t*3+0]] + vertexScore[indices[t*3+1]] + vertexScore[indices[t*3+2]];
+                    triangleScore[t] = score;
+                    if(score > bestScore) {
+                        bestScore = score;
+                        bestTriangle = t;
+                    }
+                }
+            }
+
+            cacheCount = std::min(newCacheCount, FORSYTH_CACHE_SIZE);
+            std::copy(newCache, newCache + cacheCount, cache);
+
+            // nothing connected to the cache is left, so continue with the first triangle that is not emitted yet
+            if(bestTriangle < 0) {
+                while(scanCursor < triangleCount && emitted[scanCursor]) ++scanCursor;
+                if(scanCursor < triangleCount) bestTriangle = scanCursor;
+            }
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    void optimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount, int cacheSize) {
+        size_t triangleCount = indexCount / 3;
+        if(triangleCount < 2) return;
+
+        // split into clusters where a triangle misses the cache with all of it's vertices, but not into tiny ones
+        const size_t minClusterSize = 16;
+        std::vector<size_t> clusterStarts;
+        clusterStarts.push_back(0);
+        std::vector<size_t> insertedAt(vertexCount, 0);
+        size_t misses = 0;
+        for(size_t t = 0; t < triangleCount; ++t) {
+            int triangleMisses = 0;
+            for(int c = 0; c < 3; ++c) {
+                uint32_t v = indices[t*3+c];
+                if(insertedAt[v] == 0 || misses - insertedAt[v] >= static_cast<size_t>(cacheSize)) {
+                    ++misses;
+                    insertedAt[v] = misses;
+                    ++triangleMisses;
+                }
+            }
+            if(triangleMisses == 3 && t - clusterStarts.back() >= minClusterSize) clusterStarts.push_back(t);
+        }
+        if(clusterStarts.size() < 2) return;
+        clusterStarts.push_back(triangleCount);
+
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        struct Cluster {
+            size_t start, end;
+            glm::vec3 centroid, normal;
+            float sortKey;
+        };
+        std::vector<Cluster> clusters(clusterStarts.size() - 1);
+        for(size_t c = 0; c < clusters.size(); ++c) {
+            Cluster& cluster = clusters[c];
+            cluster.start = clusterStarts[c];
+            cluster.end = clusterStarts[c + 1];
+            cluster.centroid = cluster.normal = glm::vec3(0.0f);
+            float area = 0.0f;
+            for(size_t t = cluster.start; t < cluster.end; ++t) {
+                const glm::vec3& p0 = positions[indices[t*3+0]];
+                const glm::vec3& p1 = positions[indices[t*3+1]];
+                const glm::vec3& p2 = positions[indices[t*3+2]];
+                // the length of this is twice the area, so the sums below are area weighted
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float triangleArea = glm::length(normal);
+                cluster.normal += normal;
+                cluster.centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+                area += triangleArea;
+            }
+            meshCentroid += cluster.centroid;
+            meshArea += area;
+            if(area > 0.0f) cluster.centroid /= area;
+        }
+        if(meshArea > 0.0f) meshCentroid /= meshArea;
+
+        for(auto& cluster : clusters) {
+            float length = glm::length(cluster.normal);
+            cluster.sortKey = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+        }
+        // the clusters that face away from the center the most are drawn first, because they are the most likely to occlude others
+        std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {return a.sortKey > b.sortKey;});
+
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+        for(auto& cluster : clusters) output.insert(output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+        const uint32_t UNUSED = ~static_cast<uint32_t>(0);
+        std::vector<uint32_t> remap(vertexCount, UNUSED);
+        uint32_t next = 0;
+        for(size_t i = 0; i < indexCount; ++i) {
+            uint32_t& newIndex = remap[indices[i]];
+            if(newIndex == UNUSED) newIndex = next++;
+            indices[i] = newIndex;
+        }
+        for(size_t v = 0; v < vertexCount; ++v) {
+            if(remap[v] == UNUSED) remap[v] = next++;
+        }
+        return remap;
+    }
+
+    VertexCacheStats Mesh::analyzeVertexCache(int cacheSize) const {
+        if(mMode != DrawMode::TRIANGLES) return VertexCacheStats();
+        size_t vertexCount = getVertexCount();
+        std::vector<uint32_t> indices;
+        if(mIndexBuffer) {
+            if(!mIndexBuffer->canRestoreLocal()) return VertexCacheStats();
+            const IndexBuffer& indexBuffer = *mIndexBuffer;
+            indices.resize(indexBuffer.getNumIndices());
+            for(size_t i = 0; i < indices.size(); ++i) indices[i] = indexBuffer[i];
+            indexBuffer.releaseRestored();
+        } else {
+            indices.resize(vertexCount);
+            for(size_t i = 0; i < indices.size(); ++i) indices[i] = i;
+        }
+        return ngn::analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+    }
+
+    bool Mesh::optimize(bool overdraw, bool vertexFetch) {
+        if(mMode != DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::TRIANGLES can be optimized.");
+            return false;
+        }
+        if(!mIndexBuffer || !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("Only meshes with an index buffer (and a local copy of it) can be optimized.");
+            return false;
+        }
+        for(auto& vBuf : mVertexBuffers) {
+            if(!vBuf->canRestoreLocal()) {
+                LOG_ERROR("The mesh needs a local copy of it's vertex data to be optimized.");
+                return false;
+            }
+        }
+
+        size_t vertexCount = getVertexCount();
+        IndexBuffer& indexBuffer = *mIndexBuffer;
+        const IndexBuffer& oldIndices = indexBuffer;
+        std::vector<uint32_t> indices(indexBuffer.getNumIndices());
+        for(size_t i = 0; i < indices.size(); ++i) indices[i] = oldIndices[i];
+
+        optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+
+        if(overdraw) {
+            const VertexAttribute* posAttr = nullptr;
+            VertexBuffer* posBuffer = hasAttribute(AttributeType::POSITION);
+            if(posBuffer) posAttr = posBuffer->getVertexFormat().getAttribute(AttributeType::POSITION);
+            if(posAttr && posAttr->num == 3) {
+                auto position = getAccessor<glm::vec3>(AttributeType::POSITION);
+                std::vector<glm::vec3> positions(vertexCount);
+                for(size_t i = 0; i < vertexCount; ++i) positions[i] = position.get(i);
+                optimizeOverdraw(indices.data(), indices.size(), positions.data(), vertexCount);
+            } else {
+                LOG_WARNING("Overdraw optimization needs positions with 3 components, skipping it.");
+            }
+        }
+
+        if(vertexFetch) {
+            // instanced attributes are not indexed per vertex, so the whole mesh is left alone then
+            bool instanced = false;
+            for(auto& vBuf : mVertexBuffers) {
+                for(auto& attr : vBuf->getVertexFormat().getAttributes()) instanced = instanced || attr.divisor > 0;
+            }
+            if(!instanced) {
+                std::vector<uint32_t> remap = optimizeVertexFetch(indices.data(), indices.size(), vertexCount);
+                for(auto& vBuf : mVertexBuffers) {
+                    size_t stride = vBuf->getVertexFormat().getStride();
+                    uint8_t* data = static_cast<uint8_t*>(vBuf->getData());
+                    std::vector<uint8_t> reordered(vertexCount * stride);
+                    for(size_t v = 0; v < vertexCount; ++v) std::memcpy(reordered.data() + remap[v] * stride, data + v * stride, stride);
+                    std::copy(reordered.begin(), reordered.end(), data);
+                    if(vBuf->getUploadCount() > 0) vBuf->upload();
+                }
+                for(auto& lod : mLods) {
+                    IndexBuffer& lodIndices = *lod.indexBuffer;
+                    const IndexBuffer& oldLodIndices = lodIndices;
+                    for(size_t i = 0; i < lodIndices.getNumIndices(); ++i) lodIndices[i] = remap[oldLodIndices[i]];
+                    if(lodIndices.getUploadCount() > 0) lodIndices.upload();
+                }
+            }
+        }
+
+        for(size_t i = 0; i < indices.size(); ++i) indexBuffer[i] = indices[i];
+        if(indexBuffer.getUploadCount() > 0) indexBuffer.upload();
+
+        // the triangle order changed
+        mBVH.reset();
+        clearClusters();
+        releaseRestoredData();
+        return true;
+    }
+}
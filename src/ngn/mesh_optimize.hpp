@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+namespace ngn {
+    // Simulated with a FIFO post-transform vertex cache
+    struct VertexCacheStats {
+        // average cache miss ratio: transformed vertices per triangle (0.5 is optimal for large regular grids, 3 is worst)
+        float acmr;
+        // average transform to vertex ratio: transformed vertices per referenced vertex (1 is optimal)
+        float atvr;
+
+        VertexCacheStats() : acmr(0.0f), atvr(0.0f) {}
+    };
+
+    VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize = 16);
+
+    // Reorders the triangles for post-transform vertex cache locality, using Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    // https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+    void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // Reorders clusters of triangles (as produced by optimizeVertexCache), so that those that face outwards are drawn first,
+    // which reduces overdraw from most view directions (like Tipsify by Sander et al.). Cluster borders are placed where the
+    // simulated vertex cache restarts anyways, so the cache efficiency is mostly preserved
+    void optimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount, int cacheSize = 16);
+
+    // Returns a table that maps old vertex indices to new ones, so that vertices are in the order they are first used
+    // in the index buffer (for vertex fetch locality) and rewrites the indices accordingly. Unused vertices are moved to the end
+    std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount);
+}
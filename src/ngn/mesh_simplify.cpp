@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "mesh_simplify.hpp"
+#include "mesh_optimize.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    // Symmetric 4x4 matrix (only the upper triangle) and the summed weight of all planes in it,
+    // so that the error can be normalized to a squared distance
+    struct Quadric {
+        double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+        double weight;
+    };
+
+    static inline Quadric planeQuadric(const glm::dvec3& n, double d, double weight) {
+        Quadric q;
+        q.a00 = weight * n.x * n.x; q.a01 = weight * n.x * n.y; q.a02 = weight * n.x * n.z; q.a03 = weight * n.x * d;
+        q.a11 = weight * n.y * n.y; q.a12 = weight * n.y * n.z; q.a13 = weight * n.y * d;
+        q.a22 = weight * n.z * n.z; q.a23 = weight * n.z * d;
+        q.a33 = weight * d * d;
+        q.weight = weight;
+        return q;
+    }
+
+    static inline void addQuadric(Quadric& dst, const Quadric& src) {
+        dst.a00 += src.a00; dst.a01 += src.a01; dst.a02 += src.a02; dst.a03 += src.a03;
+        dst.a11 += src.a11; dst.a12 += src.a12; dst.a13 += src.a13;
+        dst.a22 += src.a22; dst.a23 += src.a23;
+        dst.a33 += src.a33;
+        dst.weight += src.weight;
+    }
+
+    // weighted sum of the squared distances of p to all planes in q
+    static inline double evaluateQuadric(const Quadric& q, const glm::vec3& p) {
+        double x = p.x, y = p.y, z = p.z;
+        return q.a00*x*x + q.a11*y*y + q.a22*z*z + q.a33
+            + 2.0 * (q.a01*x*y + q.a02*x*z + q.a12*y*z + q.a03*x + q.a13*y + q.a23*z);
+    }
+
+    static inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+        if(a > b) std::swap(a, b);
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+    // edges has to be sorted
+    static inline size_t edgeUseCount(const std::vector<uint64_t>& edges, uint32_t a, uint32_t b) {
+        auto range = std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+        return range.second - range.first;
+    }
+
+    static void collectEdges(std::vector<uint64_t>& edges, const uint32_t* indices, size_t indexCount) {
+        edges.resize(indexCount);
+        for(size_t i = 0; i < indexCount; i += 3) {
+            for(int e = 0; e < 3; ++e) edges[i + e] = edgeKey(indices[i + e], indices[i + (e + 1) % 3]);
+        }
+        std::sort(edges.begin(), edges.end());
+    }
+
+    enum class SimplifyVertexKind : uint8_t {
+        // may collapse into any neighbour
+        MANIFOLD,
+        // on an open border, may only collapse along it
+        BORDER,
+        // on a seam or a non-manifold edge
+        LOCKED
+    };
+
+    // edges get this much more weight than faces, so that open borders keep their shape
+    static const double SIMPLIFY_BORDER_WEIGHT = 10.0;
+
+    struct Collapse {
+        uint32_t from, to;
+        // squared distance
+        double error;
+    };
+
+    size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+            size_t targetIndexCount, float targetError, float* resultError) {
+        indexCount = indexCount / 3 * 3;
+        if(destination != indices) std::copy(indices, indices + indexCount, destination);
+        if(resultError) *resultError = 0.0f;
+        if(indexCount <= targetIndexCount) return indexCount;
+
+        std::vector<uint64_t> edges;
+        collectEdges(edges, destination, indexCount);
+
+        std::vector<SimplifyVertexKind> kinds(vertexCount, SimplifyVertexKind::MANIFOLD);
+        // vertices that share their position with others differ in other attributes, moving them would tear the seam open
+        std::vector<uint32_t> sortedVertices(vertexCount);
+        for(size_t i = 0; i < vertexCount; ++i) sortedVertices[i] = i;
+        auto positionLess = [positions](uint32_t a, uint32_t b) {
+            const glm::vec3& pa = positions[a], & pb = positions[b];
+            return pa.x < pb.x || (pa.x == pb.x && (pa.y < pb.y || (pa.y == pb.y && pa.z < pb.z)));
+        };
+        std::sort(sortedVertices.begin(), sortedVertices.end(), positionLess);
+        for(size_t i = 1; i < vertexCount; ++i) {
+            if(positions[sortedVertices[i - 1]] == positions[sortedVertices[i]]) {
+                kinds[sortedVertices[i - 1]] = kinds[sortedVertices[i]] = SimplifyVertexKind::LOCKED;
+            }
+        }
+
+        for(size_t i = 0; i < edges.size(); ) {
+            size_t count = 1;
+            while(i + count < edges.size() && edges[i + count] == edges[i]) ++count;
+            uint32_t a = static_cast<uint32_t>(edges[i] >> 32), b = static_cast<uint32_t>(edges[i]);
+            for(uint32_t v : {a, b}) {
+                if(count > 2)
+                    kinds[v] = SimplifyVertexKind::LOCKED;
+                else if(count == 1 && kinds[v] != SimplifyVertexKind::LOCKED)
+                    kinds[v] = SimplifyVertexKind::BORDER;
+            }
+            i += count;
+        }
+
+        std::vector<Quadric> quadrics(vertexCount, Quadric());
+        for(size_t i = 0; i < indexCount; i += 3) {
+            uint32_t tri[3] = {destination[i], destination[i + 1], destination[i + 2]};
+            glm::dvec3 p0(positions[tri[0]]), p1(positions[tri[1]]), p2(positions[tri[2]]);
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if(length <= 0.0) continue;
+            normal /= length;
+
+            // weighted by area, so that many small triangles don't outweigh a few big ones
+            Quadric q = planeQuadric(normal, -glm::dot(normal, p0), length * 0.5);
+            for(int v = 0; v < 3; ++v) addQuadric(quadrics[tri[v]], q);
+
+            // a plane through the border edge, perpendicular to the triangle
+            for(int e = 0; e < 3; ++e) {
+                uint32_t a = tri[e], b = tri[(e + 1) % 3];
+                if(edgeUseCount(edges, a, b) != 1) continue;
+                glm::dvec3 edge = glm::dvec3(positions[b]) - glm::dvec3(positions[a]);
+                glm::dvec3 edgeNormal = glm::cross(edge, normal);
+                double edgeLength = glm::length(edgeNormal);
+                if(edgeLength <= 0.0) continue;
+                edgeNormal /= edgeLength;
+                Quadric border = planeQuadric(edgeNormal, -glm::dot(edgeNormal, glm::dvec3(positions[a])), glm::dot(edge, edge) * SIMPLIFY_BORDER_WEIGHT);
+                addQuadric(quadrics[a], border);
+                addQuadric(quadrics[b], border);
+            }
+        }
+
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1), adjacencyCursor, adjacency;
+        std::vector<uint32_t> remap(vertexCount);
+        std::vector<uint8_t> touched(vertexCount);
+        std::vector<Collapse> collapses;
+        double errorLimit = static_cast<double>(targetError) * targetError;
+        double maxError = 0.0;
+
+        // Every pass collapses a set of edges that don't influence each other, cheapest first
+        while(indexCount > targetIndexCount) {
+            // vertex -> triangles
+            std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+            for(size_t i = 0; i < indexCount; ++i) ++adjacencyOffsets[destination[i] + 1];
+            for(size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            adjacencyCursor.assign(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            adjacency.resize(indexCount);
+            for(size_t i = 0; i < indexCount; ++i) adjacency[adjacencyCursor[destination[i]]++] = i / 3;
+
+            // border edges change with every collapse along a border
+            collectEdges(edges, destination, indexCount);
+
+            collapses.clear();
+            for(size_t i = 0; i < indexCount; ++i) {
+                uint32_t a = destination[i], b = destination[i - i % 3 + (i + 1) % 3];
+                for(int dir = 0; dir < 2; ++dir) {
+                    uint32_t from = dir == 0 ? a : b, to = dir == 0 ? b : a;
+                    if(kinds[from] == SimplifyVertexKind::LOCKED) continue;
+                    if(kinds[from] == SimplifyVertexKind::BORDER &&
+                        (kinds[to] != SimplifyVertexKind::BORDER || edgeUseCount(edges, from, to) != 1)) continue;
+
+                    Quadric q = quadrics[from];
+                    addQuadric(q, quadrics[to]);
+                    Collapse collapse;
+                    collapse.from = from;
+                    collapse.to = to;
+                    collapse.error = q.weight > 0.0 ? std::max(evaluateQuadric(q, positions[to]), 0.0) / q.weight : 0.0;
+                    if(collapse.error <= errorLimit) collapses.push_back(collapse);
+                }
+            }
+            if(collapses.empty()) break;
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {return a.error < b.error;});
+
+            for(size_t v = 0; v < vertexCount; ++v) remap[v] = v;
+            std::fill(touched.begin(), touched.end(), 0);
+            size_t removeTriangles = (indexCount - targetIndexCount + 2) / 3, removedTriangles = 0;
+            for(auto& collapse : collapses) {
+                if(removedTriangles >= removeTriangles) break;
+                if(touched[collapse.from] || touched[collapse.to]) continue;
+
+                // reject collapses that flip triangles around from or make them degenerate (which could flip later)
+                bool flips = false;
+                size_t removes = 0;
+                for(uint32_t k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1] && !flips; ++k) {
+                    const uint32_t* tri = destination + adjacency[k] * 3;
+                    if(tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+                        ++removes;
+                        continue;
+                    }
+                    glm::vec3 p[3], q[3];
+                    for(int v = 0; v < 3; ++v) {
+                        p[v] = positions[tri[v]];
+                        q[v] = positions[tri[v] == collapse.from ? collapse.to : tri[v]];
+                    }
+                    glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                    flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+                }
+                if(flips) continue;
+
+                remap[collapse.from] = collapse.to;
+                // the neighbourhood changed, so all collapses involving it have to wait for the next pass
+                for(uint32_t k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1]; ++k) {
+                    const uint32_t* tri = destination + adjacency[k] * 3;
+                    touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+                }
+                addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+                maxError = std::max(maxError, collapse.error);
+                removedTriangles += removes;
+            }
+            if(removedTriangles == 0) break;
+
+            // apply the collapses and drop the triangles that became degenerate
+            size_t writeIndex = 0;
+            for(size_t i = 0; i < indexCount; i += 3) {
+                uint32_t a = remap[destination[i]], b = remap[destination[i + 1]], c = remap[destination[i + 2]];
+                if(a == b || b == c || a == c) continue;
+                destination[writeIndex++] = a;
+                destination[writeIndex++] = b;
+                destination[writeIndex++] = c;
+            }
+            indexCount = writeIndex;
+        }
+
+        if(resultError) *resultError = static_cast<float>(std::sqrt(maxError));
+        return indexCount;
+    }
+
+    bool Mesh::generateLods(int lodCount, float reduction, float maxError) {
+        clearLods();
+
+        if(mMode != DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::TRIANGLES can be simplified.");
+            return false;
+        }
+        if(!mIndexBuffer || !mIndexBuffer->canRestoreLocal()) {
+            LOG_ERROR("Only meshes with an index buffer (and a local copy of it) can be simplified.");
+            return false;
+        }
+        VertexBuffer* posBuffer = hasAttribute(AttributeType::POSITION);
+        if(!posBuffer || !posBuffer->canRestoreLocal()) {
+            LOG_ERROR("The mesh needs a local copy of it's positions to be simplified.");
+            return false;
+        }
+
+        size_t vertexCount = getVertexCount();
+        auto position = getAccessor<glm::vec3>(AttributeType::POSITION);
+        std::vector<glm::vec3> positions(vertexCount);
+        for(size_t i = 0; i < vertexCount; ++i) positions[i] = position.get(i);
+
+        const IndexBuffer& indexBuffer = *mIndexBuffer;
+        std::vector<uint32_t> indices(indexBuffer.getNumIndices());
+        for(size_t i = 0; i < indices.size(); ++i) indices[i] = indexBuffer[i];
+
+        float errorLimit = maxError * boundingSphere().second;
+        std::vector<uint32_t> lodIndices(indices.size());
+        size_t lastIndexCount = indices.size();
+        float targetFraction = 1.0f;
+        for(int l = 0; l < lodCount; ++l) {
+            // always simplify the full detail mesh, so the errors are relative to it and not to the previous level
+            targetFraction *= reduction;
+            size_t targetIndexCount = static_cast<size_t>(indices.size() / 3 * targetFraction) * 3;
+            float error = 0.0f;
+            size_t indexCount = simplifyMesh(lodIndices.data(), indices.data(), indices.size(), positions.data(), vertexCount,
+                targetIndexCount, errorLimit, &error);
+            // not worth another draw path
+            if(indexCount == 0 || indexCount > lastIndexCount * 9 / 10) break;
+
+            optimizeVertexCache(lodIndices.data(), indexCount, vertexCount);
+
+            Lod lod;
+            lod.indexBuffer.reset(new IndexBuffer(indexBuffer.getDataType(), indexCount));
+            for(size_t i = 0; i < indexCount; ++i) (*lod.indexBuffer)[i] = lodIndices[i];
+            lod.vao = 0;
+            lod.error = error;
+            mLods.push_back(std::move(lod));
+            lastIndexCount = indexCount;
+        }
+        releaseRestoredData();
+        return true;
+    }
+
+    void Mesh::clearLods() {
+        for(auto& lod : mLods) deleteVAO(lod.vao);
+        mLods.clear();
+    }
+
+    int Mesh::selectLod(float pixelsPerUnit, float maxPixelError) const {
+        for(int l = mLods.size(); l > 0; --l) {
+            if(mLods[l - 1].error * pixelsPerUnit <= maxPixelError) return l;
+        }
+        return 0;
+    }
+}
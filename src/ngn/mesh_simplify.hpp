@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+namespace ngn {
+    // Simplifies a triangle list using quadric error metrics (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics")
+    // Vertices are only collapsed into other existing vertices (half edge collapses), so the result indexes the same vertex data
+    // as the input and can be used as a LOD of it. Vertices on open borders only move along the border and vertices that share
+    // their position with other vertices (seams of texture coordinates or normals) are not moved at all.
+    // Collapses are done until the index count is at most targetIndexCount or no collapse with an error (distance to the
+    // original surface, in the units of positions) of at most targetError is left.
+    // destination needs room for indexCount indices and may be the same as indices. Returns the new index count
+    // and the biggest error of all collapses in resultError.
+    size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount,
+        size_t targetIndexCount, float targetError, float* resultError = nullptr);
+}
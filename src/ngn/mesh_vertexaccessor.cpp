@@ -1,15 +1,142 @@
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NGN_VERTEX_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "mesh_vertexaccessor.hpp"
 
 namespace ngn {
+    // IEEE 754 binary16, rounds to nearest and handles denormals, infinity and NaN
+    uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        if(((bits >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0); // inf/NaN
+        if(exponent >= 0x1f) return sign | 0x7c00; // overflow -> inf
+        if(exponent <= 0) {
+            if(exponent < -10) return sign; // underflow -> 0
+            // denormal, add the implicit 1 and shift it into place
+            mantissa |= 0x800000;
+            uint32_t shift = 14 - exponent;
+            uint16_t half = mantissa >> shift;
+            if((mantissa >> (shift - 1)) & 1) ++half;
+            return sign | half;
+        }
+        uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+        // round to nearest, a carry into the exponent is fine
+        if(mantissa & 0x1000) ++half;
+        return half;
+    }
+
+    float halfToFloat(uint16_t value) {
+        uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1f;
+        uint32_t mantissa = value & 0x3ff;
+        uint32_t bits;
+        if(exponent == 0) {
+            if(mantissa == 0) {
+                bits = sign;
+            } else {
+                // denormal, normalize it
+                exponent = 127 - 15 + 1;
+                while(!(mantissa & 0x400)) {
+                    mantissa <<= 1;
+                    --exponent;
+                }
+                bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        } else if(exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+        float ret;
+        std::memcpy(&ret, &bits, sizeof(ret));
+        return ret;
+    }
+
+    template<typename intType>
+    inline void decodeInts(const uint8_t* data, float* values, int num, bool normalized) {
+        const intType* src = reinterpret_cast<const intType*>(data);
+        for(int i = 0; i < num; ++i) values[i] = decodeInt(src[i], normalized);
+    }
+
+    template<typename intType>
+    inline void encodeInts(const float* values, uint8_t* data, int num, bool normalized) {
+        intType* dst = reinterpret_cast<intType*>(data);
+        for(int i = 0; i < num; ++i) dst[i] = encodeInt<intType>(values[i], normalized);
+    }
+
+    bool decodeVertexAttribute(const VertexAttribute& attr, const uint8_t* data, float* values) {
+        values[0] = values[1] = values[2] = 0.0f;
+        values[3] = 1.0f;
+        int num = std::min(attr.num, 4);
+        switch(attr.dataType) {
+            case AttributeDataType::F32:
+                std::memcpy(values, data, num * sizeof(float));
+                return true;
+            case AttributeDataType::F16: {
+                const uint16_t* src = reinterpret_cast<const uint16_t*>(data);
+                for(int i = 0; i < num; ++i) values[i] = halfToFloat(src[i]);
+                return true;
+            }
+            case AttributeDataType::I8: decodeInts<int8_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::UI8: decodeInts<uint8_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::I16: decodeInts<int16_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::UI16: decodeInts<uint16_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::I32: decodeInts<int32_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::UI32: decodeInts<uint32_t>(data, values, num, attr.normalized); return true;
+            case AttributeDataType::I2_10_10_10:
+            case AttributeDataType::UI2_10_10_10: {
+                uint32_t packed;
+                std::memcpy(&packed, data, sizeof(packed));
+                decodePacked2_10_10_10(packed, attr.dataType == AttributeDataType::I2_10_10_10, attr.normalized, values);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool encodeVertexAttribute(const VertexAttribute& attr, const float* values, uint8_t* data) {
+        int num = std::min(attr.num, 4);
+        switch(attr.dataType) {
+            case AttributeDataType::F32:
+                std::memcpy(data, values, num * sizeof(float));
+                return true;
+            case AttributeDataType::F16: {
+                uint16_t* dst = reinterpret_cast<uint16_t*>(data);
+                for(int i = 0; i < num; ++i) dst[i] = floatToHalf(values[i]);
+                return true;
+            }
+            case AttributeDataType::I8: encodeInts<int8_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::UI8: encodeInts<uint8_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::I16: encodeInts<int16_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::UI16: encodeInts<uint16_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::I32: encodeInts<int32_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::UI32: encodeInts<uint32_t>(values, data, num, attr.normalized); return true;
+            case AttributeDataType::I2_10_10_10:
+            case AttributeDataType::UI2_10_10_10: {
+                uint32_t packed = encodePacked2_10_10_10(values, attr.dataType == AttributeDataType::I2_10_10_10, attr.normalized);
+                std::memcpy(data, &packed, sizeof(packed));
+                return true;
+            }
+        }
+        return false;
+    }
+
     // Template specializations for attribute types
-    // TODO: Think about generating the code for these.
+    // The float types are converted from/to every data type with decode/encodeVertexAttribute (normalized or not).
+    // The number of components has to match, except that vec3 may also be used for packed (2_10_10_10) attributes, ignoring w
     /*
-        Missing:
-
-        I8, I16, I32, UI8, UI16, UI32 * 1, norm -> float
-        I8, I16, I32, UI8, UI16, UI32 * 2, norm -> vec2
-        I8, I16, I32, UI8, UI16, UI32 * 3, norm -> vec3
-        I8, I16, I32, UI8, UI16, UI32 * 4, norm -> vec4
+        Missing (integer types without conversion):
 
         I8, I16, I32, UI8, UI16, UI32 * 1 -> respective types
         I8, I16, I32, UI8, UI16, UI32 * 2 -> vec2<respective type>
@@ -18,94 +145,296 @@ namespace ngn {
 
         I2_10_10_10 -> vec4<uint16_t>
         UI2_10_10_10 -> vec4<uint16_t>
+     */
 
-        I2_10_10_10, norm -> vec4 (2 most significant bits to w/alpha component - last component)
-        UI2_10_10_10, norm -> vec4
+    inline bool componentsMatch(const VertexAttribute& attr, int num) {
+        return attr.num == num || (num == 3 && isPackedAttributeDataType(attr.dataType));
+    }
 
-        F32 * 2 -> vec4 (for 3d positions, even with w)
-        F32 * 3 -> vec4
-     */
+    inline void getFloatAttribute(const VertexAttribute& attr, const uint8_t* data, float* values, int num) {
+        if(componentsMatch(attr, num) && decodeVertexAttribute(attr, data, values)) return;
+        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+    }
+
+    inline void setFloatAttribute(const VertexAttribute& attr, uint8_t* data, const float* val, int num) {
+        float values[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        // packed attributes always have a w component, keep the old one, when only xyz is set
+        if(num < attr.num) decodeVertexAttribute(attr, data, values);
+        for(int i = 0; i < num; ++i) values[i] = val[i];
+        if(componentsMatch(attr, num) && encodeVertexAttribute(attr, values, data)) return;
+        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+    }
+
+    ////////// bulk conversion
+#ifdef NGN_VERTEX_SSE2
+    // Loads/stores 4 integers as 4 32 bit lanes (sign or zero extended)
+    template<typename intType>
+    struct SSEInts {
+        static const bool supported = false;
+        static __m128i load(const uint8_t* data) {return _mm_setzero_si128();}
+        static void store(__m128i values, uint8_t* data) {}
+    };
+
+    template<>
+    struct SSEInts<uint8_t> {
+        static const bool supported = true;
+        static __m128i load(const uint8_t* data) {
+            int32_t bits;
+            std::memcpy(&bits, data, sizeof(bits));
+            __m128i zero = _mm_setzero_si128();
+            return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero);
+        }
+        static void store(__m128i values, uint8_t* data) {
+            int32_t bits = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(values, values), values));
+            std::memcpy(data, &bits, sizeof(bits));
+        }
+    };
+
+    template<>
+    struct SSEInts<int8_t> {
+        static const bool supported = true;
+        static __m128i load(const uint8_t* data) {
+            int32_t bits;
+            std::memcpy(&bits, data, sizeof(bits));
+            // every lane is the byte repeated 4 times, so the arithmetic shift sign extends it
+            __m128i v = _mm_cvtsi32_si128(bits);
+            v = _mm_unpacklo_epi8(v, v);
+            return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 24);
+        }
+        static void store(__m128i values, uint8_t* data) {
+            int32_t bits = _mm_cvtsi128_si32(_mm_packs_epi16(_mm_packs_epi32(values, values), values));
+            std::memcpy(data, &bits, sizeof(bits));
+        }
+    };
+
+    template<>
+    struct SSEInts<uint16_t> {
+        static const bool supported = true;
+        static __m128i load(const uint8_t* data) {
+            __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+            return _mm_unpacklo_epi16(v, _mm_setzero_si128());
+        }
+        static void store(__m128i values, uint8_t* data) {
+            // there is no unsigned saturating pack for 32 bit in SSE2, so shift it to the signed range and back
+            __m128i bias = _mm_set1_epi32(0x8000);
+            __m128i v = _mm_packs_epi32(_mm_sub_epi32(values, bias), values);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(data), _mm_xor_si128(v, _mm_set1_epi16(static_cast<short>(0x8000))));
+        }
+    };
+
+    template<>
+    struct SSEInts<int16_t> {
+        static const bool supported = true;
+        static __m128i load(const uint8_t* data) {
+            __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+            return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        }
+        static void store(__m128i values, uint8_t* data) {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(data), _mm_packs_epi32(values, values));
+        }
+    };
+#endif
+
+    // Like decodeInt/encodeInt, but with the branches out of the loop (it still divides, so the results are exactly the same as get's)
+    template<typename intType>
+    static void decodeIntsStrided(const uint8_t* data, int stride, size_t count, float* values, int num, bool normalized) {
+        float divisor = normalized ? static_cast<float>(std::numeric_limits<intType>::max()) : 1.0f;
+        float minValue = normalized ? -1.0f : -std::numeric_limits<float>::max();
+#ifdef NGN_VERTEX_SSE2
+        if(SSEInts<intType>::supported && num == 4) {
+            __m128 divisor4 = _mm_set1_ps(divisor), min4 = _mm_set1_ps(minValue);
+            for(size_t i = 0; i < count; ++i) {
+                __m128 v = _mm_div_ps(_mm_cvtepi32_ps(SSEInts<intType>::load(data + i * stride)), divisor4);
+                _mm_storeu_ps(values + i * 4, _mm_max_ps(v, min4));
+            }
+            return;
+        }
+#endif
+        for(size_t i = 0; i < count; ++i) {
+            const intType* src = reinterpret_cast<const intType*>(data + i * stride);
+            for(int c = 0; c < num; ++c) values[i * num + c] = std::max(static_cast<float>(src[c]) / divisor, minValue);
+        }
+    }
+
+    template<typename intType>
+    static void encodeIntsStrided(const float* values, int num, size_t count, uint8_t* data, int stride, bool normalized) {
+#ifdef NGN_VERTEX_SSE2
+        if(SSEInts<intType>::supported && num == 4) {
+            float maxValue = static_cast<float>(std::numeric_limits<intType>::max());
+            __m128 scale4 = _mm_set1_ps(normalized ? maxValue : 1.0f);
+            __m128 min4 = _mm_set1_ps(static_cast<float>(std::numeric_limits<intType>::min())), max4 = _mm_set1_ps(maxValue);
+            __m128 signMask = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+            for(size_t i = 0; i < count; ++i) {
+                __m128 v = _mm_mul_ps(_mm_loadu_ps(values + i * 4), scale4);
+                v = _mm_min_ps(_mm_max_ps(v, min4), max4);
+                // round half away from zero exactly like std::round. Adding +-0.5 before truncating would round e.g. 0.49999997 up,
+                // so truncate first and step away from zero if the (exact) fractional part is at least 0.5
+                __m128i t = _mm_cvttps_epi32(v);
+                __m128 fraction = _mm_andnot_ps(signMask, _mm_sub_ps(v, _mm_cvtepi32_ps(t)));
+                __m128 step = _mm_and_ps(_mm_cmpge_ps(fraction, half), _mm_or_ps(one, _mm_and_ps(v, signMask)));
+                SSEInts<intType>::store(_mm_add_epi32(t, _mm_cvttps_epi32(step)), data + i * stride);
+            }
+            return;
+        }
+#endif
+        for(size_t i = 0; i < count; ++i) encodeInts<intType>(values + i * num, data + i * stride, num, normalized);
+    }
+
+    bool decodeVertexAttributes(const VertexAttribute& attr, const uint8_t* data, int stride, size_t count, float* values, int num) {
+        if(!componentsMatch(attr, num)) return false;
+        switch(attr.dataType) {
+            case AttributeDataType::F32:
+                if(stride == static_cast<int>(num * sizeof(float))) {
+                    std::memcpy(values, data, count * num * sizeof(float));
+                } else {
+                    for(size_t i = 0; i < count; ++i) std::memcpy(values + i * num, data + i * stride, num * sizeof(float));
+                }
+                return true;
+            case AttributeDataType::I8: decodeIntsStrided<int8_t>(data, stride, count, values, num, attr.normalized); return true;
+            case AttributeDataType::UI8: decodeIntsStrided<uint8_t>(data, stride, count, values, num, attr.normalized); return true;
+            case AttributeDataType::I16: decodeIntsStrided<int16_t>(data, stride, count, values, num, attr.normalized); return true;
+            case AttributeDataType::UI16: decodeIntsStrided<uint16_t>(data, stride, count, values, num, attr.normalized); return true;
+            case AttributeDataType::I32: decodeIntsStrided<int32_t>(data, stride, count, values, num, attr.normalized); return true;
+            case AttributeDataType::UI32: decodeIntsStrided<uint32_t>(data, stride, count, values, num, attr.normalized); return true;
+            default: {
+                // half floats and packed attributes
+                float value[4];
+                for(size_t i = 0; i < count; ++i) {
+                    if(!decodeVertexAttribute(attr, data + i * stride, value)) return false;
+                    std::copy(value, value + num, values + i * num);
+                }
+                return true;
+            }
+        }
+    }
+
+    bool encodeVertexAttributes(const VertexAttribute& attr, const float* values, int num, size_t count, uint8_t* data, int stride) {
+        if(!componentsMatch(attr, num)) return false;
+        switch(attr.dataType) {
+            case AttributeDataType::F32:
+                if(stride == static_cast<int>(num * sizeof(float))) {
+                    std::memcpy(data, values, count * num * sizeof(float));
+                } else {
+                    for(size_t i = 0; i < count; ++i) std::memcpy(data + i * stride, values + i * num, num * sizeof(float));
+                }
+                return true;
+            case AttributeDataType::I8: encodeIntsStrided<int8_t>(values, num, count, data, stride, attr.normalized); return true;
+            case AttributeDataType::UI8: encodeIntsStrided<uint8_t>(values, num, count, data, stride, attr.normalized); return true;
+            case AttributeDataType::I16: encodeIntsStrided<int16_t>(values, num, count, data, stride, attr.normalized); return true;
+            case AttributeDataType::UI16: encodeIntsStrided<uint16_t>(values, num, count, data, stride, attr.normalized); return true;
+            case AttributeDataType::I32: encodeIntsStrided<int32_t>(values, num, count, data, stride, attr.normalized); return true;
+            case AttributeDataType::UI32: encodeIntsStrided<uint32_t>(values, num, count, data, stride, attr.normalized); return true;
+            default: {
+                float value[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+                for(size_t i = 0; i < count; ++i) {
+                    // keeps w of packed attributes, like setFloatAttribute
+                    if(num < attr.num) decodeVertexAttribute(attr, data + i * stride, value);
+                    std::copy(values + i * num, values + i * num + num, value);
+                    if(!encodeVertexAttribute(attr, value, data + i * stride)) return false;
+                }
+                return true;
+            }
+        }
+    }
 
-    template<typename dataType, typename vecType>
-    void copyElements(dataType* data, const vecType& from, int num) {
-        for(int i = 0; i < num; ++i) data[i] = from[i];
+    bool transformVertexAttributes(const VertexAttribute& attr, uint8_t* data, int stride, size_t count, const glm::mat4& matrix, bool point) {
+        if(attr.num < 3) return false;
+        if(attr.dataType == AttributeDataType::F32) {
+#ifdef NGN_VERTEX_SSE2
+            __m128 c0 = _mm_loadu_ps(&matrix[0][0]), c1 = _mm_loadu_ps(&matrix[1][0]), c2 = _mm_loadu_ps(&matrix[2][0]);
+            __m128 c3 = point ? _mm_loadu_ps(&matrix[3][0]) : _mm_setzero_ps();
+            for(size_t i = 0; i < count; ++i) {
+                float v[4];
+                std::memcpy(v, data + i * stride, 3 * sizeof(float));
+                __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v[0])), _mm_mul_ps(c1, _mm_set1_ps(v[1]))),
+                                      _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(v[2])), c3));
+                _mm_storeu_ps(v, r);
+                std::memcpy(data + i * stride, v, 3 * sizeof(float));
+            }
+#else
+            glm::mat3 linear(matrix);
+            glm::vec3 translation = point ? glm::vec3(matrix[3]) : glm::vec3(0.0f);
+            for(size_t i = 0; i < count; ++i) {
+                glm::vec3 v;
+                std::memcpy(&v[0], data + i * stride, 3 * sizeof(float));
+                v = linear * v + translation;
+                std::memcpy(data + i * stride, &v[0], 3 * sizeof(float));
+            }
+#endif
+            return true;
+        }
+
+        // everything else is converted to floats and back in chunks
+        const size_t chunkSize = 256;
+        int num = std::min(attr.num, 4);
+        float values[chunkSize * 4];
+        float w = point ? 1.0f : 0.0f;
+        for(size_t first = 0; first < count; first += chunkSize) {
+            size_t chunk = std::min(chunkSize, count - first);
+            uint8_t* chunkData = data + first * stride;
+            if(!decodeVertexAttributes(attr, chunkData, stride, chunk, values, num)) return false;
+            for(size_t i = 0; i < chunk; ++i) {
+                float* v = values + i * num;
+                glm::vec3 t = glm::vec3(matrix * glm::vec4(v[0], v[1], v[2], w));
+                v[0] = t.x;
+                v[1] = t.y;
+                v[2] = t.z;
+            }
+            if(!encodeVertexAttributes(attr, values, num, chunk, chunkData, stride)) return false;
+        }
+        return true;
     }
 
     ////////// float
     template<>
     float VertexAttributeAccessor<float>::getWrapped(int index) const {
-        // F32 * 1
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 1) return *(getPointer<float>(index));
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
-		return 0.0f;
+        float values[4];
+        getFloatAttribute(*mAttribute, getPointer<uint8_t>(index), values, 1);
+        return values[0];
     }
 
     template<>
     void VertexAttributeAccessor<float>::setWrapped(int index, const float& val) {
-        // F32 * 1
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 1) {
-            *(getPointer<float>(index)) = val;
-            return;
-        }
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        setFloatAttribute(*mAttribute, getPointer<uint8_t>(index), &val, 1);
     }
 
     ////////// glm::vec2
     template<>
     glm::vec2 VertexAttributeAccessor<glm::vec2>::getWrapped(int index) const {
-        // F32 * 2
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 2) return glm::make_vec2(getPointer<float>(index));
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
-		return glm::vec2();
+        float values[4];
+        getFloatAttribute(*mAttribute, getPointer<uint8_t>(index), values, 2);
+        return glm::make_vec2(values);
     }
 
     template<>
     void VertexAttributeAccessor<glm::vec2>::setWrapped(int index, const glm::vec2& val) {
-        // F32 * 2
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 2) {
-            copyElements(getPointer<float>(index), val, 2);
-            return;
-        }
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        setFloatAttribute(*mAttribute, getPointer<uint8_t>(index), glm::value_ptr(val), 2);
     }
 
     ////////// glm::vec3
     template<>
     glm::vec3 VertexAttributeAccessor<glm::vec3>::getWrapped(int index) const {
-        // F32 * 3
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 3) return glm::make_vec3(getPointer<float>(index));
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
-		return glm::vec3();
+        float values[4];
+        getFloatAttribute(*mAttribute, getPointer<uint8_t>(index), values, 3);
+        return glm::make_vec3(values);
     }
 
     template<>
     void VertexAttributeAccessor<glm::vec3>::setWrapped(int index, const glm::vec3& val) {
-        // F32 * 3
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 3) {
-            copyElements(getPointer<float>(index), val, 3);
-            return;
-        }
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        setFloatAttribute(*mAttribute, getPointer<uint8_t>(index), glm::value_ptr(val), 3);
     }
 
-
     ////////// glm::vec4
     template<>
     glm::vec4 VertexAttributeAccessor<glm::vec4>::getWrapped(int index) const {
-        // F32 * 4
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 4) return glm::make_vec4(getPointer<float>(index));
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
-		return glm::vec4();
+        float values[4];
+        getFloatAttribute(*mAttribute, getPointer<uint8_t>(index), values, 4);
+        return glm::make_vec4(values);
     }
 
     template<>
     void VertexAttributeAccessor<glm::vec4>::setWrapped(int index, const glm::vec4& val) {
-        // F32 * 4
-        if(mAttribute->dataType == AttributeDataType::F32 && mAttribute->num == 4) {
-            copyElements(getPointer<float>(index), val, 4);
-            return;
-        }
-        assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        setFloatAttribute(*mAttribute, getPointer<uint8_t>(index), glm::value_ptr(val), 4);
     }
 
     ////////// int16_t
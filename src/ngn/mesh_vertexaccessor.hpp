@@ -2,6 +2,13 @@
 
 #define GLM_META_PROG_HELPERS // number of components etc. as static members
 
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -25,6 +32,75 @@ template<typename elementType> struct GLMVecType<typename elementType, 4> {
 };*/
 
 namespace ngn {
+    class GLBuffer;
+    // Calls buffer->markDirty, so accessors can be used without including mesh_vertexdata.hpp
+    void markBufferDirty(GLBuffer* buffer, size_t offset, size_t size);
+
+    // IEEE 754 half precision
+    uint16_t floatToHalf(float value);
+    float halfToFloat(uint16_t value);
+
+    // Single integer components, normalized ones are mapped like described below
+    template<typename intType>
+    inline float decodeInt(intType value, bool normalized) {
+        if(!normalized) return static_cast<float>(value);
+        // OpenGL 4.2+ convention for signed values, so that 0 is exactly representable
+        float maxValue = static_cast<float>(std::numeric_limits<intType>::max());
+        return std::max(static_cast<float>(value) / maxValue, -1.0f);
+    }
+
+    template<typename intType>
+    inline intType encodeInt(float value, bool normalized) {
+        float minValue = static_cast<float>(std::numeric_limits<intType>::min());
+        float maxValue = static_cast<float>(std::numeric_limits<intType>::max());
+        if(normalized) value *= maxValue;
+        return static_cast<intType>(std::round(std::min(std::max(value, minValue), maxValue)));
+    }
+
+    // The (U)I2_10_10_10 types, x is in the lowest bits, w is the 2 bit component
+    inline void decodePacked2_10_10_10(uint32_t packed, bool isSigned, bool normalized, float* values) {
+        for(int i = 0; i < 4; ++i) {
+            int bits = i < 3 ? 10 : 2;
+            uint32_t value = (packed >> (i * 10)) & ((1u << bits) - 1);
+            if(isSigned) {
+                // sign extend
+                int32_t signedValue = value & (1u << (bits - 1)) ? static_cast<int32_t>(value) - (1 << bits) : static_cast<int32_t>(value);
+                float maxValue = static_cast<float>((1 << (bits - 1)) - 1);
+                values[i] = normalized ? std::max(signedValue / maxValue, -1.0f) : static_cast<float>(signedValue);
+            } else {
+                values[i] = normalized ? value / static_cast<float>((1 << bits) - 1) : static_cast<float>(value);
+            }
+        }
+    }
+
+    inline uint32_t encodePacked2_10_10_10(const float* values, bool isSigned, bool normalized) {
+        uint32_t packed = 0;
+        for(int i = 0; i < 4; ++i) {
+            int bits = i < 3 ? 10 : 2;
+            float minValue = isSigned ? -static_cast<float>(1 << (bits - 1)) : 0.0f;
+            float maxValue = isSigned ? static_cast<float>((1 << (bits - 1)) - 1) : static_cast<float>((1 << bits) - 1);
+            float value = normalized ? values[i] * maxValue : values[i];
+            int32_t intValue = static_cast<int32_t>(std::round(std::min(std::max(value, minValue), maxValue)));
+            packed |= (static_cast<uint32_t>(intValue) & ((1u << bits) - 1)) << (i * 10);
+        }
+        return packed;
+    }
+
+    // Convert a single attribute value between it's storage format and 4 floats. Missing components are 0 (w is 1).
+    // Normalized integers are mapped to [0, 1] (unsigned) and [-1, 1] (signed) just like OpenGL does it.
+    // Return false if the data type is not supported
+    bool decodeVertexAttribute(const VertexAttribute& attr, const uint8_t* data, float* values);
+    bool encodeVertexAttribute(const VertexAttribute& attr, const float* values, uint8_t* data);
+
+    // Bulk versions of the above for count values that are stride bytes apart, from/to num tightly packed floats per value.
+    // The number of components has to match like for the accessors (num = 3 for packed attributes writes xyz and keeps w).
+    // The data type is only checked once per call and F32 and 4 component 8/16 bit integers have SSE2 paths,
+    // so use these (or the accessor methods copyTo/copyFrom/transform) for big meshes. Return false if the types don't match
+    bool decodeVertexAttributes(const VertexAttribute& attr, const uint8_t* data, int stride, size_t count, float* values, int num);
+    bool encodeVertexAttributes(const VertexAttribute& attr, const float* values, int num, size_t count, uint8_t* data, int stride);
+    // Transforms the xyz components in place with w = 1 for points and w = 0 for vectors
+    bool transformVertexAttributes(const VertexAttribute& attr, uint8_t* data, int stride, size_t count, const glm::mat4& matrix, bool point);
+
     template<typename T>
     class VertexAttributeAssigner;
 
@@ -36,18 +112,21 @@ namespace ngn {
         const int mAttributeOffset;
         const size_t mCount;
         void* mData;
+        // set writes are marked as dirty in this buffer (if it's not nullptr)
+        GLBuffer* mBuffer;
 
     public:
         // This represents an invalid state
-        VertexAttributeAccessor() : mAttribute(nullptr), mStride(0), mAttributeOffset(0), mCount(0), mData(nullptr) {}
+        VertexAttributeAccessor() : mAttribute(nullptr), mStride(0), mAttributeOffset(0), mCount(0), mData(nullptr), mBuffer(nullptr) {}
 
-        VertexAttributeAccessor(const VertexAttribute& attr, int stride, int offset, size_t num, void* data) :
-                mAttribute(&attr), mStride(stride), mAttributeOffset(offset), mCount(num), mData(data) {}
+        VertexAttributeAccessor(const VertexAttribute& attr, int stride, int offset, size_t num, void* data, GLBuffer* buffer = nullptr) :
+                mAttribute(&attr), mStride(stride), mAttributeOffset(offset), mCount(num), mData(data), mBuffer(buffer) {}
 
         bool isValid() const {return mData != nullptr;}
         size_t getCount() const {return mCount;}
 
         // every attribute is aligned to 4 bytes
+        // Writes through the non-const getPointer are not tracked, use markDirty for those
         template<typename pT>
         const pT* getPointer(int index) const {
             return reinterpret_cast<pT*>(reinterpret_cast<uint8_t*>(mData) + mStride * index + mAttributeOffset);
@@ -81,6 +160,7 @@ namespace ngn {
 
         void set(int index, const T& val) {
             if(mData == nullptr) return;
+            markDirty(index, 1);
             return setWrapped(index, val);
         }
 
@@ -88,6 +168,36 @@ namespace ngn {
             return get(index);
         }
 
+        // ---- bulk access
+        // Copies count elements (0 means all after first) starting at first to/from a tightly packed array, with the same conversions as get/set
+        void copyTo(T* dst, size_t first = 0, size_t count = 0) const {
+            if(mData == nullptr) return;
+            if(count == 0) count = mCount - first;
+            if(!decodeVertexAttributes(*mAttribute, getPointer<uint8_t>(first), mStride, count, reinterpret_cast<float*>(dst), sizeof(T) / sizeof(float)))
+                assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        }
+
+        void copyFrom(const T* src, size_t first = 0, size_t count = 0) {
+            if(mData == nullptr) return;
+            if(count == 0) count = mCount - first;
+            markDirty(first, count);
+            if(!encodeVertexAttributes(*mAttribute, reinterpret_cast<const float*>(src), sizeof(T) / sizeof(float), count, getPointer<uint8_t>(first), mStride))
+                assert(false && "You seem to be using the wrong data type with this vertex attribute");
+        }
+
+        // Transforms all elements in place as points (w = 1) or vectors (w = 0). Only for attributes with at least 3 components
+        void transform(const glm::mat4& matrix, bool point = true) {
+            if(mData == nullptr || mCount == 0) return;
+            markDirty(0, mCount);
+            if(!transformVertexAttributes(*mAttribute, getPointer<uint8_t>(0), mStride, mCount, matrix, point))
+                assert(false && "Only attributes with at least 3 components can be transformed");
+        }
+
+        // Marks the elements in the buffer the accessor belongs to, for writes through getPointer
+        void markDirty(size_t first, size_t count) {
+            if(mBuffer && count > 0) markBufferDirty(mBuffer, mStride * first + mAttributeOffset, mStride * (count - 1) + mAttribute->getSize());
+        }
+
         VertexAttributeAssigner<T> operator[](const int index);
     };
 
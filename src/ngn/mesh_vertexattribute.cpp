@@ -29,6 +29,7 @@ namespace ngn {
                 break;
             case AttributeDataType::I16:
             case AttributeDataType::UI16:
+            case AttributeDataType::F16:
                 return 2;
                 break;
             default:
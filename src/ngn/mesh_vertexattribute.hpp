@@ -12,7 +12,7 @@ namespace ngn {
         UI16 = GL_UNSIGNED_SHORT,
         I32 = GL_INT,
         UI32 = GL_UNSIGNED_INT,
-        //F16 = GL_HALF_FLOAT,
+        F16 = GL_HALF_FLOAT,
         F32 = GL_FLOAT,
         //F64 = GL_DOUBLE,
         I2_10_10_10 = GL_INT_2_10_10_10_REV,
@@ -20,6 +20,10 @@ namespace ngn {
     };
 
     int getAttributeDataTypeSize(AttributeDataType type);
+    // The 2_10_10_10 types pack all four components into a single 32 bit value, so their num has to be 4
+    constexpr bool isPackedAttributeDataType(AttributeDataType type) {
+        return type == AttributeDataType::I2_10_10_10 || type == AttributeDataType::UI2_10_10_10;
+    }
 
     enum class AttributeType : int {
         POSITION = 0,
@@ -57,6 +61,7 @@ namespace ngn {
                     break;
                 case AttributeDataType::I16:
                 case AttributeDataType::UI16:
+                case AttributeDataType::F16:
                     overlap = (num * 2) % 4;
                     if(overlap > 0) alignedNum = num + (4 - overlap) / 2;
                     break;
@@ -65,5 +70,11 @@ namespace ngn {
                     break;
             }
         }
+
+        // in bytes, the packed types hold all components in 4 bytes
+        int getSize() const {
+            if(isPackedAttributeDataType(dataType)) return 4;
+            return getAttributeDataTypeSize(dataType) * alignedNum;
+        }
     };
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
+#include <cstring>
+
 #include "mesh_vertexdata.hpp"
+#include "misc.hpp"
+#include "compression.hpp"
 
 namespace ngn {
     bool VertexFormat::hasAttribute(AttributeType attrType) const {
@@ -8,28 +12,285 @@ namespace ngn {
         return false;
     }
 
+    const VertexAttribute* VertexFormat::getAttribute(AttributeType attrType) const {
+        for(auto& attr : mAttributes)
+            if(attr.type == attrType)
+                return &attr;
+        return nullptr;
+    }
+
+    bool VertexFormat::operator==(const VertexFormat& other) const {
+        if(mAttributes.size() != other.mAttributes.size()) return false;
+        for(size_t i = 0; i < mAttributes.size(); ++i) {
+            const VertexAttribute& a = mAttributes[i];
+            const VertexAttribute& b = other.mAttributes[i];
+            if(a.type != b.type || a.num != b.num || a.dataType != b.dataType || a.normalized != b.normalized || a.divisor != b.divisor)
+                return false;
+        }
+        return true;
+    }
+
+    std::unordered_map<uint64_t, GLBuffer::SharedBuffer> GLBuffer::sharedBuffers;
+    bool GLBuffer::deduplicate = true;
+    ResidencyPolicy GLBuffer::defaultResidencyPolicy = ResidencyPolicy::KEEP;
+
+    GLBuffer::~GLBuffer() {
+        if(mShared) detachShared();
+        if(mVBO != 0) glDeleteBuffers(1, &mVBO);
+    }
+
+    void markBufferDirty(GLBuffer* buffer, size_t offset, size_t size) {
+        buffer->markDirty(offset, size);
+    }
+
+    void GLBuffer::markDirty(size_t offset, size_t size) {
+        if(size == 0) return;
+        int begin = offset, end = offset + size;
+        if(!mDirtyRanges.empty()) {
+            // writes in a loop (e.g. through an accessor) usually just grow the last range
+            std::pair<int, int>& last = mDirtyRanges.back();
+            if(begin <= last.second + DIRTY_RANGE_MERGE_GAP && end >= last.first - DIRTY_RANGE_MERGE_GAP) {
+                last.first = std::min(last.first, begin);
+                last.second = std::max(last.second, end);
+                return;
+            }
+
+            if(mDirtyRanges.size() >= MAX_DIRTY_RANGES) {
+                for(auto& range : mDirtyRanges) {
+                    begin = std::min(begin, range.first);
+                    end = std::max(end, range.second);
+                }
+                mDirtyRanges.clear();
+            }
+        }
+        mDirtyRanges.push_back(std::make_pair(begin, end));
+    }
+
     void GLBuffer::upload() {
+        if(!mData) {
+            // the local copy was freed after the last upload, so there can't be anything new
+            if(mUploadCount > 0) return;
+            restoreLocal();
+        }
+        // partial uploads would change the content for every buffer sharing the buffer object
+        if(mUploadCount == 0 || mLastUploadedSize != mSize || !mData || mUsage == UsageHint::STREAM || mShared) {
+            uploadData(mData.get());
+            return;
+        }
+        if(mDirtyRanges.empty()) return;
+
+        std::sort(mDirtyRanges.begin(), mDirtyRanges.end());
+        std::vector<std::pair<int, int> > ranges;
+        int dirtySize = 0;
+        for(auto& range : mDirtyRanges) {
+            if(!ranges.empty() && range.first <= ranges.back().second + DIRTY_RANGE_MERGE_GAP) {
+                dirtySize += std::max(range.second, ranges.back().second) - ranges.back().second;
+                ranges.back().second = std::max(ranges.back().second, range.second);
+            } else {
+                dirtySize += range.second - range.first;
+                ranges.push_back(range);
+            }
+        }
+
+        // uploading the whole buffer into fresh storage is cheaper than waiting for the GPU
+        if(mUsage == UsageHint::DYNAMIC && dirtySize * 2 >= mSize) {
+            uploadData(mData.get());
+            return;
+        }
+
         mUploadCount++;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mVBO);
+        for(auto& range : ranges) {
+            int end = std::min(range.second, mSize);
+            if(end > range.first) glBufferSubData(GL_COPY_WRITE_BUFFER, range.first, end - range.first, mData.get() + range.first);
+        }
+        mDirtyRanges.clear();
+        applyResidencyPolicy(nullptr);
+    }
+
+    void GLBuffer::applyResidencyPolicy(const void* uploadedData) const {
+        if(mUsage != UsageHint::STATIC || mResidencyPolicy == ResidencyPolicy::KEEP) return;
+        // the first upload takes everything from the local copy anyways, after that the changes have to be uploaded from it
+        if(mUploadCount > 0 && isDirty()) return;
+        const void* data = mData ? mData.get() : uploadedData;
+        if(!data || !mCompressedData.empty()) return;
+        // without a buffer object of it's own (e.g. a mesh in a geometry arena) there is nothing to read back from
+        if(mResidencyPolicy == ResidencyPolicy::COMPRESS_AFTER_UPLOAD || mVBO == 0 || mUploadCount == 0) {
+            mCompressedData = compressElements(data, mSize, getElementSize());
+        }
+        mData.reset();
+        mRestored = false;
+    }
+
+    bool GLBuffer::restoreLocal() const {
+        if(mData) return true;
+        if(!mCompressedData.empty()) {
+            std::unique_ptr<VBODataType[]> data(new VBODataType[mSize]);
+            if(!decompressElements(mCompressedData.data(), mCompressedData.size(), data.get(), mSize, getElementSize())) {
+                LOG_ERROR("The compressed local copy of a buffer is corrupt.");
+                return false;
+            }
+            mData = std::move(data);
+            std::vector<uint8_t>().swap(mCompressedData);
+            mRestored = true;
+            return true;
+        }
+        if(mVBO != 0 && mUploadCount > 0) {
+            std::unique_ptr<VBODataType[]> data(new VBODataType[mSize]);
+            glBindBuffer(GL_COPY_READ_BUFFER, mVBO);
+            if(mSize > 0) glGetBufferSubData(GL_COPY_READ_BUFFER, 0, mSize, data.get());
+            mData = std::move(data);
+            mRestored = true;
+            return true;
+        }
+        return false;
+    }
+
+    void GLBuffer::detachShared() {
+        auto it = sharedBuffers.find(mContentHash);
+        if(it->second.referenceCount > 1) {
+            --it->second.referenceCount;
+            mVBO = 0;
+            mLastUploadedSize = 0;
+        } else {
+            sharedBuffers.erase(it);
+        }
+        mShared = false;
+    }
+
+    bool GLBuffer::sharedContentEquals(GLuint vbo, const void* data) const {
+        // only happens when a buffer is shared, i.e. mostly while loading, so the synchronous read back is fine
+        std::unique_ptr<VBODataType[]> content(new VBODataType[mSize]);
+        glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, mSize, content.get());
+        return std::memcmp(content.get(), data, mSize) == 0;
+    }
+
+    void GLBuffer::uploadData(const void* data) {
+        mUploadCount++;
+        bool share = deduplicate && mUsage == UsageHint::STATIC && data && mSize > 0;
+        uint64_t hash = 0;
+        if(share) hash = hashBytes(&mSize, sizeof(mSize), hashBytes(data, mSize));
+        if(mShared) {
+            if(share && hash == mContentHash && sharedContentEquals(mVBO, data)) {
+                mDirtyRanges.clear();
+                applyResidencyPolicy(data);
+                return;
+            }
+            // copy on write: the others keep the shared buffer object and this one gets a new one
+            detachShared();
+            if(mVBO == 0) ++mBufferObjectGeneration;
+        }
+        // only on the first upload, because the VAOs already point to the buffer object otherwise
+        if(share && mVBO == 0) {
+            auto it = sharedBuffers.find(hash);
+            // with a hash collision this one just gets a buffer object of it's own
+            if(it != sharedBuffers.end() && sharedContentEquals(it->second.vbo, data)) {
+                ++it->second.referenceCount;
+                mVBO = it->second.vbo;
+                mShared = true;
+                mContentHash = hash;
+                mLastUploadedSize = mSize;
+                mDirtyRanges.clear();
+                applyResidencyPolicy(data);
+                return;
+            }
+        }
+
         if(mVBO == 0) {
             glGenBuffers(1, &mVBO);
         }
-        glBindBuffer(mTarget, mVBO);
-        if(mLastUploadedSize != mSize) {
-            glBufferData(mTarget, mSize, mData.get(), static_cast<GLenum>(mUsage));
+        // GL_COPY_WRITE_BUFFER is not part of the VAO state, so binding an index buffer here does not change the one
+        // of the currently bound VAO and there is no need to unbind it afterwards
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mVBO);
+        if(mLastUploadedSize != mSize || mUsage != UsageHint::STATIC || !data) {
+            // for the same size this orphans the old storage: the driver can hand out new memory while the GPU still reads from the old one
+            glBufferData(GL_COPY_WRITE_BUFFER, mSize, data, static_cast<GLenum>(mUsage));
             mLastUploadedSize = mSize;
         } else {
-            glBufferSubData(mTarget, 0, mSize, mData.get());
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, mSize, data);
+        }
+        mDirtyRanges.clear();
+
+        if(share && sharedBuffers.find(hash) == sharedBuffers.end()) {
+            sharedBuffers.insert(std::make_pair(hash, SharedBuffer{mVBO, 1}));
+            mShared = true;
+            mContentHash = hash;
         }
-        glBindBuffer(mTarget, 0);
+        applyResidencyPolicy(data);
     }
 
     void VertexBuffer::reallocate(size_t numVertices, bool copyOld) {
         size_t newSize = mVertexFormat.getStride()*numVertices;
         std::unique_ptr<VBODataType[]> newData(new VBODataType[newSize]);
+        if(copyOld) restoreLocal();
+        std::vector<uint8_t>().swap(mCompressedData);
         if(mData.get() != nullptr && copyOld) std::copy(mData.get(), mData.get() + mSize, newData.get());
         mData.reset(newData.release());
         mNumVertices = numVertices;
         mSize = newSize;
+        markDirty();
+    }
+
+    void VertexBuffer::uploadFrom(const void* data, size_t numVertices) {
+        mData.reset();
+        std::vector<uint8_t>().swap(mCompressedData);
+        mNumVertices = numVertices;
+        mSize = mVertexFormat.getStride()*numVertices;
+        uploadData(data);
+    }
+
+    bool VertexBuffer::fillFromOtherBuffer(const VertexBuffer& other, size_t vertexOffset) {
+        if(vertexOffset + other.mNumVertices > mNumVertices) {
+            LOG_ERROR("The vertex buffer is too small to be filled from the other buffer.");
+            return false;
+        }
+        if(other.mNumVertices == 0) return true;
+        if(!canRestoreLocal() || !other.canRestoreLocal()) {
+            LOG_ERROR("Both vertex buffers need a local copy of their data to fill one from the other.");
+            return false;
+        }
+        restoreLocal();
+        other.restoreLocal();
+
+        // if the formats are the same, the whole block can be copied at once
+        markDirty(vertexOffset * mVertexFormat.getStride(), other.mNumVertices * mVertexFormat.getStride());
+        if(mVertexFormat == other.mVertexFormat) {
+            int stride = mVertexFormat.getStride();
+            std::memcpy(mData.get() + vertexOffset * stride, other.mData.get(), other.mNumVertices * stride);
+            other.releaseRestored();
+            return true;
+        }
+
+        bool success = true;
+        int dstStride = mVertexFormat.getStride(), srcStride = other.mVertexFormat.getStride();
+        for(int a = 0; a < mVertexFormat.getAttributeCount(); ++a) {
+            const VertexAttribute& dstAttr = mVertexFormat.getAttributes()[a];
+            const VertexAttribute* srcAttr = other.mVertexFormat.getAttribute(dstAttr.type);
+            if(!srcAttr) continue;
+            int srcIndex = srcAttr - other.mVertexFormat.getAttributes().data();
+
+            VBODataType* dst = mData.get() + vertexOffset * dstStride + mVertexFormat.getAttributeOffset(a);
+            const VBODataType* src = other.mData.get() + other.mVertexFormat.getAttributeOffset(srcIndex);
+
+            if(dstAttr.dataType == srcAttr->dataType && dstAttr.num == srcAttr->num && dstAttr.normalized == srcAttr->normalized) {
+                int size = dstAttr.getSize();
+                for(size_t i = 0; i < other.mNumVertices; ++i) {
+                    std::memcpy(dst + i * dstStride, src + i * srcStride, size);
+                }
+            } else {
+                float values[4];
+                for(size_t i = 0; i < other.mNumVertices; ++i) {
+                    if(!decodeVertexAttribute(*srcAttr, src + i * srcStride, values) || !encodeVertexAttribute(dstAttr, values, dst + i * dstStride)) {
+                        LOG_ERROR("Conversion of vertex attribute '%s' between these data types is not supported.", getVertexAttributeTypeName(dstAttr.type));
+                        success = false;
+                        break;
+                    }
+                }
+            }
+        }
+        other.releaseRestored();
+        return success;
     }
 
     int getIndexBufferTypeSize(IndexBufferType type) {
@@ -57,9 +318,20 @@ namespace ngn {
     void IndexBuffer::reallocate(size_t numIndices, bool copyOld) {
         size_t newSize = getIndexBufferTypeSize(mDataType)*numIndices;
         std::unique_ptr<VBODataType[]> newData(new VBODataType[newSize]);
+        if(copyOld) restoreLocal();
+        std::vector<uint8_t>().swap(mCompressedData);
         if(mData.get() != nullptr && copyOld) std::copy(mData.get(), mData.get() + mSize, newData.get());
         mData.reset(newData.release());
         mNumIndices = numIndices;
         mSize = newSize;
+        markDirty();
+    }
+
+    void IndexBuffer::uploadFrom(const void* data, size_t numIndices) {
+        mData.reset();
+        std::vector<uint8_t>().swap(mCompressedData);
+        mNumIndices = numIndices;
+        mSize = getIndexBufferTypeSize(mDataType)*numIndices;
+        uploadData(data);
     }
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <utility>
 #include <memory>
 #include <algorithm>
+#include <unordered_map>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -21,6 +22,16 @@ namespace ngn {
         DYNAMIC = GL_DYNAMIC_DRAW
     };
 
+    // What happens to the local copy of a STATIC buffer after it was uploaded. The other buffers are written regularly, so they keep it.
+    // A freed local copy is restored transparently when it's needed again (see GLBuffer::restoreLocal), so nothing stops working.
+    enum class ResidencyPolicy {
+        KEEP,
+        // freed and read back from the GL buffer if needed (which is slow and only possible on the thread with the GL context)
+        FREE_AFTER_UPLOAD,
+        // replaced by a compressed copy (see compression.hpp), which usually is half the size or less and is decompressed if needed
+        COMPRESS_AFTER_UPLOAD
+    };
+
     struct VertexFormat {
     private:
         std::vector<VertexAttribute> mAttributes;
@@ -43,7 +54,7 @@ namespace ngn {
                 mAttributes.emplace_back(attrType, num, dataType, normalized, divisor);
                 mAttributeOffsets.push_back(mStride);
                 const VertexAttribute& attr = mAttributes.back();
-                mStride += getAttributeDataTypeSize(attr.dataType) * attr.alignedNum;
+                mStride += attr.getSize();
             }
         }
 
@@ -58,14 +69,21 @@ namespace ngn {
         // I was thinking about hasAttributes, but you would probably pass a vector to that, which
         // would just as much code to create, than to call hasAttribute multiple times.
         bool hasAttribute(AttributeType attrType) const;
+        // returns nullptr if the attribute is not present
+        const VertexAttribute* getAttribute(AttributeType attrType) const;
+
+        // same attributes in the same order (i.e. same memory layout)
+        bool operator==(const VertexFormat& other) const;
+        bool operator!=(const VertexFormat& other) const {return !(*this == other);}
 
         // These return a VertexAttributeAccessor instance that represents an invalid state (doesn't read or write)
         // if the attribute does not exist. use isValid()
+        // If buffer is given, writes through the accessor are marked as dirty there
         template<typename T>
-        VertexAttributeAccessor<T> getAccessor(AttributeType attrType, size_t count, void* data) const {
+        VertexAttributeAccessor<T> getAccessor(AttributeType attrType, size_t count, void* data, GLBuffer* buffer = nullptr) const {
             for(std::size_t i = 0; i < mAttributes.size(); ++i) {
                 if(mAttributes[i].type == attrType) {
-                    return VertexAttributeAccessor<T>(mAttributes[i], getStride(), getAttributeOffset(i), count, data);
+                    return VertexAttributeAccessor<T>(mAttributes[i], getStride(), getAttributeOffset(i), count, data, buffer);
                 }
             }
             LOG_ERROR("There is no attribute of type '%s', make sure to call hasAttribute!", getVertexAttributeTypeName(attrType));
@@ -79,39 +97,124 @@ namespace ngn {
         int mSize;
         UsageHint mUsage;
         using VBODataType = uint8_t;
-        std::unique_ptr<VBODataType[]> mData; // Actually we don't care about the type, but we can't declare a std::unique_ptr<void>
+        // mutable, because it is restored on demand (see restoreLocal)
+        mutable std::unique_ptr<VBODataType[]> mData; // Actually we don't care about the type, but we can't declare a std::unique_ptr<void>
         // this is because void doesn't have a destructor, making that type incomplete
+        ResidencyPolicy mResidencyPolicy;
+        // the local copy, while it's compressed (see ResidencyPolicy)
+        mutable std::vector<uint8_t> mCompressedData;
+        // the local copy was restored on demand and can be freed again (see releaseRestored)
+        mutable bool mRestored;
         GLuint mVBO;
+        // mVBO is shared with other buffers with the same content (see deduplicate) and mContentHash is it's key in sharedBuffers
+        bool mShared;
+        uint64_t mContentHash;
         int mLastUploadedSize;
         int mUploadCount;
+        // see getBufferObjectGeneration
+        uint32_t mBufferObjectGeneration;
+        // Byte ranges [first, second) that were written since the last upload
+        std::vector<std::pair<int, int> > mDirtyRanges;
+
+        // Dirty ranges closer than this are uploaded together, because every glBufferSubData has it's own overhead
+        static const int DIRTY_RANGE_MERGE_GAP = 256;
+        // If there are more ranges than this (i.e. very scattered writes), they are all merged into one
+        static const size_t MAX_DIRTY_RANGES = 32;
+
+        struct SharedBuffer {
+            GLuint vbo;
+            int referenceCount;
+        };
+        static std::unordered_map<uint64_t, SharedBuffer> sharedBuffers;
+
+        // Uploads everything
+        void uploadData(const void* data);
+        // Leaves this buffer with a buffer object of it's own (none, if others still use the shared one)
+        void detachShared();
+        // The hash only finds candidates, the content of the shared buffer object is read back and compared before it's used
+        bool sharedContentEquals(GLuint vbo, const void* data) const;
+        // uploadedData is the content of the buffer, if the local copy was freed already (see VertexBuffer::uploadFrom)
+        void applyResidencyPolicy(const void* uploadedData) const;
+
+        // For the compression of the local copy: the stride of vertices, the size of indices
+        virtual size_t getElementSize() const {return 1;}
 
     public:
         GLBuffer(GLenum target, void* data, size_t size, UsageHint usage) :
                 mTarget(target), mSize(size), mUsage(usage), mData(reinterpret_cast<VBODataType*>(data)),
-                mVBO(0), mLastUploadedSize(0), mUploadCount(0) {}
+                mResidencyPolicy(defaultResidencyPolicy), mRestored(false), mVBO(0), mShared(false), mContentHash(0), mLastUploadedSize(0), mUploadCount(0),
+                mBufferObjectGeneration(0) {}
 
-        ~GLBuffer() {
-            if(mVBO != 0) glDeleteBuffers(1, &mVBO);
-        }
+        ~GLBuffer();
 
         GLBuffer(const GLBuffer& other) = delete;
         GLBuffer& operator=(const GLBuffer& other) = delete;
 
         // http://hacksoflife.blogspot.de/2015/06/glmapbuffer-no-longer-cool.html - Don't implement map()?
 
+        // The first upload (and the first after the size changed) uploads the whole buffer, after that only the dirty ranges are uploaded
+        // and nothing if nothing was written. STREAM buffers and DYNAMIC buffers that are mostly dirty are orphaned and uploaded completely instead,
+        // so the upload never has to wait for the GPU to finish reading the old data.
         void upload();
 
+        // Writes through accessors, fillFromOtherBuffer and IndexBuffer::operator[] are tracked automatically. Getting a
+        // non-const pointer with getData marks the whole buffer, so only use this for writes through pointers you kept around.
+        void markDirty(size_t offset, size_t size);
+        void markDirty() {markDirty(0, mSize);}
+        bool isDirty() const {return !mDirtyRanges.empty();}
+
         virtual void reallocate(size_t num, bool copyOld) = 0;
 
         virtual void* getData() {
+            restoreLocal();
+            markDirty();
             return mData.get();
         }
 
-        int getUploadCount() const {return mUploadCount;}
+        const void* getData() const {
+            restoreLocal();
+            return mData.get();
+        }
 
-        // If you uploaded your data, you can call release to delete the local copy
+        UsageHint getUsage() const {return mUsage;}
+        int getSize() const {return mSize;}
+        int getUploadCount() const {return mUploadCount;}
+        // true if the uncompressed local copy is in memory right now
+        bool hasLocalData() const {return mData != nullptr;}
+        // true if the local copy is in memory or can be restored (see restoreLocal), so this is only false if there is no data at all.
+        // Use this to check if an operation can read the data, it doesn't restore anything
+        bool canRestoreLocal() const {return mData != nullptr || !mCompressedData.empty() || (mVBO != 0 && mUploadCount > 0);}
+
+        // The policy of buffers created from now on
+        static ResidencyPolicy defaultResidencyPolicy;
+        ResidencyPolicy getResidencyPolicy() const {return mResidencyPolicy;}
+        void setResidencyPolicy(ResidencyPolicy policy) {mResidencyPolicy = policy;}
+        // Frees or compresses the local copy according to the policy, unless there are changes that were not uploaded yet. This happens after
+        // every upload, so call it only to get rid of a local copy that was restored to read it (e.g. to build a BVH or save a mesh cache)
+        void applyResidencyPolicy() const {applyResidencyPolicy(nullptr);}
+        // Brings back a freed local copy: decompresses it or reads it back from the GL buffer (on the thread with the GL context only).
+        // All the functions that access the data do this, but it's not thread safe, so call it before the buffer
+        // is read from multiple threads. Returns false if there is nothing to restore
+        bool restoreLocal() const;
+        // Applies the policy again, if the local copy was restored by restoreLocal. Operations that read the data call this when they are done
+        void releaseRestored() const {if(mRestored) applyResidencyPolicy(nullptr);}
+        // The memory used by the local copy (compressed or not)
+        size_t getLocalSize() const {return mData ? mSize : mCompressedData.size();}
+
+        // If true (the default), STATIC buffers with the same content share a single GL buffer object, which is found by a 64 bit hash
+        // of the content and the size when they are uploaded completely (e.g. the same mesh generated or imported twice) and then
+        // compared byte by byte with the content of the buffer object.
+        // Uploading changed content into a shared buffer gives it a buffer object of it's own again, so the others are not affected.
+        static bool deduplicate;
+        bool isShared() const {return mShared;}
+        static size_t getSharedBufferCount() {return sharedBuffers.size();}
+        // Incremented when this buffer was uploaded already and gets another buffer object (see deduplicate),
+        // so VAOs that were compiled before point to the wrong one and have to be rebuilt
+        uint32_t getBufferObjectGeneration() const {return mBufferObjectGeneration;}
+
+        // If you uploaded your data, you can call release to delete the local copy (it's read back from the GL buffer if it's needed again)
         void freeLocal() {
-            mData.reset();
+            if(mUploadCount > 0) mData.reset();
         }
 
         void bind() {
@@ -133,6 +236,8 @@ namespace ngn {
         const VertexFormat mVertexFormat;
         size_t mNumVertices;
 
+        size_t getElementSize() const {return mVertexFormat.getStride();}
+
     public:
         // The vertex formats will be copied, so it's not possible to to dangerous shenanigans by changing them after they were used
         VertexBuffer(const VertexFormat& format, UsageHint usage = UsageHint::STATIC) :
@@ -154,19 +259,27 @@ namespace ngn {
         // If nothing has been allocated yet, also call this function
         void reallocate(size_t numVertices, bool copyOld = false);
 
+        // Uploads numVertices vertices directly from data (which is not owned) and frees the local copy,
+        // e.g. to upload from a memory mapped file without copying it first
+        void uploadFrom(const void* data, size_t numVertices);
+
         size_t getNumVertices() const {return mNumVertices;}
         const VertexFormat& getVertexFormat() const {return mVertexFormat;}
 
         template<typename T>
         VertexAttributeAccessor<T> getAccessor(AttributeType id) {
-            return mVertexFormat.getAccessor<T>(id, mNumVertices, mData.get());
+            restoreLocal();
+            return mVertexFormat.getAccessor<T>(id, mNumVertices, mData.get(), this);
         }
 
         // Note that this is compatible with VertexBuffers that have a different VertexFormat
         // This is actually what this is for mainly
-        // If the types match in both buffers, they data is copied byte-by-byte, otherwise...
-        // tons of rules. This has to be clever. Implement this sometime.
-        void fillFromOtherBuffer(const VertexBuffer& other);
+        // All vertices of other are copied to the vertices starting at vertexOffset (this buffer has to be big enough).
+        // Only attributes present in both buffers are copied, the others are left untouched.
+        // If the types match in both buffers, the data is copied byte-by-byte, otherwise it's converted through floats
+        // (see decodeVertexAttribute, missing components are filled with 0 and w with 1). This is also how a mesh is compressed.
+        // Returns false if some attributes could not be copied
+        bool fillFromOtherBuffer(const VertexBuffer& other, size_t vertexOffset = 0);
     };
 
     enum class IndexBufferType : GLenum {
@@ -180,15 +293,19 @@ namespace ngn {
 
     class IndexBufferAssigner {
     private:
+        GLBuffer* mBuffer;
         void* mData;
         size_t mIndex;
         IndexBufferType mDataType;
 
     public:
-        IndexBufferAssigner(void* data, size_t index, IndexBufferType dataType) : mData(data), mIndex(index), mDataType(dataType) {}
+        IndexBufferAssigner(GLBuffer* buffer, void* data, size_t index, IndexBufferType dataType) :
+                mBuffer(buffer), mData(data), mIndex(index), mDataType(dataType) {}
 
         template<typename T>
         const T& operator=(const T& val) {
+            int size = getIndexBufferTypeSize(mDataType);
+            mBuffer->markDirty(mIndex * size, size);
             switch(mDataType) {
                 case IndexBufferType::UI8:
                     *(reinterpret_cast< uint8_t*>(mData) + mIndex) = val;
@@ -209,6 +326,8 @@ namespace ngn {
         IndexBufferType mDataType;
         size_t mNumIndices;
 
+        size_t getElementSize() const {return getIndexBufferTypeSize(mDataType);}
+
     public:
         IndexBuffer(IndexBufferType dataType, UsageHint usage = UsageHint::STATIC) :
                 GLBuffer(GL_ELEMENT_ARRAY_BUFFER, nullptr, 0, usage),
@@ -233,14 +352,21 @@ namespace ngn {
         size_t getNumIndices() const {return mNumIndices;}
         IndexBufferType getDataType() const {return mDataType;}
 
+        using GLBuffer::getData;
         template<typename T>
         T* getData() {
+            restoreLocal();
+            markDirty();
             return reinterpret_cast<T*>(mData.get());
         }
 
         void reallocate(size_t numIndices, bool copyOld = false);
 
+        // see VertexBuffer::uploadFrom
+        void uploadFrom(const void* data, size_t numIndices);
+
         uint32_t operator[](size_t index) const {
+            if(!mData) restoreLocal();
             switch(mDataType) {
                 case IndexBufferType::UI8:
                     return static_cast<uint32_t>(*(reinterpret_cast<uint8_t*>(mData.get()) + index));
@@ -255,7 +381,8 @@ namespace ngn {
         }
 
         IndexBufferAssigner operator[](size_t index) {
-            return IndexBufferAssigner(mData.get(), index, mDataType);
+            if(!mData) restoreLocal();
+            return IndexBufferAssigner(this, mData.get(), index, mDataType);
         }
     };
 }
\ No newline at end of file
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+#include "log.hpp"
+#include "mesh_vertexattribute.hpp"
+#include "mesh_vertexaccessor.hpp"
+#include "mesh_vertexdata.hpp"
+
+/*
+Vertex formats that are known at compile time, e.g.:
+
+    using MyLayout = VertexLayout<Position<>, Normal<AttributeDataType::I2_10_10_10>, TexCoord0<AttributeDataType::F16, 2> >;
+    VertexBuffer* vBuf = mesh->addVertexBuffer(MyLayout::getVertexFormat(), vertexCount);
+    MyLayout::Vertex* vertices = MyLayout::getVertices(*vBuf);
+    vertices[i].position = glm::vec3(1.0f, 2.0f, 3.0f);
+    vertices[i].normal = glm::vec3(0.0f, 1.0f, 0.0f);
+
+Vertex is a plain struct with one member per attribute (named like the attribute, e.g. position, normal, texCoord0), so writing
+an F32 attribute is a plain store. The members of other data types are VertexValues, which are assigned from and converted to
+float vectors (with the same conversions as the accessors, but inline and without checking the data type at runtime).
+*/
+
+namespace ngn {
+    constexpr int getLayoutDataTypeSize(AttributeDataType type) {
+        return type == AttributeDataType::I8 || type == AttributeDataType::UI8 ? 1 :
+               type == AttributeDataType::I16 || type == AttributeDataType::UI16 || type == AttributeDataType::F16 ? 2 : 4;
+    }
+
+    // Integers are normalized by default
+    constexpr bool isLayoutNormalizedByDefault(AttributeDataType type) {
+        return type != AttributeDataType::F32 && type != AttributeDataType::F16;
+    }
+
+    template<AttributeDataType dataType> struct AttributeStorage {using type = uint32_t;}; // UI32 and the packed types
+    template<> struct AttributeStorage<AttributeDataType::I8> {using type = int8_t;};
+    template<> struct AttributeStorage<AttributeDataType::UI8> {using type = uint8_t;};
+    template<> struct AttributeStorage<AttributeDataType::I16> {using type = int16_t;};
+    template<> struct AttributeStorage<AttributeDataType::UI16> {using type = uint16_t;};
+    template<> struct AttributeStorage<AttributeDataType::F16> {using type = uint16_t;};
+    template<> struct AttributeStorage<AttributeDataType::I32> {using type = int32_t;};
+    template<> struct AttributeStorage<AttributeDataType::F32> {using type = float;};
+
+    template<int num> struct FloatVector {};
+    template<> struct FloatVector<1> {using type = float;};
+    template<> struct FloatVector<2> {using type = glm::vec2;};
+    template<> struct FloatVector<3> {using type = glm::vec3;};
+    template<> struct FloatVector<4> {using type = glm::vec4;};
+
+    inline float* getFloatVectorData(float& value) {return &value;}
+    inline const float* getFloatVectorData(const float& value) {return &value;}
+    template<typename T> float* getFloatVectorData(T& value) {return &value.x;}
+    template<typename T> const float* getFloatVectorData(const T& value) {return &value.x;}
+
+    // A num component value of a vertex in a data type other than F32, storageCount is the number of components including the padding
+    template<AttributeDataType dataType, int num, bool normalized, int storageCount>
+    struct VertexValue {
+        using Storage = typename AttributeStorage<dataType>::type;
+        using Vector = typename FloatVector<num>::type;
+
+        Storage data[storageCount];
+
+        VertexValue& operator=(const Vector& value) {
+            const float* values = getFloatVectorData(value);
+            if(isPackedAttributeDataType(dataType)) {
+                float packedValues[4];
+                // keep w, if only xyz are assigned
+                if(num < 4) decodePacked2_10_10_10(data[0], dataType == AttributeDataType::I2_10_10_10, normalized, packedValues);
+                for(int i = 0; i < num; ++i) packedValues[i] = values[i];
+                data[0] = encodePacked2_10_10_10(packedValues, dataType == AttributeDataType::I2_10_10_10, normalized);
+            } else if(dataType == AttributeDataType::F16) {
+                for(int i = 0; i < num; ++i) data[i] = floatToHalf(values[i]);
+            } else {
+                for(int i = 0; i < num; ++i) data[i] = encodeInt<Storage>(values[i], normalized);
+            }
+            return *this;
+        }
+
+        Vector get() const {
+            Vector ret;
+            float* values = getFloatVectorData(ret);
+            if(isPackedAttributeDataType(dataType)) {
+                float packedValues[4];
+                decodePacked2_10_10_10(data[0], dataType == AttributeDataType::I2_10_10_10, normalized, packedValues);
+                for(int i = 0; i < num; ++i) values[i] = packedValues[i];
+            } else if(dataType == AttributeDataType::F16) {
+                for(int i = 0; i < num; ++i) values[i] = halfToFloat(data[i]);
+            } else {
+                for(int i = 0; i < num; ++i) values[i] = decodeInt<Storage>(data[i], normalized);
+            }
+            return ret;
+        }
+
+        operator Vector() const {return get();}
+    };
+
+    // Everything about one attribute of a layout. num is the number of components the members have, for packed
+    // attributes this may be 3 (the attribute has 4 components in the VertexFormat nonetheless)
+    template<AttributeType attrType, AttributeDataType attrDataType, int attrNum, bool attrNormalized>
+    struct LayoutAttribute {
+        static_assert(attrNum >= 1 && attrNum <= 4, "Vertex attributes have 1 to 4 components");
+        static_assert(!isPackedAttributeDataType(attrDataType) || attrNum >= 3, "Packed attributes have 3 or 4 components");
+
+        static constexpr AttributeType type = attrType;
+        static constexpr AttributeDataType dataType = attrDataType;
+        static constexpr int num = attrNum;
+        static constexpr int formatNum = isPackedAttributeDataType(attrDataType) ? 4 : attrNum;
+        static constexpr bool normalized = attrNormalized;
+        // like VertexAttribute::getSize, aligned to 4 bytes
+        static constexpr int size = isPackedAttributeDataType(attrDataType) ? 4 : (getLayoutDataTypeSize(attrDataType) * attrNum + 3) / 4 * 4;
+
+        using ValueType = typename std::conditional<attrDataType == AttributeDataType::F32, typename FloatVector<attrNum>::type,
+            VertexValue<attrDataType, attrNum, attrNormalized, size / static_cast<int>(sizeof(typename AttributeStorage<attrDataType>::type))> >::type;
+    };
+
+    // Member<Base> derives from Base and adds a member with the name of the attribute
+    #define NGN_LAYOUT_ATTRIBUTE(Name, memberName, attrType, defaultNum) \
+        template<AttributeDataType dataType = AttributeDataType::F32, int num = defaultNum, bool normalized = isLayoutNormalizedByDefault(dataType)> \
+        struct Name : LayoutAttribute<attrType, dataType, num, normalized> { \
+            template<typename Base> \
+            struct Member : Base { \
+                typename LayoutAttribute<attrType, dataType, num, normalized>::ValueType memberName; \
+            }; \
+        };
+
+    NGN_LAYOUT_ATTRIBUTE(Position, position, AttributeType::POSITION, 3)
+    NGN_LAYOUT_ATTRIBUTE(Normal, normal, AttributeType::NORMAL, 3)
+    NGN_LAYOUT_ATTRIBUTE(Tangent, tangent, AttributeType::TANGENT, 3)
+    NGN_LAYOUT_ATTRIBUTE(Bitangent, bitangent, AttributeType::BITANGENT, 3)
+    NGN_LAYOUT_ATTRIBUTE(Color0, color0, AttributeType::COLOR0, 4)
+    NGN_LAYOUT_ATTRIBUTE(Color1, color1, AttributeType::COLOR1, 4)
+    NGN_LAYOUT_ATTRIBUTE(BoneIndices, boneIndices, AttributeType::BONEINDICES, 4)
+    NGN_LAYOUT_ATTRIBUTE(BoneWeights, boneWeights, AttributeType::BONEWEIGHTS, 4)
+    NGN_LAYOUT_ATTRIBUTE(TexCoord0, texCoord0, AttributeType::TEXCOORD0, 2)
+    NGN_LAYOUT_ATTRIBUTE(TexCoord1, texCoord1, AttributeType::TEXCOORD1, 2)
+    NGN_LAYOUT_ATTRIBUTE(TexCoord2, texCoord2, AttributeType::TEXCOORD2, 2)
+    NGN_LAYOUT_ATTRIBUTE(TexCoord3, texCoord3, AttributeType::TEXCOORD3, 2)
+    NGN_LAYOUT_ATTRIBUTE(Custom0, custom0, AttributeType::CUSTOM0, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom1, custom1, AttributeType::CUSTOM1, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom2, custom2, AttributeType::CUSTOM2, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom3, custom3, AttributeType::CUSTOM3, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom4, custom4, AttributeType::CUSTOM4, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom5, custom5, AttributeType::CUSTOM5, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom6, custom6, AttributeType::CUSTOM6, 4)
+    NGN_LAYOUT_ATTRIBUTE(Custom7, custom7, AttributeType::CUSTOM7, 4)
+
+    #undef NGN_LAYOUT_ATTRIBUTE
+
+    // The first attribute is the innermost base class, so the members are in the order of the attributes.
+    // Every member is a multiple of 4 bytes big and at most 4 byte aligned, so there is no padding between them
+    struct EmptyVertex {};
+
+    template<typename Base, typename... Attributes>
+    struct VertexChain {
+        using type = Base;
+    };
+
+    template<typename Base, typename First, typename... Rest>
+    struct VertexChain<Base, First, Rest...> {
+        using type = typename VertexChain<typename First::template Member<Base>, Rest...>::type;
+    };
+
+    template<typename... Attributes>
+    struct LayoutStride {
+        static constexpr int value = 0;
+    };
+
+    template<typename First, typename... Rest>
+    struct LayoutStride<First, Rest...> {
+        static constexpr int value = First::size + LayoutStride<Rest...>::value;
+    };
+
+    // -1 if the attribute is not in the layout
+    template<AttributeType attrType, typename... Attributes>
+    struct LayoutOffset {
+        static constexpr int value = -1;
+    };
+
+    template<AttributeType attrType, typename First, typename... Rest>
+    struct LayoutOffset<attrType, First, Rest...> {
+        static constexpr int value = First::type == attrType ? 0 :
+            (LayoutOffset<attrType, Rest...>::value < 0 ? -1 : First::size + LayoutOffset<attrType, Rest...>::value);
+    };
+
+    template<typename... Attributes>
+    class VertexLayout {
+    public:
+        using Vertex = typename VertexChain<EmptyVertex, Attributes...>::type;
+
+        static constexpr int stride = LayoutStride<Attributes...>::value;
+        static_assert(sizeof(Vertex) == stride, "The vertex struct has a different size than the vertex format");
+
+        template<AttributeType attrType>
+        static constexpr int getOffset() {return LayoutOffset<attrType, Attributes...>::value;}
+        template<AttributeType attrType>
+        static constexpr bool hasAttribute() {return LayoutOffset<attrType, Attributes...>::value >= 0;}
+
+        // The equivalent runtime format (for the GL setup and everything that works with any format)
+        static const VertexFormat& getVertexFormat() {
+            static const VertexFormat format = createVertexFormat();
+            return format;
+        }
+
+        // Returns nullptr if the vertex buffer has another format. Marks the whole buffer as dirty
+        static Vertex* getVertices(VertexBuffer& buffer) {
+            if(buffer.getVertexFormat() != getVertexFormat()) {
+                LOG_ERROR("The vertex buffer does not have the format of the vertex layout.");
+                return nullptr;
+            }
+            return reinterpret_cast<Vertex*>(buffer.getData());
+        }
+
+        static const Vertex* getVertices(const VertexBuffer& buffer) {
+            if(buffer.getVertexFormat() != getVertexFormat()) {
+                LOG_ERROR("The vertex buffer does not have the format of the vertex layout.");
+                return nullptr;
+            }
+            return reinterpret_cast<const Vertex*>(buffer.getData());
+        }
+
+    private:
+        static VertexFormat createVertexFormat() {
+            VertexFormat format;
+            // expands to one add per attribute
+            int dummy[] = {0, (format.add(Attributes::type, Attributes::formatNum, Attributes::dataType, Attributes::normalized), 0)...};
+            (void)dummy;
+            assert(format.getStride() == stride);
+            return format;
+        }
+    };
+}
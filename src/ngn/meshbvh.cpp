@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cmath>
+
+#include "meshbvh.hpp"
+#include "mesh.hpp"
+
+namespace ngn {
+    bool MeshBVH::build(const Mesh& mesh) {
+        mNodes.clear();
+        mVertices.clear();
+        mTriangles.clear();
+
+        if(mesh.getDrawMode() != Mesh::DrawMode::TRIANGLES) {
+            LOG_ERROR("Only meshes with DrawMode::TRIANGLES can be raycast.");
+            return false;
+        }
+
+        if(!mesh.hasAttribute(AttributeType::POSITION)) return false;
+        auto position = mesh.getAccessor<glm::vec3>(AttributeType::POSITION);
+        if(!position.isValid()) {
+            LOG_ERROR("The mesh vertex data has to be present locally to build a BVH.");
+            return false;
+        }
+
+        const IndexBuffer* indexBuffer = mesh.getIndexBuffer();
+        size_t vertexCount = indexBuffer ? indexBuffer->getNumIndices() : position.getCount();
+        size_t triangleCount = vertexCount / 3;
+        if(triangleCount == 0) return true;
+
+        mVertices.resize(triangleCount * 3);
+        for(size_t i = 0; i < triangleCount * 3; ++i) {
+            mVertices[i] = position.get(indexBuffer ? (*indexBuffer)[i] : i);
+        }
+
+        std::vector<glm::vec3> centroids(triangleCount);
+        mTriangles.resize(triangleCount);
+        for(size_t i = 0; i < triangleCount; ++i) {
+            mTriangles[i] = i;
+            centroids[i] = (mVertices[i*3+0] + mVertices[i*3+1] + mVertices[i*3+2]) / 3.0f;
+        }
+
+        mNodes.reserve(2 * triangleCount / MAX_LEAF_TRIANGLES + 1);
+        Node root;
+        root.leftFirst = 0;
+        root.count = triangleCount;
+        mNodes.push_back(root);
+        subdivide(0, centroids);
+
+        // until now mVertices were indexed with the original triangle indices
+        std::vector<glm::vec3> sortedVertices(mVertices.size());
+        for(size_t i = 0; i < triangleCount; ++i) {
+            for(int v = 0; v < 3; ++v) sortedVertices[i*3+v] = mVertices[mTriangles[i]*3+v];
+        }
+        mVertices.swap(sortedVertices);
+
+        return true;
+    }
+
+    // Splits at the median of the centroids along the longest axis of the centroid bounds
+    void MeshBVH::subdivide(uint32_t nodeIndex, std::vector<glm::vec3>& centroids) {
+        uint32_t first = mNodes[nodeIndex].leftFirst;
+        uint32_t count = mNodes[nodeIndex].count;
+
+        AABoundingBox box, centroidBox;
+        box.min = box.max = mVertices[mTriangles[first]*3];
+        centroidBox.min = centroidBox.max = centroids[mTriangles[first]];
+        for(uint32_t i = first; i < first + count; ++i) {
+            uint32_t tri = mTriangles[i];
+            for(int v = 0; v < 3; ++v) box.fitPoint(mVertices[tri*3+v]);
+            centroidBox.fitPoint(centroids[tri]);
+        }
+        mNodes[nodeIndex].box = box;
+
+        if(count <= MAX_LEAF_TRIANGLES) return;
+
+        glm::vec3 size = centroidBox.max - centroidBox.min;
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        // all centroids in one point, splitting won't help
+        if(size[axis] <= 0.0f) return;
+
+        uint32_t mid = first + count / 2;
+        std::nth_element(mTriangles.begin() + first, mTriangles.begin() + mid, mTriangles.begin() + first + count,
+            [&centroids, axis](uint32_t a, uint32_t b) {return centroids[a][axis] < centroids[b][axis];});
+
+        uint32_t left = mNodes.size();
+        Node child;
+        child.leftFirst = first;
+        child.count = mid - first;
+        mNodes.push_back(child);
+        child.leftFirst = mid;
+        child.count = first + count - mid;
+        mNodes.push_back(child);
+
+        mNodes[nodeIndex].leftFirst = left;
+        mNodes[nodeIndex].count = 0;
+
+        subdivide(left, centroids);
+        subdivide(left + 1, centroids);
+    }
+
+    // returns the distance at which the ray enters the box or infinity if it misses
+    inline float intersectAABB(const AABoundingBox& box, const glm::vec3& origin, const glm::vec3& invDir, float maxDistance) {
+        glm::vec3 t1 = (box.min - origin) * invDir;
+        glm::vec3 t2 = (box.max - origin) * invDir;
+        glm::vec3 tmin = glm::min(t1, t2), tmax = glm::max(t1, t2);
+        float enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+        float exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxDistance));
+        return enter <= exit ? enter : INFINITY;
+    }
+
+    bool MeshBVH::intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RaycastHit& hit) const {
+        if(mNodes.empty()) return false;
+
+        glm::vec3 invDir = 1.0f / direction;
+        bool found = false;
+
+        uint32_t stack[64];
+        int stackSize = 0;
+        if(intersectAABB(mNodes[0].box, origin, invDir, maxDistance) < INFINITY) stack[stackSize++] = 0;
+
+        while(stackSize > 0) {
+            const Node& node = mNodes[stack[--stackSize]];
+            if(node.count > 0) {
+                for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+                    // Moller-Trumbore
+                    const glm::vec3& v0 = mVertices[i*3+0];
+                    glm::vec3 edge1 = mVertices[i*3+1] - v0;
+                    glm::vec3 edge2 = mVertices[i*3+2] - v0;
+                    glm::vec3 p = glm::cross(direction, edge2);
+                    float det = glm::dot(edge1, p);
+                    if(std::fabs(det) < 1e-12f) continue;
+                    float invDet = 1.0f / det;
+                    glm::vec3 s = origin - v0;
+                    float u = glm::dot(s, p) * invDet;
+                    if(u < 0.0f || u > 1.0f) continue;
+                    glm::vec3 q = glm::cross(s, edge1);
+                    float v = glm::dot(direction, q) * invDet;
+                    if(v < 0.0f || u + v > 1.0f) continue;
+                    float t = glm::dot(edge2, q) * invDet;
+                    if(t < 0.0f || t >= maxDistance) continue;
+
+                    maxDistance = t;
+                    hit.distance = t;
+                    hit.triangle = mTriangles[i];
+                    hit.barycentrics = glm::vec3(1.0f - u - v, u, v);
+                    found = true;
+                }
+            } else {
+                // visit the closer child first, so maxDistance shrinks faster
+                float dist1 = intersectAABB(mNodes[node.leftFirst + 0].box, origin, invDir, maxDistance);
+                float dist2 = intersectAABB(mNodes[node.leftFirst + 1].box, origin, invDir, maxDistance);
+                if(dist1 > dist2) {
+                    if(dist1 < INFINITY) stack[stackSize++] = node.leftFirst + 0;
+                    if(dist2 < INFINITY) stack[stackSize++] = node.leftFirst + 1;
+                } else {
+                    if(dist2 < INFINITY) stack[stackSize++] = node.leftFirst + 1;
+                    if(dist1 < INFINITY) stack[stackSize++] = node.leftFirst + 0;
+                }
+            }
+        }
+
+        return found;
+    }
+}
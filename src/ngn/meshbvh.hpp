@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "aabb.hpp"
+
+namespace ngn {
+    class Mesh;
+    class SceneNode;
+
+    struct RaycastHit {
+        SceneNode* node;
+        // index of the triangle in the index buffer (i.e. the first index is triangle * 3) or in the vertex buffer, if the mesh has no indices
+        size_t triangle;
+        // weights of the triangle's three vertices
+        glm::vec3 barycentrics;
+        // along the ray direction
+        float distance;
+        // world space
+        glm::vec3 position;
+
+        RaycastHit() : node(nullptr), triangle(0), distance(0.0f) {}
+    };
+
+    // Bounding volume hierarchy over the triangles of a mesh (in model space) for raycasting
+    // It keeps it's own copy of the positions, so it stays valid if the local copy of the vertex data is released
+    class MeshBVH {
+    private:
+        struct Node {
+            AABoundingBox box;
+            // if count == 0, this is the index of the first child (the second one is right after it), otherwise the first triangle
+            uint32_t leftFirst;
+            uint32_t count;
+        };
+
+        static const int MAX_LEAF_TRIANGLES = 4;
+
+        std::vector<Node> mNodes;
+        // three per triangle, in the order of mTriangles
+        std::vector<glm::vec3> mVertices;
+        // maps the sorted triangles back to the triangles in the mesh
+        std::vector<uint32_t> mTriangles;
+
+        void subdivide(uint32_t nodeIndex, std::vector<glm::vec3>& centroids);
+
+    public:
+        MeshBVH() {}
+
+        // Only meshes with DrawMode::TRIANGLES are supported. Returns false if the mesh could not be used (e.g. no local copy of the positions)
+        bool build(const Mesh& mesh);
+
+        size_t getTriangleCount() const {return mTriangles.size();}
+
+        // direction does not have to be normalized, the hit distance is in multiples of it.
+        // Only returns hits closer than maxDistance. Triangles are double-sided
+        bool intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RaycastHit& hit) const;
+    };
+}
@@ -1,3 +1,8 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
 #include "misc.hpp"
 
 namespace ngn {
@@ -21,4 +26,28 @@ namespace ngn {
             return 1.0f;
         }
     }
+
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t begin, size_t end)>& func, unsigned int threadCount) {
+        if(count == 0) return;
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        if(threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        threadCount = std::min(static_cast<size_t>(threadCount), chunkCount);
+        if(threadCount <= 1) {
+            func(0, count);
+            return;
+        }
+
+        std::atomic<size_t> nextChunk(0);
+        auto worker = [&]() {
+            size_t chunk;
+            while((chunk = nextChunk++) < chunkCount) {
+                size_t begin = chunk * chunkSize;
+                func(begin, std::min(begin + chunkSize, count));
+            }
+        };
+        std::vector<std::thread> threads;
+        for(unsigned int i = 1; i < threadCount; ++i) threads.emplace_back(worker);
+        worker();
+        for(auto& thread : threads) thread.join();
+    }
 }
\ No newline at end of file
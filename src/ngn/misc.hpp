@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
 #include <glm/glm.hpp>
 
 namespace ngn {
@@ -41,6 +44,21 @@ namespace ngn {
         return glm::vec3(v) / v.w;
     }
 
+    // 64 bit FNV-1a, pass the result of a previous call as hash to hash multiple blocks of data
+    inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for(size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Calls func(begin, end) for chunks of chunkSize elements of [0, count) on up to threadCount threads (0 means one per hardware thread),
+    // including the calling one, and returns when all are done. Small counts (a single chunk) don't start any threads.
+    // The chunks don't depend on the number of threads, so as long as func only writes to the elements it's given, the results do neither
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t begin, size_t end)>& func, unsigned int threadCount = 0);
+
     // glm gives an error for glm::abs(mat4());
     inline glm::mat4 absMat4(const glm::mat4& mat) {
         glm::mat4 ret = mat;
@@ -14,4 +14,12 @@
 #include "renderer.hpp"
 #include "shader.hpp"
 #include "rendertarget.hpp"
-#include "posteffect.hpp"
\ No newline at end of file
+#include "posteffect.hpp"
+#include "staticbatcher.hpp"
+#include "mesh_cache.hpp"
+#include "asyncmeshloader.hpp"
+#include "geometryarena.hpp"
+#include "mesh_vertexlayout.hpp"
+#include "mesh_normals.hpp"
+#include "mesh_clusters.hpp"
+#include "compression.hpp"
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <new>
+#include <cstdint>
+
+#include "poolallocator.hpp"
+
+namespace ngn {
+    const size_t PoolAllocator::ALIGNMENT;
+
+    PoolAllocator::~PoolAllocator() {
+        for(auto block : mBlocks) ::operator delete(block);
+    }
+
+    PoolAllocator::SizeClass& PoolAllocator::getSizeClass(size_t size) {
+        // there are only a few different sizes, so a linear search is fastest
+        for(auto& sizeClass : mSizeClasses) {
+            if(sizeClass.size == size) return sizeClass;
+        }
+        SizeClass sizeClass;
+        sizeClass.size = size;
+        sizeClass.freeList = nullptr;
+        mSizeClasses.push_back(sizeClass);
+        return mSizeClasses.back();
+    }
+
+    void PoolAllocator::allocateBlock(SizeClass& sizeClass) {
+        uint8_t* block = static_cast<uint8_t*>(::operator new(sizeClass.size * mObjectsPerBlock));
+        mBlocks.push_back(block);
+        // push them in reverse, so the first allocations are at the start of the block
+        for(size_t i = mObjectsPerBlock; i > 0; --i) {
+            FreeNode* node = reinterpret_cast<FreeNode*>(block + (i - 1) * sizeClass.size);
+            node->next = sizeClass.freeList;
+            sizeClass.freeList = node;
+        }
+    }
+
+    void* PoolAllocator::allocate(size_t size) {
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        SizeClass& sizeClass = getSizeClass(size);
+        if(!sizeClass.freeList) allocateBlock(sizeClass);
+        FreeNode* node = sizeClass.freeList;
+        sizeClass.freeList = node->next;
+        return node;
+    }
+
+    void PoolAllocator::deallocate(void* ptr, size_t size) {
+        if(!ptr) return;
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        SizeClass& sizeClass = getSizeClass(size);
+        FreeNode* node = static_cast<FreeNode*>(ptr);
+        node->next = sizeClass.freeList;
+        sizeClass.freeList = node;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace ngn {
+    // Allocator for objects of a handful of different sizes (e.g. SceneNode and it's subclasses), that are created and destroyed often
+    // Memory is taken from the system in blocks and every object size has it's own free list, so allocation and deallocation
+    // are just a pop or a push. Memory is never given back to the system (before the allocator is destroyed), but reused.
+    // This is not thread safe!
+    class PoolAllocator {
+    private:
+        // Everything is aligned to this, which should be enough for everything including SSE types
+        static const size_t ALIGNMENT = 16;
+
+        struct FreeNode {
+            FreeNode* next;
+        };
+
+        struct SizeClass {
+            size_t size;
+            FreeNode* freeList;
+        };
+
+        std::vector<SizeClass> mSizeClasses;
+        std::vector<void*> mBlocks;
+        size_t mObjectsPerBlock;
+
+        SizeClass& getSizeClass(size_t size);
+        void allocateBlock(SizeClass& sizeClass);
+
+    public:
+        PoolAllocator(size_t objectsPerBlock = 256) : mObjectsPerBlock(objectsPerBlock) {}
+        ~PoolAllocator();
+
+        PoolAllocator(const PoolAllocator& other) = delete;
+        PoolAllocator& operator=(const PoolAllocator& other) = delete;
+
+        void* allocate(size_t size);
+        // size has to be the same as in the corresponding call to allocate
+        void deallocate(void* ptr, size_t size);
+    };
+}
@@ -1,4 +1,6 @@
 #include <stack>
+#include <cmath>
+#include <algorithm>
 
 #include "renderer.hpp"
 #include "shader.hpp"
@@ -15,7 +17,6 @@ namespace ngn {
     glm::ivec4 Renderer::currentScissor = glm::ivec4(0, 0, 0, 0);
     bool Renderer::currentScissorTest = false;
 
-    int Renderer::nextRendererIndex = 0;
     bool Renderer::staticInitialized = false;
 
     const int Renderer::AMBIENT_PASS = 1;
@@ -56,6 +57,28 @@ namespace ngn {
         ShaderProgram::UniformGUID ngn_light_shadowCascadeSplitDistanceGUID[LightData::Shadow::MAX_CASCADES];
     }
 
+    static_assert(LightData::Shadow::MAX_CASCADES <= 7, "The cascade count doesn't fit into the permutation key");
+
+    // The permutation features (see ShaderPermutation) of the vertex attributes the mesh has
+    static uint64_t getAttributeFeatures(const Mesh& mesh) {
+        uint64_t features = 0;
+        for(size_t b = 0; b < mesh.getVertexBufferCount(); ++b) {
+            for(auto& attr : mesh.getVertexBuffer(b)->getVertexFormat().getAttributes()) features |= ShaderPermutation::attribute(attr.type);
+        }
+        return features;
+    }
+
+    // and of the light, so the light pass only contains the code for this type of light and it's kind of shadow
+    static uint64_t getLightFeatures(LightData& lightData) {
+        uint64_t features = ShaderPermutation::light(static_cast<int>(lightData.getType()));
+        LightData::Shadow* shadow = lightData.getShadow();
+        if(shadow) {
+            int pcfTier = shadow->getPCFSamples() <= 0 ? 0 : (shadow->getPCFEarlyBailSamples() > 0 ? 2 : 1);
+            features |= ShaderPermutation::shadow(pcfTier, shadow->getCascadeCount());
+        }
+        return features;
+    }
+
     void Renderer::staticInitialize() {
         Shader::globalShaderPreamble += "#define NGN_PASS_FORWARD_AMBIENT " + std::to_string(AMBIENT_PASS) + "\n";
         Shader::globalShaderPreamble += "#define NGN_PASS_FORWARD_LIGHT " + std::to_string(LIGHT_PASS) + "\n";
@@ -206,10 +229,20 @@ uniform ngn_LightParameters ngn_light;
         static std::vector<SceneNode*> lightLists[LIGHT_TYPE_COUNT];
         for(int i = 0; i < LIGHT_TYPE_COUNT; ++i) if(lightLists[i].capacity() == 0) lightLists[i].reserve(1024);
 
+        static std::vector<uint32_t> visibleMask;
+        // the spatial index contains all nodes, not only the ones in this scene
+        static std::vector<uint8_t> inScene;
+        static std::vector<SceneNode*> shadowCasters;
+        static std::vector<std::vector<uint32_t>> lightMasks[LIGHT_TYPE_COUNT];
+
         if(regenerateQueue) {
+            root.updateSpatialIndex();
             glm::mat4 viewMatrix(camera.getViewMatrix());
             glm::mat4 projectionMatrix(camera.getProjectionMatrix());
 
+            // Only used for the camera passes, objects outside of the view frustum may still cast shadows
+            cullAABBs(SceneNode::storage.worldBoundingBoxes, camera.getFrustum(), visibleMask);
+
             // linearize scene graph (this should in theory not be done every frame)
             linearizedSceneGraph.clear(); // resize(0) might retain capacity?
             if(linearizedSceneGraph.capacity() == 0)
@@ -217,6 +250,12 @@ uniform ngn_LightParameters ngn_light;
 
             for(int i = 0; i < LIGHT_TYPE_COUNT; ++i) lightLists[i].clear();
 
+            // cached per subtree, so for a static scene this is just a lookup
+            AABoundingBox sceneBounds = root.boundingBox();
+            // the render queue points into this, so it may only grow while regenerating the queue
+            if(mRendererData.size() < SceneNode::nodeIds.getSlotCount()) mRendererData.resize(SceneNode::nodeIds.getSlotCount());
+            inScene.assign(SceneNode::storage.size(), 0);
+
             std::stack<SceneNode*> traversalStack;
             traversalStack.push(&root);
             while(!traversalStack.empty()) {
@@ -224,16 +263,12 @@ uniform ngn_LightParameters ngn_light;
                 traversalStack.pop();
 
                 linearizedSceneGraph.push_back(node);
-
-                RendererData* rendererData = node->rendererData[mRendererIndex];
-                if(rendererData == nullptr) {
-                    node->rendererData[mRendererIndex] = rendererData = new RendererData;
-                }
+                inScene[node->mStorageIndex] = 1;
 
                 Mesh* mesh = node->getMesh();
                 if(mesh) {
-                    rendererData->worldMatrix = node->getWorldMatrix();
-                    glm::mat4 model = rendererData->worldMatrix;
+                    RendererData* rendererData = &mRendererData[node->getSlotIndex()];
+                    glm::mat4 model = SceneNode::storage.worldMatrices[node->mStorageIndex];
                     glm::mat4 modelview = viewMatrix * model;
                     glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelview)));
                     rendererData->uniforms.setMatrix4(UniformGUIDs::ngn_modelMatrixGUID, model);
@@ -243,13 +278,30 @@ uniform ngn_LightParameters ngn_light;
                     rendererData->uniforms.setMatrix3(UniformGUIDs::ngn_normalMatrixGUID, normalMatrix);
                     rendererData->uniforms.setMatrix4(UniformGUIDs::ngn_modelViewProjectionMatrixGUID, projectionMatrix * modelview);
 
-                    rendererData->boundingBox = mesh->boundingBox();
-                    rendererData->boundingBox.transform(rendererData->worldMatrix);
-                }
+                    // select the LOD by the projected size of the bounding sphere, at it's point closest to the camera
+                    rendererData->lod = 0;
+                    if(mesh->getLodCount() > 1 && lodPixelError > 0.0f) {
+                        std::pair<glm::vec3, float> sphere = mesh->boundingSphere();
+                        float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+                        float pixelsPerUnit = projectionMatrix[1][1] * viewport.w * 0.5f * scale;
+                        // perspective projection
+                        if(projectionMatrix[2][3] != 0.0f) {
+                            float distance = glm::length(glm::vec3(modelview * glm::vec4(sphere.first, 1.0f))) - sphere.second * scale;
+                            pixelsPerUnit = distance > 0.0f ? pixelsPerUnit / distance : INFINITY;
+                        }
+                        rendererData->lod = mesh->selectLod(pixelsPerUnit, lodPixelError);
+                    }
 
-                SceneNode* parent = node->getParent();
-                if(parent) {
-                    parent->rendererData[mRendererIndex]->boundingBox.fitAABB(rendererData->boundingBox);
+                    // in model space, so the clusters don't have to be transformed
+                    rendererData->clustersCulled = false;
+                    if(clusterCulling && rendererData->lod == 0 && !mesh->getClusters().empty()) {
+                        glm::mat4 invModelview = glm::inverse(modelview);
+                        bool orthographic = projectionMatrix[2][3] == 0.0f;
+                        glm::vec3 viewPosition = orthographic ? -glm::vec3(invModelview[2]) : glm::vec3(invModelview[3]);
+                        rendererData->clusterRanges.clear();
+                        cullMeshClusters(mesh->getClusters(), Frustum(projectionMatrix * modelview), viewPosition, orthographic, rendererData->clusterRanges);
+                        rendererData->clustersCulled = true;
+                    }
                 }
 
                 LightData* lightData = node->getLightData();
@@ -257,11 +309,33 @@ uniform ngn_LightParameters ngn_light;
                     lightLists[static_cast<int>(lightData->getType())].push_back(node);
                 }
 
-                for(auto child : node->getChildren()) {
+                for(SceneNode* child = node->getFirstChild(); child; child = child->getNextSibling()) {
                     traversalStack.push(child);
                 }
             }
 
+            // determine which objects are affected by which point and spot lights (directional lights affect everything)
+            const SceneNodeStorage& storage = SceneNode::storage;
+            for(size_t ltype = 0; ltype < LIGHT_TYPE_COUNT; ++ltype) {
+                lightMasks[ltype].resize(lightLists[ltype].size());
+                if(ltype == static_cast<int>(LightData::LightType::DIRECTIONAL)) continue;
+                for(size_t l = 0; l < lightLists[ltype].size(); ++l) {
+                    SceneNode* light = lightLists[ltype][l];
+                    LightData* lightData = light->getLightData();
+                    std::vector<uint32_t>& mask = lightMasks[ltype][l];
+                    mask.assign((storage.size() + 31) / 32, 0);
+                    auto markNode = [&mask](void* userData) {
+                        SceneNodeStorage::Index index = static_cast<SceneNode*>(userData)->mStorageIndex;
+                        mask[index / 32] |= 1u << (index % 32);
+                    };
+                    if(lightData->getType() == LightData::LightType::SPOT) {
+                        storage.tree.queryCone(light->getPosition(), light->getForward(), lightData->getOuterAngle(), lightData->getRange(), markNode);
+                    } else {
+                        storage.tree.querySphere(light->getPosition(), lightData->getRange(), markNode);
+                    }
+                }
+            }
+
             // build render queue
             renderQueue.clear();
 
@@ -270,8 +344,6 @@ uniform ngn_LightParameters ngn_light;
             Rendertarget* currentRenderTarget = Rendertarget::currentRendertargetDraw;
 
             // generate shadow maps
-            AABoundingBox sceneBounds = root.rendererData[mRendererIndex]->boundingBox;
-
             glColorMask(false, false, false, false);
             glDepthMask((RenderStateBlock::currentDepthWrite = true) ? GL_TRUE : GL_FALSE);
             for(size_t ltype = 0; ltype < LIGHT_TYPE_COUNT; ++ltype) {
@@ -287,8 +359,14 @@ uniform ngn_LightParameters ngn_light;
                             glm::mat4 lightViewMatrix(shadow->getCamera(cascadeIndex)->getViewMatrix());
                             glm::mat4 lightProjectionMatrix(shadow->getCamera(cascadeIndex)->getProjectionMatrix());
 
-                            for(size_t i = 0; i < linearizedSceneGraph.size(); ++i) {
-                                SceneNode* node = linearizedSceneGraph[i];
+                            shadowCasters.clear();
+                            storage.tree.queryFrustum(shadow->getCamera(cascadeIndex)->getFrustum(), [](void* userData) {
+                                SceneNode* node = static_cast<SceneNode*>(userData);
+                                if(inScene[node->mStorageIndex]) shadowCasters.push_back(node);
+                            });
+
+                            for(size_t i = 0; i < shadowCasters.size(); ++i) {
+                                SceneNode* node = shadowCasters[i];
                                 Mesh* mesh = node->getMesh();
                                 if(mesh) {
                                     Material* mat = node->getMaterial();
@@ -297,14 +375,15 @@ uniform ngn_LightParameters ngn_light;
                                     if(mat->getStateBlock().getDepthWrite()) {
                                         Material::Pass* pass = mat->getPass(SHADOWMAP_PASS);
                                         if(!pass) pass = mat->getPass(AMBIENT_PASS);
+                                        const ShaderProgram* program = pass ? pass->getShaderProgram(getAttributeFeatures(*mesh)) : nullptr;
 
-                                        if(pass && pass->getShaderProgram()) {
-                                            RendererData* rendererData = node->rendererData[mRendererIndex];
-
-                                            renderQueue.emplace_back(mat, pass, mesh);
+                                        if(program) {
+                                            int lod = mRendererData[node->getSlotIndex()].lod;
+                                            if(lodPixelError > 0.0f) lod = std::min(lod + shadowLodBias, mesh->getLodCount() - 1);
+                                            renderQueue.emplace_back(mat, pass, program, mesh, lod);
                                             RenderQueueEntry& entry = renderQueue.back();
 
-                                            glm::mat4 model = rendererData->worldMatrix;
+                                            glm::mat4 model = SceneNode::storage.worldMatrices[node->mStorageIndex];
                                             glm::mat4 modelview = lightViewMatrix * model;
                                             glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelview)));
                                             entry.perEntryUniforms.setMatrix4(UniformGUIDs::ngn_modelMatrixGUID, model);
@@ -338,18 +417,20 @@ uniform ngn_LightParameters ngn_light;
                 for(size_t i = 0; i < linearizedSceneGraph.size(); ++i) {
                     SceneNode* node = linearizedSceneGraph[i];
                     Mesh* mesh = node->getMesh();
-                    if(mesh) {
+                    if(mesh && isVisible(visibleMask, node->mStorageIndex)) {
                         Material* mat = node->getMaterial();
                         assert(mat != nullptr);
                         Material::Pass* pass = mat->getPass(AMBIENT_PASS);
+                        const ShaderProgram* program = pass ? pass->getShaderProgram(getAttributeFeatures(*mesh)) : nullptr;
 
-                        if(pass && pass->getShaderProgram()) {
+                        if(program) {
                             if(drawTransparent == pass->getStateBlock().getBlendEnabled()) {
-                                renderQueue.emplace_back(mat, pass, mesh);
+                                RendererData& rendererData = mRendererData[node->getSlotIndex()];
+                                renderQueue.emplace_back(mat, pass, program, mesh, rendererData.lod);
                                 RenderQueueEntry& entry = renderQueue.back();
 
-                                RendererData* rendererData = node->rendererData[mRendererIndex];
-                                entry.uniformBlocks.push_back(&(rendererData->uniforms));
+                                entry.uniformBlocks.push_back(&(rendererData.uniforms));
+                                if(rendererData.clustersCulled) entry.ranges = &rendererData.clusterRanges;
                                 //LOG_DEBUG("ambient (obj %d) - transparent: %d\n", node->getId(), drawTransparent);
                             }
                         }
@@ -360,23 +441,30 @@ uniform ngn_LightParameters ngn_light;
                 for(size_t i = 0; i < linearizedSceneGraph.size(); ++i) {
                     SceneNode* node = linearizedSceneGraph[i];
                     Mesh* mesh = node->getMesh();
-                    if(mesh) {
+                    if(mesh && isVisible(visibleMask, node->mStorageIndex)) {
                         Material* mat = node->getMaterial();
                         assert(mat != nullptr);
                         Material::Pass* pass = mat->getPass(LIGHT_PASS);
-                        if(pass && pass->getShaderProgram()) {
+                        if(pass) {
                             if(drawTransparent == pass->getStateBlock().getBlendEnabled()) {
+                                uint64_t attributeFeatures = getAttributeFeatures(*mesh);
                                 for(size_t ltype = 0; ltype < LIGHT_TYPE_COUNT; ++ltype) {
                                     // later: sort by influence and take the N most influential lights
                                     for(size_t l = 0; l < lightLists[ltype].size(); ++l) {
+                                        if(ltype != static_cast<int>(LightData::LightType::DIRECTIONAL)
+                                                && !isVisible(lightMasks[ltype][l], node->mStorageIndex)) continue;
                                         SceneNode* light = lightLists[ltype][l];
                                         LightData* lightData = light->getLightData();
+                                        // one variant per kind of light instead of branching on the light uniforms
+                                        const ShaderProgram* program = pass->getShaderProgram(attributeFeatures | getLightFeatures(*lightData));
+                                        if(!program) continue;
 
-                                        renderQueue.emplace_back(mat, pass, mesh);
+                                        RendererData& rendererData = mRendererData[node->getSlotIndex()];
+                                        renderQueue.emplace_back(mat, pass, program, mesh, rendererData.lod);
                                         RenderQueueEntry& entry = renderQueue.back();
 
-                                        RendererData* rendererData = node->rendererData[mRendererIndex];
-                                        entry.uniformBlocks.push_back(&(rendererData->uniforms));
+                                        entry.uniformBlocks.push_back(&(rendererData.uniforms));
+                                        if(rendererData.clustersCulled) entry.ranges = &rendererData.clusterRanges;
 
                                         // TODO: Move this into a separate uniform block per light!
                                         entry.perEntryUniforms.setInteger(UniformGUIDs::ngn_light_typeGUID,        static_cast<int>(lightData->getType()));
@@ -403,7 +491,7 @@ uniform ngn_LightParameters ngn_light;
                                             }
                                             /* This is some bullshit
                                             The shadow map is bound to a specific unit (this engine is going to assume hardware with at least 16)
-                                            because I rely heavily on uniform dynamic branching instead of different shader permutations. As a result
+                                            because shaders may branch on the light uniforms instead of using the permutations (see ShaderPermutation). As a result
                                             it might happen that a shader is used, that has a uniform for a shadow map, but doesn't use it.
                                             That shadow sampler NEEDS to have a depth texture bound for my NVIDIA driver not to whine about it.
                                             Even if I point that sampler, when it is not in use, to a unit that does not have a texture bound (i.e. the 0-texture)
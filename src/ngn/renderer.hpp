@@ -25,12 +25,18 @@ namespace ngn {
             std::vector<UniformBlock*> uniformBlocks;
             UniformList perEntryUniforms;
             Mesh* mesh;
+            int lod;
+            // if not nullptr, only these index ranges of the full detail mesh are drawn (see Mesh::drawRanges)
+            const std::vector<std::pair<size_t, size_t> >* ranges;
             RenderStateBlock stateBlock;
 
-            inline RenderQueueEntry(Material* mat, Material::Pass* pass, Mesh* _mesh) {
-                shaderProgram = pass->getShaderProgram();
+            // program is the permutation of the pass for this entry (see Material::Pass::getShaderProgram)
+            inline RenderQueueEntry(Material* mat, Material::Pass* pass, const ShaderProgram* program, Mesh* _mesh, int _lod = 0) {
+                shaderProgram = program;
                 uniformBlocks.push_back(mat);
                 mesh = _mesh;
+                lod = _lod;
+                ranges = nullptr;
                 stateBlock = pass->getStateBlock();
             }
         };
@@ -46,12 +52,17 @@ namespace ngn {
                 //LOG_DEBUG("blend enabled: %d, factors: 0x%X, 0x%X, depth write: %d, depth func: 0x%X", RenderStateBlock::currentBlendEnabled,
                 //    static_cast<int>(RenderStateBlock::currentBlendSrcFactor), static_cast<int>(RenderStateBlock::currentBlendDstFactor),
                 //    RenderStateBlock::currentDepthWrite, static_cast<int>(RenderStateBlock::currentDepthFunc));
-                entry.mesh->draw();
+                if(entry.ranges) {
+                    entry.mesh->drawRanges(*entry.ranges);
+                } else {
+                    entry.mesh->draw(0, entry.lod);
+                }
             }
         }
 
     private:
-        int mRendererIndex;
+        // per node data, indexed by SceneNode::getSlotIndex()
+        std::vector<RendererData> mRendererData;
 
         static bool staticInitialized;
         static void staticInitialize();
@@ -65,8 +76,6 @@ namespace ngn {
         static glm::ivec4 currentScissor;
         static bool currentScissorTest;
 
-        static int nextRendererIndex;
-
         // If other renderers start defining these, they have to take care of not clashing with others themselves
         // Also it helps if their values are consecutive, so the staticInitialize-method can also easily implement a renderer query define
         static const int AMBIENT_PASS;
@@ -75,6 +84,15 @@ namespace ngn {
 
         bool autoClear, autoClearColor, autoClearDepth, autoClearStencil;
 
+        // LODs are selected so that their error is at most this many pixels on screen (0 always draws full detail)
+        float lodPixelError;
+        // shadow maps use LODs this many levels coarser than the camera passes (only if lodPixelError > 0). 0 by default, because casters that
+        // are coarser than the receivers shadow themselves differently (acne), so only use this for distant or unimportant geometry
+        int shadowLodBias;
+        // Meshes with clusters (see Mesh::buildClusters) only draw the clusters that are in the view frustum and not facing away from
+        // the camera in the camera passes (when the full detail LOD is selected). Shadow maps always draw the whole mesh
+        bool clusterCulling;
+
         glm::vec4 clearColor;
         float clearDepth;
         GLint clearStencil;
@@ -86,12 +104,10 @@ namespace ngn {
         glm::ivec4 scissor;
 
         Renderer() : autoClear(true), autoClearColor(true), autoClearDepth(true), autoClearStencil(false),
+                lodPixelError(1.0f), shadowLodBias(0), clusterCulling(true),
                 clearColor(currentClearColor), clearDepth(currentClearDepth), clearStencil(currentClearStencil), scissorTest(currentScissorTest),
                 viewport(currentViewport), scissor(currentScissor) {
             if(!staticInitialized) staticInitialize();
-            mRendererIndex = nextRendererIndex++;
-            if(mRendererIndex >= SceneNode::MAX_RENDERDATA_COUNT)
-                LOG_CRITICAL("More than SceneNode::MAX_RENDERDATA_COUNT(%d) renderers!", SceneNode::MAX_RENDERDATA_COUNT);
         }
         ~Renderer() {}
 
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <vector>
+#include <utility>
+
 #include "uniformblock.hpp"
 
 namespace ngn {
+    // Renderers keep one of these per node in a side table indexed by SceneNode::getSlotIndex()
     struct RendererData {
         UniformList uniforms;
-        glm::mat4 worldMatrix;
-        AABoundingBox boundingBox;
-        virtual ~RendererData() {}
+        // selected for the camera this frame (see Mesh::selectLod)
+        int lod;
+        // the index ranges of the clusters that survived culling for the camera this frame, if clustersCulled (see Mesh::buildClusters)
+        std::vector<std::pair<size_t, size_t> > clusterRanges;
+        bool clustersCulled;
+
+        RendererData() : lod(0), clustersCulled(false) {}
     };
 }
\ No newline at end of file
@@ -1,14 +1,118 @@
+#include <thread>
+#include <stack>
+
 #include "scenenode.hpp"
 
 namespace ngn {
-    SceneNode::Id SceneNode::nextId = 0;
-    std::unordered_map<SceneNode::Id, SceneNode*> SceneNode::nodeIdMap;
+    SceneNodeStorage SceneNode::storage;
+
+    SlotMap<SceneNode*> SceneNode::nodeIds;
 
     void SceneNode::updateTRSFromMatrix() {
-        mPosition = glm::vec3(mMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-        mQuaternion = glm::normalize(glm::quat_cast(mMatrix));
+        const glm::mat4& matrix = storage.matrices[mStorageIndex];
+        position() = glm::vec3(matrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        quaternion() = glm::normalize(glm::quat_cast(matrix));
         // remove the translation and put the scale factors in the columns
-        glm::mat3 temp = glm::transpose(glm::mat3(mMatrix));
-        mScale = glm::vec3(glm::length(temp[0]), glm::length(temp[1]), glm::length(temp[2]));
+        glm::mat3 temp = glm::transpose(glm::mat3(matrix));
+        scale() = glm::vec3(glm::length(temp[0]), glm::length(temp[1]), glm::length(temp[2]));
+    }
+
+    AABoundingBox SceneNode::getWorldBoundingBox() const {
+        Mesh* mesh = storage.meshes[mStorageIndex];
+        if(mesh && mesh->getBoundsVersion() != storage.meshBoundsVersions[mStorageIndex]) {
+            flags() |= SceneNodeStorage::WORLD_BOUNDS_DIRTY | SceneNodeStorage::PROXY_DIRTY;
+            dirtySubtreeBounds();
+        }
+        if(flags() & SceneNodeStorage::WORLD_BOUNDS_DIRTY) {
+            getWorldMatrix();
+            storage.updateWorldBoundingBox(mStorageIndex);
+        }
+        return storage.worldBoundingBoxes.get(mStorageIndex);
+    }
+
+    const AABoundingBox& SceneNode::boundingBox() const {
+        if(flags() & SceneNodeStorage::SUBTREE_BOUNDS_DIRTY) {
+            AABoundingBox bounds;
+            bounds.fitAABB(getWorldBoundingBox());
+            for(SceneNode* child = mFirstChild; child; child = child->mNextSibling) {
+                bounds.fitAABB(child->boundingBox());
+            }
+            storage.subtreeBoundingBoxes[mStorageIndex] = bounds;
+            flags() &= ~SceneNodeStorage::SUBTREE_BOUNDS_DIRTY;
+        }
+        return storage.subtreeBoundingBoxes[mStorageIndex];
+    }
+
+    void SceneNode::updateWorldMatrices() {
+        if(flags() & SceneNodeStorage::WORLD_MATRIX_DIRTY) {
+            // the parent is either clean already or getWorldMatrix will take care of it (if this is not called on the root)
+            getWorldMatrix();
+        } else if(!(flags() & SceneNodeStorage::DESCENDANT_WORLD_MATRIX_DIRTY)) {
+            return;
+        }
+
+        for(SceneNode* child = mFirstChild; child; child = child->mNextSibling) child->updateWorldMatrices();
+        flags() &= ~SceneNodeStorage::DESCENDANT_WORLD_MATRIX_DIRTY;
+    }
+
+    void SceneNode::updateSpatialIndex() {
+        storage.updateMatrices();
+        updateWorldMatrices();
+        storage.updateBoundingBoxes();
+    }
+
+    RaycastHit SceneNode::castRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const {
+        RaycastHit closest;
+        glm::vec3 dir = glm::normalize(direction);
+        storage.tree.queryRay(origin, dir, maxDistance, [&](void* userData, float maxDist) {
+            SceneNode* node = static_cast<SceneNode*>(userData);
+            Mesh* mesh = storage.meshes[node->mStorageIndex];
+            if(!mesh || !node->isDescendantOf(this)) return maxDist;
+
+            // Intersect in model space. The direction is not normalized after the transform, so distances stay in world units
+            glm::mat4 invWorld = glm::inverse(node->getWorldMatrix());
+            glm::vec3 localOrigin = glm::vec3(invWorld * glm::vec4(origin, 1.0f));
+            glm::vec3 localDir = glm::vec3(invWorld * glm::vec4(dir, 0.0f));
+
+            RaycastHit hit;
+            if(mesh->getBVH().intersect(localOrigin, localDir, maxDist, hit)) {
+                closest = hit;
+                closest.node = node;
+                closest.position = origin + dir * hit.distance;
+                return hit.distance;
+            }
+            return maxDist;
+        });
+        return closest;
+    }
+
+    void SceneNode::castRays(const glm::vec3* origins, const glm::vec3* directions, size_t count, RaycastHit* hits, unsigned int threadCount) {
+        // everything that would be lazily evaluated has to be done before going wide
+        std::stack<SceneNode*> traversalStack;
+        traversalStack.push(this);
+        while(!traversalStack.empty()) {
+            SceneNode* node = traversalStack.top();
+            traversalStack.pop();
+            node->getWorldMatrix();
+            Mesh* mesh = node->getMesh();
+            if(mesh) mesh->getBVH();
+            for(SceneNode* child = node->mFirstChild; child; child = child->mNextSibling) traversalStack.push(child);
+        }
+
+        if(threadCount == 0) threadCount = std::thread::hardware_concurrency();
+        if(threadCount == 0) threadCount = 1;
+        size_t raysPerThread = (count + threadCount - 1) / threadCount;
+
+        auto castRange = [=](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) hits[i] = castRay(origins[i], directions[i]);
+        };
+
+        std::vector<std::thread> threads;
+        for(size_t begin = raysPerThread; begin < count; begin += raysPerThread) {
+            threads.emplace_back(castRange, begin, std::min(begin + raysPerThread, count));
+        }
+        // the calling thread takes the first batch
+        castRange(0, std::min(raysPerThread, count));
+        for(auto& thread : threads) thread.join();
     }
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 #include <vector>
 #include <cstdio>
-#include <unordered_map>
+#include <cmath>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,60 +11,110 @@
 #include "material.hpp"
 #include "mesh.hpp"
 #include "lightdata.hpp"
-#include "rendererdata.hpp"
 #include "resource.hpp"
 #include "aabb.hpp"
+#include "scenenodestorage.hpp"
+#include "meshbvh.hpp"
+#include "slotmap.hpp"
+#include "poolallocator.hpp"
 
 namespace ngn {
     class SceneNode {
     friend class Renderer;
+    friend class SceneNodeStorage;
 
     public:
-        using Id = uint32_t;
+        // Generational handle, so ids of destroyed nodes are never resolved to other nodes
+        using Id = SlotMap<SceneNode*>::Handle;
 
     protected:
-        glm::vec3 mPosition, mScale;
-        glm::quat mQuaternion;
-        mutable glm::mat4 mMatrix;
+        // The transform data lives in SceneNode::storage, these just reference it
+        glm::vec3& position() const {return storage.positions[mStorageIndex];}
+        glm::vec3& scale() const {return storage.scales[mStorageIndex];}
+        glm::quat& quaternion() const {return storage.quaternions[mStorageIndex];}
+        uint8_t& flags() const {return storage.flags[mStorageIndex];}
 
         void updateTRSFromMatrix();
-        virtual void dirty() {mMatrixDirty = true;}
+        virtual void dirty() {flags() |= SceneNodeStorage::MATRIX_DIRTY; dirtyWorldMatrix();}
 
     private:
         Id mId;
+        SceneNodeStorage::Index mStorageIndex;
 
+        // intrusive doubly linked list of children, so adding and removing is O(1) and doesn't allocate
         SceneNode* mParent;
-        std::vector<SceneNode*> mChildren;
+        SceneNode* mFirstChild;
+        SceneNode* mLastChild;
+        SceneNode* mPrevSibling;
+        SceneNode* mNextSibling;
 
         ResourceHandle<Material>* mMaterial;
-        Mesh* mMesh;
+        // keeps the mesh set through a handle alive (the storage has the raw pointer)
+        ResourceHandle<Mesh> mMeshHandle;
         bool mMeshOwned;
-        LightData* mLightData;
+        bool mStatic;
 
-        mutable bool mMatrixDirty;
+        // marks this node and it's ancestors, stops at the first one that is dirty already (it's ancestors are dirty too then)
+        void dirtySubtreeBounds() const {
+            for(const SceneNode* node = this; node && !(node->flags() & SceneNodeStorage::SUBTREE_BOUNDS_DIRTY); node = node->mParent)
+                node->flags() |= SceneNodeStorage::SUBTREE_BOUNDS_DIRTY;
+        }
+
+        // descendants with their own material are not affected, so they (and their subtrees) are skipped
+        void dirtyMaterial() {
+            if(flags() & SceneNodeStorage::MATERIAL_DIRTY) return;
+            flags() |= SceneNodeStorage::MATERIAL_DIRTY;
+            for(SceneNode* child = mFirstChild; child; child = child->mNextSibling) {
+                if(!child->mMaterial) child->dirtyMaterial();
+            }
+        }
+
+        ResourceHandle<Material>* resolveMaterial() {
+            ResourceHandle<Material>*& resolved = storage.resolvedMaterials[mStorageIndex];
+            if(flags() & SceneNodeStorage::MATERIAL_DIRTY) {
+                resolved = mMaterial ? mMaterial : (mParent ? mParent->resolveMaterial() : nullptr);
+                flags() &= ~SceneNodeStorage::MATERIAL_DIRTY;
+            }
+            return resolved;
+        }
+
+        // if a node's world matrix is dirty, all the world matrices of it's descendants are dirty as well
+        // so we can stop at nodes that are already dirty
+        void dirtyWorldMatrix() {
+            dirtySubtreeBounds();
+            if(!(flags() & SceneNodeStorage::WORLD_MATRIX_DIRTY)) {
+                flags() |= SceneNodeStorage::WORLD_MATRIX_DIRTY | SceneNodeStorage::WORLD_BOUNDS_DIRTY | SceneNodeStorage::PROXY_DIRTY;
+                for(SceneNode* child = mFirstChild; child; child = child->mNextSibling) child->dirtyWorldMatrix();
+            }
+            for(SceneNode* node = mParent; node && !(node->flags() & SceneNodeStorage::DESCENDANT_WORLD_MATRIX_DIRTY); node = node->mParent)
+                node->flags() |= SceneNodeStorage::DESCENDANT_WORLD_MATRIX_DIRTY;
+        }
 
-        static constexpr int MAX_RENDERDATA_COUNT = 4;
-        RendererData* rendererData[MAX_RENDERDATA_COUNT];
     public:
+        static SceneNodeStorage storage;
+        static SlotMap<SceneNode*> nodeIds;
+
+        // returns nullptr if the node does not exist (anymore)
+        // Nodes are allocated from a pool, since they are often created and destroyed in large numbers (e.g. projectiles)
+        // It is intentionally never destroyed, so nodes with static storage duration can't outlive it
+        static PoolAllocator& getNodePool() {
+            static PoolAllocator* pool = new PoolAllocator;
+            return *pool;
+        }
 
-        static Id nextId;
-        static std::unordered_map<Id, SceneNode*> nodeIdMap;
+        static void* operator new(size_t size) {return getNodePool().allocate(size);}
+        // this gets the size of the dynamic type, because the destructor is virtual
+        static void operator delete(void* ptr, size_t size) {getNodePool().deallocate(ptr, size);}
 
         static SceneNode* getById(Id id) {
-            auto it = nodeIdMap.find(id);
-            if(it != nodeIdMap.end()) {
-                return it->second;
-            } else {
-                return nullptr;
-            }
+            SceneNode** node = nodeIds.get(id);
+            return node ? *node : nullptr;
         }
 
-        SceneNode() : mPosition(0.0f, 0.0f, 0.0f), mScale(1.0f, 1.0f, 1.0f), mQuaternion(),
-                mParent(nullptr),
-                mMaterial(nullptr), mMesh(nullptr), mMeshOwned(false), mLightData(nullptr),
-                mMatrixDirty(true) {
-            nodeIdMap[mId = nextId++] = this;
-            for(int i = 0; i < MAX_RENDERDATA_COUNT; ++i) rendererData[i] = nullptr;
+        SceneNode() : mParent(nullptr), mFirstChild(nullptr), mLastChild(nullptr), mPrevSibling(nullptr), mNextSibling(nullptr),
+                mMaterial(nullptr), mMeshOwned(false), mStatic(false) {
+            mId = nodeIds.insert(this);
+            mStorageIndex = storage.add(this);
         }
 
         SceneNode(const SceneNode& other) = delete;
@@ -72,99 +122,144 @@ namespace ngn {
 
         virtual ~SceneNode() {
             if(mParent != nullptr) mParent->remove(*this);
+            while(mFirstChild) remove(*mFirstChild);
             delete mMaterial;
-            if(mMeshOwned) delete mMesh;
-            delete mLightData;
-            for(int i = 0; i < MAX_RENDERDATA_COUNT; ++i) delete rendererData[i];
-            //TODO: for all children: mParent=nullptr?
+            if(mMeshOwned) delete getMesh();
+            delete getLightData();
+            storage.remove(mStorageIndex);
+            nodeIds.remove(mId);
         }
 
         // Id etc.
         Id getId() const {return mId;}
-        // if you use setId, please make sure SceneNode::nextId has a valid value after it
-        // probably something like: SceneNode::nextId == std::max(SceneNode::nextId + 1, theIdISetTo);
-        void setId(Id id) {
-            nodeIdMap.erase(mId);
-            nodeIdMap[mId = id] = this;
-        }
+        // Stable for the lifetime of the node and small (slots are reused), so it can be used to index side tables
+        uint32_t getSlotIndex() const {return SlotMap<SceneNode*>::getSlotIndex(mId);}
+        // Changes when other nodes are destroyed!
+        SceneNodeStorage::Index getStorageIndex() const {return mStorageIndex;}
 
         // Mesh/Material
-        Mesh* getMesh() {return mMesh;}
-        void setMesh(Mesh* mesh, bool owned = false) {mMesh = mesh; mMeshOwned = owned;}
+        Mesh* getMesh() {return storage.meshes[mStorageIndex];}
+        // if the previous mesh was owned, it is deleted
+        void setMesh(Mesh* mesh, bool owned = false) {
+            Mesh*& current = storage.meshes[mStorageIndex];
+            if(mMeshOwned && current != mesh) delete current;
+            current = mesh;
+            mMeshOwned = owned;
+            mMeshHandle.release();
+            flags() |= SceneNodeStorage::WORLD_BOUNDS_DIRTY | SceneNodeStorage::PROXY_DIRTY;
+            dirtySubtreeBounds();
+        }
+        // Shared meshes (e.g. ResourceHandle<Mesh>(Resource::getPrepare<Mesh>("model.obj", format))) are reference counted through
+        // the handle, so Resource::collect only frees them once no node uses them anymore
+        void setMesh(const ResourceHandle<Mesh>& mesh) {
+            ResourceHandle<Mesh> handle = mesh;
+            setMesh(handle.getResource(), false);
+            mMeshHandle = handle;
+        }
 
         // inherit materials
+        // The handle that is inherited is cached, so this only walks up the parent chain after the hierarchy changed
         Material* getMaterial() {
-            return mMaterial ? mMaterial->getResource() : (mParent ? mParent->getMaterial() : nullptr);
+            ResourceHandle<Material>* handle = resolveMaterial();
+            return handle ? handle->getResource() : nullptr;
         }
         void setMaterial(const ResourceHandle<Material>& mat) {
             if(mMaterial) {
+                // the handle object stays the same, so the nodes that resolved to it don't have to be invalidated
                 *mMaterial = mat;
             } else {
                 mMaterial = new ResourceHandle<Material>(mat);
+                dirtyMaterial();
             }
         }
 
         template<typename... Args>
-        void addLightData(Args&& ...args) {if(!mLightData) mLightData = new LightData(this, std::forward<Args>(args)...);}
-        LightData* getLightData() {return mLightData;}
+        void addLightData(Args&& ...args) {
+            LightData*& lightData = storage.lightData[mStorageIndex];
+            if(!lightData) lightData = new LightData(this, std::forward<Args>(args)...);
+        }
+        LightData* getLightData() {return storage.lightData[mStorageIndex];}
+
+        // Static nodes (and their meshes) are not supposed to move or change anymore, so they can be batched (see batchStaticGeometry)
+        void setStatic(bool isStatic) {mStatic = isStatic;}
+        bool isStatic() const {return mStatic;}
 
         // Hierarchy
         SceneNode* getParent() {return mParent;}
-        const std::vector<SceneNode*>& getChildren() const {return mChildren;}
+        // also true for node == this
+        bool isDescendantOf(const SceneNode* node) const {
+            for(const SceneNode* n = this; n; n = n->mParent) {
+                if(n == node) return true;
+            }
+            return false;
+        }
+        // iterate the children with: for(SceneNode* child = node->getFirstChild(); child; child = child->getNextSibling())
+        SceneNode* getFirstChild() const {return mFirstChild;}
+        SceneNode* getNextSibling() const {return mNextSibling;}
 
-        // you may add a node twice to the graph, which is not intended, but the overhead of checking is undesirable
+        // if obj already has a parent, it is removed from it first
         void add(SceneNode& obj) {
+            if(obj.mParent) obj.mParent->remove(obj);
+            // obj might be marked already, so it would not propagate to us
+            dirtySubtreeBounds();
             obj.mParent = this;
-            mChildren.push_back(&obj);
+            obj.mPrevSibling = mLastChild;
+            obj.mNextSibling = nullptr;
+            if(mLastChild)
+                mLastChild->mNextSibling = &obj;
+            else
+                mFirstChild = &obj;
+            mLastChild = &obj;
+            obj.dirtyWorldMatrix();
+            obj.dirtyMaterial();
         }
 
         void remove(SceneNode& obj) {
-            auto it = mChildren.begin();
-            while(it != mChildren.end()) {
-                if(*it == &obj) {
-                    (*it)->mParent = nullptr;
-                    it = mChildren.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+            if(obj.mParent != this) return;
+            if(obj.mPrevSibling)
+                obj.mPrevSibling->mNextSibling = obj.mNextSibling;
+            else
+                mFirstChild = obj.mNextSibling;
+            if(obj.mNextSibling)
+                obj.mNextSibling->mPrevSibling = obj.mPrevSibling;
+            else
+                mLastChild = obj.mPrevSibling;
+            obj.mParent = obj.mPrevSibling = obj.mNextSibling = nullptr;
+            obj.dirtyWorldMatrix();
+            obj.dirtyMaterial();
+            dirtySubtreeBounds();
         }
 
-        AABoundingBox boundingBox() const {
-            AABoundingBox ret;
-            if(mMesh) {
-                ret = mMesh->boundingBox();
-                ret.transform(getWorldMatrix());
-            }
-            for(auto child : mChildren) {
-                ret.fitAABB(child->boundingBox());
-            }
-            return ret;
-        }
+        // World space bounding box of this node's mesh (empty if it has none). Cached until the transform or the mesh changes
+        AABoundingBox getWorldBoundingBox() const;
+        // World space bounds of this node and all it's descendants. Cached as well, only dirty subtrees are refit.
+        // Changes to the mesh data itself (Mesh::updateBoundingBox) are detected here for this node only,
+        // for descendants they are picked up by updateSpatialIndex()
+        const AABoundingBox& boundingBox() const;
 
         // Transforms
-        void setPosition(const glm::vec3& position) {mPosition = position; dirty();}
-        glm::vec3 getPosition() const {return mPosition;}
+        void setPosition(const glm::vec3& pos) {position() = pos; dirty();}
+        glm::vec3 getPosition() const {return position();}
 
-        void setScale(const glm::vec3& scale) {mScale = scale; dirty();}
-        glm::vec3 getScale() const {return mScale;}
+        void setScale(const glm::vec3& scl) {scale() = scl; dirty();}
+        glm::vec3 getScale() const {return scale();}
 
-        void setQuaternion(const glm::quat& quat) {mQuaternion = quat; dirty();}
-        glm::quat getQuaternion() const {return mQuaternion;}
+        void setQuaternion(const glm::quat& quat) {quaternion() = quat; dirty();}
+        glm::quat getQuaternion() const {return quaternion();}
 
-        void rotate(const glm::quat& quat) {mQuaternion = glm::normalize(quat * mQuaternion); dirty();}
+        void rotate(const glm::quat& quat) {quaternion() = glm::normalize(quat * quaternion()); dirty();}
         void rotate(float angleRadians, const glm::vec3& axis) {
             // this normalization is not necessary mathematically, but technically (because of floating point numbers) it is
-            mQuaternion = glm::normalize(glm::angleAxis(angleRadians, axis) * mQuaternion);
+            quaternion() = glm::normalize(glm::angleAxis(angleRadians, axis) * quaternion());
             dirty();
         }
 
         void rotateWorld(float angleRadians, const glm::vec3& worldAxis) {
-            rotate(angleRadians, mQuaternion * worldAxis);
+            rotate(angleRadians, quaternion() * worldAxis);
         }
 
         // For FPS camera ust localDirToWorld, then set y = 0 and renormalize
-        glm::vec3 localDirToWorld(const glm::vec3& vec) const {return glm::conjugate(mQuaternion) * vec;}
+        glm::vec3 localDirToWorld(const glm::vec3& vec) const {return glm::conjugate(quaternion()) * vec;}
         glm::vec3 getForward() const {return localDirToWorld(glm::vec3(0.0f, 0.0f, -1.0f));}
         glm::vec3 getRight() const {return localDirToWorld(glm::vec3(1.0f, 0.0f, 0.0f));}
         glm::vec3 getUp() const {return localDirToWorld(glm::vec3(0.0f, 1.0f, 0.0f));}
@@ -178,36 +273,55 @@ namespace ngn {
         }
 
         glm::mat4 getMatrix() const {
-            if(mMatrixDirty) {
-                mMatrix = glm::scale(glm::translate(glm::mat4(), mPosition) * glm::mat4_cast(glm::conjugate(mQuaternion)), mScale);
-                mMatrixDirty = false;
-            }
-            return mMatrix;
+            if(flags() & SceneNodeStorage::MATRIX_DIRTY) storage.updateMatrix(mStorageIndex);
+            return storage.matrices[mStorageIndex];
         }
 
+        // Only walks up the parent chain as long as the world matrices are dirty
         glm::mat4 getWorldMatrix() const {
-            if(mParent)
-                return mParent->getWorldMatrix() * getMatrix();
-            else
-                return getMatrix();
+            glm::mat4& worldMatrix = storage.worldMatrices[mStorageIndex];
+            if(flags() & SceneNodeStorage::WORLD_MATRIX_DIRTY) {
+                if(mParent)
+                    worldMatrix = mParent->getWorldMatrix() * getMatrix();
+                else
+                    worldMatrix = getMatrix();
+                flags() &= ~SceneNodeStorage::WORLD_MATRIX_DIRTY;
+            }
+            return worldMatrix;
         }
 
+        // Recomputes all dirty world matrices in this subtree in a single top-down pass
+        // The renderer calls this on the scene root once per frame, after rebuilding the local matrices in one sweep over the storage
+        void updateWorldMatrices();
+
+        // Updates the local and world matrices of this subtree and the world bounds and spatial index in SceneNode::storage
+        // The renderer does this for the scene every frame
+        void updateSpatialIndex();
+
+        // Returns the closest hit of the ray with the meshes of this node and it's descendants (hit.node is nullptr if nothing was hit)
+        // This uses the spatial index, so call updateSpatialIndex() first, if nodes moved since the last frame was rendered
+        RaycastHit castRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance = INFINITY) const;
+        // Casts count rays distributed over threadCount threads (0 = one per hardware thread). It's safe to use this, since all the
+        // mesh BVHs and world matrices are built/updated beforehand. The nodes must not be modified while this is running of course
+        void castRays(const glm::vec3* origins, const glm::vec3* directions, size_t count, RaycastHit* hits, unsigned int threadCount = 0);
+
         void setMatrix(const glm::mat4& matrix, bool updateTRS = true) {
-            mMatrix = matrix;
-            mMatrixDirty = false;
+            storage.matrices[mStorageIndex] = matrix;
+            flags() &= ~SceneNodeStorage::MATRIX_DIRTY;
+            dirtyWorldMatrix();
             if(updateTRS) updateTRSFromMatrix();
         }
 
         // this works just as gluLookAt, so may put in "world space up" (this might not work sometimes, but makes everything a lot easier most of the time)
         // it also means, that the negative z-axis is aligned to face "at"
         void lookAtPos(const glm::vec3& pos, const glm::vec3& at, const glm::vec3& up = glm::vec3(0.0f, 1.0f, 0.0f)) {
-            mPosition = pos;
-            mQuaternion = glm::normalize(glm::quat_cast(glm::lookAt(pos, at, up)));
+            position() = pos;
+            quaternion() = glm::normalize(glm::quat_cast(glm::lookAt(pos, at, up)));
             dirty();
         }
 
         void lookAt(const glm::vec3& at, const glm::vec3& up = glm::vec3(0.0f, 1.0f, 0.0f)) {
-            lookAtPos(mPosition, at, up);
+            lookAtPos(position(), at, up);
         }
     };
 
@@ -0,0 +1,107 @@
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scenenodestorage.hpp"
+#include "scenenode.hpp"
+
+namespace ngn {
+    SceneNodeStorage::Index SceneNodeStorage::add(SceneNode* node) {
+        Index index = nodes.size();
+        nodes.push_back(node);
+        positions.emplace_back(0.0f, 0.0f, 0.0f);
+        scales.emplace_back(1.0f, 1.0f, 1.0f);
+        quaternions.emplace_back();
+        matrices.emplace_back();
+        worldMatrices.emplace_back();
+        flags.push_back(MATRIX_DIRTY | WORLD_MATRIX_DIRTY | WORLD_BOUNDS_DIRTY | PROXY_DIRTY | SUBTREE_BOUNDS_DIRTY | MATERIAL_DIRTY);
+        localBoundingBoxes.push_back(AABoundingBox());
+        worldBoundingBoxes.push_back(AABoundingBox());
+        meshBoundsVersions.push_back(0);
+        subtreeBoundingBoxes.push_back(AABoundingBox());
+        treeProxies.push_back(AABBTree::NULL_NODE);
+        meshes.push_back(nullptr);
+        lightData.push_back(nullptr);
+        resolvedMaterials.push_back(nullptr);
+        return index;
+    }
+
+    template<typename T>
+    inline void swapRemove(std::vector<T>& vec, size_t index) {
+        vec[index] = vec.back();
+        vec.pop_back();
+    }
+
+    void SceneNodeStorage::remove(Index index) {
+        Index last = nodes.size() - 1;
+        if(treeProxies[index] != AABBTree::NULL_NODE) tree.destroyProxy(treeProxies[index]);
+        if(index != last) nodes[last]->mStorageIndex = index;
+        swapRemove(nodes, index);
+        swapRemove(positions, index);
+        swapRemove(scales, index);
+        swapRemove(quaternions, index);
+        swapRemove(matrices, index);
+        swapRemove(worldMatrices, index);
+        swapRemove(flags, index);
+        localBoundingBoxes.swapRemove(index);
+        worldBoundingBoxes.swapRemove(index);
+        swapRemove(meshBoundsVersions, index);
+        swapRemove(subtreeBoundingBoxes, index);
+        swapRemove(treeProxies, index);
+        swapRemove(meshes, index);
+        swapRemove(lightData, index);
+        swapRemove(resolvedMaterials, index);
+    }
+
+    void SceneNodeStorage::updateMatrix(Index i) {
+        matrices[i] = glm::scale(glm::translate(glm::mat4(), positions[i]) * glm::mat4_cast(glm::conjugate(quaternions[i])), scales[i]);
+        flags[i] &= ~MATRIX_DIRTY;
+    }
+
+    void SceneNodeStorage::updateMatrices() {
+        for(size_t i = 0; i < nodes.size(); ++i) {
+            if(flags[i] & MATRIX_DIRTY) updateMatrix(i);
+        }
+    }
+
+    void SceneNodeStorage::updateLocalBoundingBox(Index i) {
+        localBoundingBoxes.set(i, meshes[i] ? meshes[i]->boundingBox() : AABoundingBox());
+        meshBoundsVersions[i] = meshes[i] ? meshes[i]->getBoundsVersion() : 0;
+    }
+
+    void SceneNodeStorage::updateWorldBoundingBox(Index i) {
+        updateLocalBoundingBox(i);
+        transformAABBs(localBoundingBoxes, worldMatrices.data(), worldBoundingBoxes, &i, 1);
+        flags[i] &= ~WORLD_BOUNDS_DIRTY;
+    }
+
+    void SceneNodeStorage::updateBoundingBoxes() {
+        mDirtyBounds.clear();
+        for(size_t i = 0; i < nodes.size(); ++i) {
+            if(meshes[i] && meshes[i]->getBoundsVersion() != meshBoundsVersions[i]) {
+                flags[i] |= WORLD_BOUNDS_DIRTY | PROXY_DIRTY;
+                nodes[i]->dirtySubtreeBounds();
+            }
+            // nodes outside of the updated hierarchy might still have stale world matrices, they stay dirty until those are updated
+            if((flags[i] & WORLD_BOUNDS_DIRTY) && !(flags[i] & WORLD_MATRIX_DIRTY)) {
+                updateLocalBoundingBox(i);
+                flags[i] &= ~WORLD_BOUNDS_DIRTY;
+                mDirtyBounds.push_back(i);
+            }
+        }
+        transformAABBs(localBoundingBoxes, worldMatrices.data(), worldBoundingBoxes, mDirtyBounds.data(), mDirtyBounds.size());
+
+        for(size_t i = 0; i < nodes.size(); ++i) {
+            if(!(flags[i] & PROXY_DIRTY) || (flags[i] & WORLD_BOUNDS_DIRTY)) continue;
+            flags[i] &= ~PROXY_DIRTY;
+            int& proxy = treeProxies[i];
+            if(meshes[i]) {
+                if(proxy == AABBTree::NULL_NODE)
+                    proxy = tree.createProxy(worldBoundingBoxes.get(i), nodes[i]);
+                else
+                    tree.moveProxy(proxy, worldBoundingBoxes.get(i));
+            } else if(proxy != AABBTree::NULL_NODE) {
+                tree.destroyProxy(proxy);
+                proxy = AABBTree::NULL_NODE;
+            }
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "aabb.hpp"
+#include "culling.hpp"
+#include "aabbtree.hpp"
+
+namespace ngn {
+    class SceneNode;
+    class Mesh;
+    class LightData;
+    class Material;
+    template<class T> class ResourceHandle;
+
+    // This holds all the data of scene nodes that is touched every frame as a structure of arrays, so that the per-frame
+    // transform and bounds updates are linear sweeps over tightly packed memory instead of pointer chasing through the heap.
+    // A SceneNode only stores it's index into these arrays and all it's accessors just forward to them.
+    // Removing an element moves the last one into it's place, so the arrays never have holes, but indices are not stable!
+    class SceneNodeStorage {
+    friend class SceneNode;
+
+    public:
+        using Index = uint32_t;
+
+        enum Flags : uint8_t {
+            MATRIX_DIRTY = 1 << 0,
+            WORLD_MATRIX_DIRTY = 1 << 1,
+            // set on all ancestors of a node with a dirty world matrix, so updateWorldMatrices can skip clean subtrees
+            DESCENDANT_WORLD_MATRIX_DIRTY = 1 << 2,
+            // the world bounding box has to be recomputed (transform or mesh changed)
+            WORLD_BOUNDS_DIRTY = 1 << 3,
+            // the proxy in the tree has to be moved to the new world bounding box
+            PROXY_DIRTY = 1 << 4,
+            // the bounds of the node and it's descendants have to be refit. Like DESCENDANT_WORLD_MATRIX_DIRTY this is also
+            // set on all ancestors, so clean subtrees can be skipped and their cached bounds reused
+            SUBTREE_BOUNDS_DIRTY = 1 << 5,
+            // the material handle inherited from the ancestors has to be looked up again
+            // If a node is marked, all it's descendants that inherit it are marked too
+            MATERIAL_DIRTY = 1 << 6,
+        };
+
+        std::vector<SceneNode*> nodes;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> scales;
+        std::vector<glm::quat> quaternions;
+        std::vector<glm::mat4> matrices;
+        std::vector<glm::mat4> worldMatrices;
+        std::vector<uint8_t> flags;
+
+        // mesh bounding boxes in local and in world space (empty for nodes without mesh)
+        AABBArray localBoundingBoxes;
+        AABBArray worldBoundingBoxes;
+        // Mesh::getBoundsVersion() at the time the local bounding box was taken from the mesh
+        std::vector<uint32_t> meshBoundsVersions;
+        // world space bounds of the node and all it's descendants, see SceneNode::boundingBox()
+        std::vector<AABoundingBox> subtreeBoundingBoxes;
+
+        // Spatial index over the world bounding boxes of all nodes with a mesh, the user data of the proxies is the SceneNode*
+        AABBTree tree;
+        // AABBTree::NULL_NODE for nodes without a mesh
+        std::vector<int> treeProxies;
+
+        std::vector<Mesh*> meshes;
+        std::vector<LightData*> lightData;
+        // The handle of the node itself or of the closest ancestor that has one (nullptr if none has), see SceneNode::getMaterial()
+        std::vector<ResourceHandle<Material>*> resolvedMaterials;
+
+    private:
+        // scratch space for updateBoundingBoxes
+        std::vector<Index> mDirtyBounds;
+
+        Index add(SceneNode* node);
+        void remove(Index index);
+
+        void updateLocalBoundingBox(Index index);
+
+    public:
+        size_t size() const {return nodes.size();}
+
+        void updateMatrix(Index index);
+        // Rebuilds all dirty local matrices from position, scale and rotation
+        void updateMatrices();
+        // The world matrix of the node has to be up to date for this
+        void updateWorldBoundingBox(Index index);
+        // Recomputes the dirty world bounding boxes (of nodes with clean world matrices) and moves their proxies in the tree
+        // Static nodes cost only a flag check and a mesh bounds version compare
+        void updateBoundingBoxes();
+    };
+}
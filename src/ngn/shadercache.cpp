@@ -1,6 +1,138 @@
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #include "shadercache.hpp"
+#include "mappedfile.hpp"
+#include "misc.hpp"
+#include "log.hpp"
 
 namespace ngn  {
+    std::string ShaderCache::binaryCacheDirectory;
+
+    static const char PROGRAM_BINARY_MAGIC[8] = {'N', 'G', 'N', 'P', 'R', 'O', 'G', '\0'};
+
+    // Only 4 and 8 byte members, ordered so that there is no padding. The binary follows directly
+    struct ProgramBinaryFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t binaryFormat;
+        uint64_t key;
+        uint64_t binarySize;
+    };
+    static_assert(ShaderPermutation::ATTRIBUTES_SHIFT + static_cast<int>(AttributeType::FINAL_COUNT_ENTRY) <= 64,
+        "The attribute bits don't fit into the permutation key");
+
+    std::string ShaderPermutation::getDefines(uint64_t key) {
+        std::string defines = "#define NGN_PASS " + std::to_string(key & PASS_MASK) + "\n";
+        defines += "#define NGN_LIGHT_TYPE " + std::to_string(static_cast<int>((key & LIGHT_TYPE_MASK) >> LIGHT_TYPE_SHIFT) - 1) + "\n";
+        defines += "#define NGN_SHADOWED " + std::to_string((key & SHADOWED) ? 1 : 0) + "\n";
+        defines += "#define NGN_SHADOW_PCF " + std::to_string((key & PCF_TIER_MASK) >> PCF_TIER_SHIFT) + "\n";
+        defines += "#define NGN_SHADOW_CASCADES " + std::to_string((key & CASCADE_COUNT_MASK) >> CASCADE_COUNT_SHIFT) + "\n";
+        for(int i = 0; i < static_cast<int>(AttributeType::FINAL_COUNT_ENTRY); ++i) {
+            AttributeType type = static_cast<AttributeType>(i);
+            defines += std::string("#define NGN_HAS_ATTR_") + getVertexAttributeTypeName(type) + ((key & attribute(type)) ? " 1\n" : " 0\n");
+        }
+        return defines;
+    }
+
+    void ShaderCache::setBinaryCacheDirectory(const std::string& directory) {
+        binaryCacheDirectory = directory;
+        if(directory.empty()) return;
+        // fails if it already exists, every other failure shows up when the first binary is written
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+
+    // The size first, so that different splits of the same characters give different hashes
+    static uint64_t hashString(const std::string& str, uint64_t hash) {
+        uint64_t size = str.size();
+        hash = hashBytes(&size, sizeof(size), hash);
+        return hashBytes(str.data(), str.size(), hash);
+    }
+
+    uint64_t ShaderCache::getProgramBinaryKey(const std::string& fragSource, const std::string& vertSource,
+            const std::string& fragDefines, const std::string& vertDefines) {
+        // the driver doesn't change while running
+        static uint64_t driverHash = 0;
+        if(driverHash == 0) {
+            uint32_t version = PROGRAM_BINARY_VERSION;
+            driverHash = hashBytes(&version, sizeof(version));
+            const GLenum driverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+            for(auto name : driverStrings) {
+                const char* str = reinterpret_cast<const char*>(glGetString(name));
+                driverHash = hashString(str ? str : "", driverHash);
+            }
+        }
+
+        uint64_t key = hashString(fragSource, driverHash);
+        key = hashString(vertSource, key);
+        key = hashString(fragDefines, key);
+        return hashString(vertDefines, key);
+    }
+
+    std::string ShaderCache::getProgramBinaryFilename(uint64_t key) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.ngnprog", static_cast<unsigned long long>(key));
+        return binaryCacheDirectory + "/" + name;
+    }
+
+    bool ShaderCache::loadProgramBinary(const char* filename, uint64_t key, ShaderProgram& program) {
+        MappedFile file;
+        if(!file.open(filename)) return false;
+
+        ProgramBinaryFileHeader header;
+        if(file.getSize() < sizeof(header)) return false;
+        std::memcpy(&header, file.getData(), sizeof(header));
+        if(std::memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_BINARY_VERSION
+                || header.key != key || header.binarySize != file.getSize() - sizeof(header)) {
+            LOG_DEBUG("Program binary '%s' has another version or is broken, ignoring it.", filename);
+            return false;
+        }
+
+        if(!program.loadBinary(header.binaryFormat, file.getData() + sizeof(header), header.binarySize)) {
+            LOG_DEBUG("Program binary '%s' was rejected by the driver, compiling from source.", filename);
+            return false;
+        }
+        return true;
+    }
+
+    bool ShaderCache::saveProgramBinary(const char* filename, uint64_t key, const ShaderProgram& program) {
+        GLenum format;
+        std::vector<uint8_t> binary;
+        if(!program.getBinary(format, binary)) return false;
+
+        ProgramBinaryFileHeader header;
+        std::memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+        header.version = PROGRAM_BINARY_VERSION;
+        header.binaryFormat = format;
+        header.key = key;
+        header.binarySize = binary.size();
+
+        FILE* file = std::fopen(filename, "wb");
+        if(!file) {
+            LOG_ERROR("Program binary '%s' could not be opened for writing.", filename);
+            return false;
+        }
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+            && std::fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+        written = std::fclose(file) == 0 && written;
+        if(!written) {
+            LOG_ERROR("Program binary '%s' could not be written.", filename);
+            // don't leave a truncated file behind
+            std::remove(filename);
+        }
+        return written;
+    }
+
     ShaderProgram* ShaderCache::getShaderPermutation(uint64_t permutationHash, const FragmentShader* frag, const VertexShader* vert,
             const std::string& fragDefines, const std::string& vertDefines) {
 
@@ -8,11 +140,28 @@ namespace ngn  {
         auto it = mCacheEntries.find(keyTuple);
         if(it == mCacheEntries.end()) {
             ShaderProgram* prog = new ShaderProgram;
-            if(!prog->compileAndLinkFromStrings(frag->getFullString(fragDefines).c_str(),
-                                                vert->getFullString(vertDefines).c_str())) {
+            std::string fragSource = frag->getFullString(fragDefines);
+            std::string vertSource = vert->getFullString(vertDefines);
+
+            static const bool binariesSupported = ShaderProgram::programBinariesSupported();
+            bool useBinaryCache = !binaryCacheDirectory.empty() && binariesSupported;
+            uint64_t binaryKey = 0;
+            std::string binaryFilename;
+            if(useBinaryCache) {
+                binaryKey = getProgramBinaryKey(fragSource, vertSource, fragDefines, vertDefines);
+                binaryFilename = getProgramBinaryFilename(binaryKey);
+                if(loadProgramBinary(binaryFilename.c_str(), binaryKey, *prog)) {
+                    mCacheEntries.insert(std::make_pair(keyTuple, prog));
+                    return prog;
+                }
+                prog->setBinaryRetrievable(true);
+            }
+
+            if(!prog->compileAndLinkFromStrings(fragSource.c_str(), vertSource.c_str())) {
                 delete prog;
                 return nullptr;
             }
+            if(useBinaryCache) saveProgramBinary(binaryFilename.c_str(), binaryKey, *prog);
             mCacheEntries.insert(std::make_pair(keyTuple, prog));
             return prog;
         } else {
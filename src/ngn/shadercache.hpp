@@ -2,23 +2,76 @@
 
 #include <unordered_map>
 #include <tuple>
+#include <string>
+#include <cstdint>
 
 #include "shaderprogram.hpp"
 #include "shader.hpp"
+#include "mesh_vertexattribute.hpp"
 
 #include "hash_tuple.hpp"
 
 namespace ngn {
+    // Permutation keys made of feature bits. Every feature becomes a #define (see getDefines), so shaders can use #if instead of
+    // branching on uniforms and the variants that don't need a feature don't contain it's code (and samplers) at all
+    struct ShaderPermutation {
+        // bits 0-7: the pass (see Renderer::AMBIENT_PASS etc.) - NGN_PASS
+        static const uint64_t PASS_MASK = 0xff;
+        // bits 8-9: light type + 1, 0 without a light - NGN_LIGHT_TYPE (one of NGN_LIGHT_TYPE_*, -1 without a light)
+        static const int LIGHT_TYPE_SHIFT = 8;
+        static const uint64_t LIGHT_TYPE_MASK = 0x3ull << LIGHT_TYPE_SHIFT;
+        // bit 10 - NGN_SHADOWED (0 or 1)
+        static const uint64_t SHADOWED = 1ull << 10;
+        // bits 11-12 - NGN_SHADOW_PCF: 0 = a single sample, 1 = PCF, 2 = PCF with early bail
+        static const int PCF_TIER_SHIFT = 11;
+        static const uint64_t PCF_TIER_MASK = 0x3ull << PCF_TIER_SHIFT;
+        // bits 13-15 - NGN_SHADOW_CASCADES (0 if not shadowed)
+        static const int CASCADE_COUNT_SHIFT = 13;
+        static const uint64_t CASCADE_COUNT_MASK = 0x7ull << CASCADE_COUNT_SHIFT;
+        // bits 16-35: one per AttributeType the mesh has - NGN_HAS_ATTR_<type> (e.g. NGN_HAS_ATTR_TANGENT, 0 or 1)
+        static const int ATTRIBUTES_SHIFT = 16;
+
+        static uint64_t pass(int passIndex) {return static_cast<uint64_t>(passIndex) & PASS_MASK;}
+        static uint64_t light(int lightType) {return (static_cast<uint64_t>(lightType + 1) << LIGHT_TYPE_SHIFT) & LIGHT_TYPE_MASK;}
+        static uint64_t shadow(int pcfTier, int cascadeCount) {
+            return SHADOWED | ((static_cast<uint64_t>(pcfTier) << PCF_TIER_SHIFT) & PCF_TIER_MASK)
+                | ((static_cast<uint64_t>(cascadeCount) << CASCADE_COUNT_SHIFT) & CASCADE_COUNT_MASK);
+        }
+        static uint64_t attribute(AttributeType type) {return 1ull << (ATTRIBUTES_SHIFT + static_cast<int>(type));}
+
+        // Defines all of them, the features that are not set as 0, so shaders can always use #if
+        static std::string getDefines(uint64_t key);
+    };
+
+    // Linked programs are also cached on disk as program binaries (if the driver supports them, see ShaderProgram::programBinariesSupported),
+    // so they don't have to be compiled again on the next start. The files are named after a hash of the full sources, the defines and
+    // the driver (vendor, renderer and version string), so changed shaders and driver updates just use another file. If the driver still
+    // rejects a binary, the program is compiled from source and the file is replaced.
     class ShaderCache {
     private:
         using keyType = std::tuple<uint64_t, const FragmentShader*, const VertexShader*>;
         std::unordered_map<keyType, ShaderProgram*, hash_tuple::hash<keyType> > mCacheEntries;
 
+        static std::string binaryCacheDirectory;
+
+        static uint64_t getProgramBinaryKey(const std::string& fragSource, const std::string& vertSource,
+            const std::string& fragDefines, const std::string& vertDefines);
+        static std::string getProgramBinaryFilename(uint64_t key);
+        static bool loadProgramBinary(const char* filename, uint64_t key, ShaderProgram& program);
+        static bool saveProgramBinary(const char* filename, uint64_t key, const ShaderProgram& program);
+
     public:
+        // 1: initial version
+        static const uint32_t PROGRAM_BINARY_VERSION = 1;
+
         ~ShaderCache() {
             for(auto& entry : mCacheEntries) delete entry.second;
         }
 
+        // Creates the directory, if it doesn't exist yet (not it's parents though). An empty string disables the binary cache (the default)
+        static void setBinaryCacheDirectory(const std::string& directory);
+        static const std::string& getBinaryCacheDirectory() {return binaryCacheDirectory;}
+
         ShaderProgram* getShaderPermutation(uint64_t permutationHash, const FragmentShader* frag, const VertexShader* vert,
             const std::string& fragDefines = "", const std::string& vertDefines = "");
     };
@@ -3,20 +3,40 @@
 #include <sstream>
 
 #include <glad/glad.h>
+#include <SDL.h>
 
 #include "shaderprogram.hpp"
 #include "log.hpp"
 
+// OpenGL 4.1/ARB_get_program_binary, which the 3.3 glad loader doesn't know about
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
 namespace ngn {
+    typedef void (APIENTRYP ProgramParameteriFunc)(GLuint program, GLenum pname, GLint value);
+    typedef void (APIENTRYP ProgramBinaryFunc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRYP GetProgramBinaryFunc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+
+    static ProgramParameteriFunc programParameteri = nullptr;
+    static ProgramBinaryFunc programBinary = nullptr;
+    static GetProgramBinaryFunc getProgramBinary = nullptr;
+
     const ShaderProgram* ShaderProgram::currentShaderProgram = nullptr;
     const char* ShaderProgram::shaderTypeNames[] = {"Vertex", "Fragment"};
     std::unordered_map<std::string, ShaderProgram::UniformGUID> ShaderProgram::uniformNameGUIDMap;
     std::vector<std::string> ShaderProgram::uniformGUIDNameMap;
     ShaderProgram::UniformGUID ShaderProgram::nextUniformGUID = 0;
 
-    ShaderProgram::ShaderProgram() : mStatus(Status::EMPTY) {}
+    ShaderProgram::ShaderProgram() : mProgramObject(0), mStatus(Status::EMPTY), mBinaryRetrievable(false) {}
 
-    ShaderProgram::ShaderProgram(const char* fragfile, const char* vertfile) : mStatus(Status::EMPTY) {
+    ShaderProgram::ShaderProgram(const char* fragfile, const char* vertfile) : mProgramObject(0), mStatus(Status::EMPTY), mBinaryRetrievable(false) {
         compileAndLinkFromFiles(fragfile, vertfile);
     }
 
@@ -36,6 +56,7 @@ namespace ngn {
         for(auto shader: mShaderObjects) {
             glAttachShader(mProgramObject, shader);
         }
+        if(mBinaryRetrievable && programParameteri) programParameteri(mProgramObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(mProgramObject);
         for(auto shader: mShaderObjects) {
             glDetachShader(mProgramObject, shader);
@@ -58,6 +79,68 @@ namespace ngn {
         }
     }
 
+    bool ShaderProgram::programBinariesSupported() {
+        if(!programBinary) {
+            GLint major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            bool core = major > 4 || (major == 4 && minor >= 1);
+            if(!core && !SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) return false;
+            // the extension has no suffix on the function names
+            programParameteri = reinterpret_cast<ProgramParameteriFunc>(SDL_GL_GetProcAddress("glProgramParameteri"));
+            getProgramBinary = reinterpret_cast<GetProgramBinaryFunc>(SDL_GL_GetProcAddress("glGetProgramBinary"));
+            programBinary = reinterpret_cast<ProgramBinaryFunc>(SDL_GL_GetProcAddress("glProgramBinary"));
+            if(!programParameteri || !getProgramBinary || !programBinary) {
+                LOG_WARNING("Program binaries are advertised, but the functions could not be loaded");
+                programParameteri = nullptr;
+                getProgramBinary = nullptr;
+                programBinary = nullptr;
+                return false;
+            }
+        }
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        return formatCount > 0;
+    }
+
+    bool ShaderProgram::loadBinary(GLenum format, const void* data, size_t size) {
+        if(mStatus != Status::EMPTY) {
+            LOG_ERROR("To load a program binary, the status must be EMPTY");
+            return false;
+        }
+
+        if(!programBinary) return false;
+        mProgramObject = glCreateProgram();
+        programBinary(mProgramObject, format, data, size);
+        GLint linkStatus;
+        glGetProgramiv(mProgramObject, GL_LINK_STATUS, &linkStatus);
+        if(linkStatus == GL_FALSE) {
+            glDeleteProgram(mProgramObject);
+            mProgramObject = 0;
+            return false;
+        }
+        mStatus = Status::LINKED;
+        LOG_DEBUG("Loaded shader %d from binary", mProgramObject);
+        return true;
+    }
+
+    bool ShaderProgram::getBinary(GLenum& format, std::vector<uint8_t>& data) const {
+        if(mStatus != Status::LINKED) {
+            LOG_ERROR("To get a program binary, the status must be LINKED");
+            return false;
+        }
+
+        if(!getProgramBinary) return false;
+        GLint length = 0;
+        glGetProgramiv(mProgramObject, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0) return false;
+        data.resize(length);
+        GLsizei written = 0;
+        getProgramBinary(mProgramObject, length, &written, &format, data.data());
+        data.resize(written);
+        return written > 0;
+    }
+
     bool ShaderProgram::compileShaderFromString(const char* source, ShaderProgram::ShaderType type) {
         //LOG_DEBUG("%s:\n%s", type == ShaderType::FRAGMENT ? "fragment" : "vertex", source);
 
@@ -3,6 +3,7 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <cstdint>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -32,6 +33,7 @@ namespace ngn {
         GLuint mProgramObject;
         std::vector<GLuint> mShaderObjects;
         Status mStatus;
+        bool mBinaryRetrievable;
         mutable std::unordered_map<std::string, UniformLocation> mAttributeLocations; // only caches
         mutable std::unordered_map<std::string, UniformLocation> mUniformLocations;
         // bool holds if the location is already initialized
@@ -105,6 +107,16 @@ namespace ngn {
 
         bool link();
 
+        // Program binaries (see ShaderCache) need an OpenGL 4.1 context or ARB_get_program_binary and at least one binary format.
+        // The glad loader is 3.3 only, so the first call resolves the functions through SDL. Needs a current context.
+        // If this is false, loadBinary and getBinary always fail
+        static bool programBinariesSupported();
+        // Has to be called before link, so that the driver keeps the binary around for getBinary
+        void setBinaryRetrievable(bool retrievable) {mBinaryRetrievable = retrievable;}
+        // Only for EMPTY programs. Returns false if the driver rejects the binary (e.g. after a driver update), the program is EMPTY again then
+        bool loadBinary(GLenum format, const void* data, size_t size);
+        bool getBinary(GLenum& format, std::vector<uint8_t>& data) const;
+
         inline void bind() const {
             if(currentShaderProgram != this) {
                 glUseProgram(mProgramObject);
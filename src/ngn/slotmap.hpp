@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace ngn {
+    // Stores values densely (without holes) and hands out handles, that stay valid until the value is removed
+    // Lookup is an index and a generation compare. After removal the slot is reused, but with a new generation,
+    // so stale handles are detected instead of silently pointing to another value.
+    // The slot index of a handle (getSlotIndex) is stable while the value lives, so it can be used to index side tables
+    template<typename T>
+    class SlotMap {
+    public:
+        // slot index in the lower 32 bits, generation in the upper 32 bits
+        using Handle = uint64_t;
+        static const Handle INVALID_HANDLE = ~static_cast<Handle>(0);
+
+    private:
+        static const uint32_t FREE_LIST_END = ~static_cast<uint32_t>(0);
+
+        struct Slot {
+            // index into mValues if the slot is in use, next free slot otherwise
+            uint32_t denseIndex;
+            uint32_t generation;
+        };
+
+        std::vector<T> mValues;
+        std::vector<uint32_t> mDenseToSlot;
+        std::vector<Slot> mSlots;
+        uint32_t mFreeList;
+
+        static Handle makeHandle(uint32_t slotIndex, uint32_t generation) {
+            return static_cast<Handle>(slotIndex) | (static_cast<Handle>(generation) << 32);
+        }
+
+    public:
+        SlotMap() : mFreeList(FREE_LIST_END) {}
+
+        static uint32_t getSlotIndex(Handle handle) {return static_cast<uint32_t>(handle);}
+        static uint32_t getGeneration(Handle handle) {return static_cast<uint32_t>(handle >> 32);}
+
+        template<typename... Args>
+        Handle insert(Args&&... args) {
+            uint32_t slotIndex;
+            if(mFreeList != FREE_LIST_END) {
+                slotIndex = mFreeList;
+                mFreeList = mSlots[slotIndex].denseIndex;
+            } else {
+                slotIndex = mSlots.size();
+                Slot slot;
+                slot.generation = 0;
+                mSlots.push_back(slot);
+            }
+            Slot& slot = mSlots[slotIndex];
+            slot.denseIndex = mValues.size();
+            mValues.emplace_back(std::forward<Args>(args)...);
+            mDenseToSlot.push_back(slotIndex);
+            return makeHandle(slotIndex, slot.generation);
+        }
+
+        bool contains(Handle handle) const {
+            uint32_t slotIndex = getSlotIndex(handle);
+            return slotIndex < mSlots.size() && mSlots[slotIndex].generation == getGeneration(handle);
+        }
+
+        // returns nullptr for stale or invalid handles
+        T* get(Handle handle) {
+            return contains(handle) ? &mValues[mSlots[getSlotIndex(handle)].denseIndex] : nullptr;
+        }
+
+        const T* get(Handle handle) const {
+            return contains(handle) ? &mValues[mSlots[getSlotIndex(handle)].denseIndex] : nullptr;
+        }
+
+        // Moves the last value into the hole, so pointers to values (and dense indices) are not stable, handles are
+        bool remove(Handle handle) {
+            if(!contains(handle)) return false;
+            uint32_t slotIndex = getSlotIndex(handle);
+            Slot& slot = mSlots[slotIndex];
+            uint32_t denseIndex = slot.denseIndex;
+            uint32_t last = mValues.size() - 1;
+            if(denseIndex != last) {
+                mValues[denseIndex] = std::move(mValues[last]);
+                mDenseToSlot[denseIndex] = mDenseToSlot[last];
+                mSlots[mDenseToSlot[denseIndex]].denseIndex = denseIndex;
+            }
+            mValues.pop_back();
+            mDenseToSlot.pop_back();
+
+            ++slot.generation;
+            slot.denseIndex = mFreeList;
+            mFreeList = slotIndex;
+            return true;
+        }
+
+        size_t size() const {return mValues.size();}
+        bool empty() const {return mValues.empty();}
+        // Upper bound for getSlotIndex of all live handles, use this to size side tables
+        size_t getSlotCount() const {return mSlots.size();}
+
+        // dense iteration
+        typename std::vector<T>::iterator begin() {return mValues.begin();}
+        typename std::vector<T>::iterator end() {return mValues.end();}
+        typename std::vector<T>::const_iterator begin() const {return mValues.begin();}
+        typename std::vector<T>::const_iterator end() const {return mValues.end();}
+
+        T& operator[](size_t denseIndex) {return mValues[denseIndex];}
+        const T& operator[](size_t denseIndex) const {return mValues[denseIndex];}
+        Handle getHandle(size_t denseIndex) const {
+            uint32_t slotIndex = mDenseToSlot[denseIndex];
+            return makeHandle(slotIndex, mSlots[slotIndex].generation);
+        }
+    };
+
+    template<typename T> const typename SlotMap<T>::Handle SlotMap<T>::INVALID_HANDLE;
+    template<typename T> const uint32_t SlotMap<T>::FREE_LIST_END;
+}
@@ -0,0 +1,109 @@
+#include <map>
+#include <algorithm>
+#include <tuple>
+#include <stack>
+#include <cmath>
+
+#include "staticbatcher.hpp"
+
+namespace ngn {
+    using VertexFormatList = std::vector<const VertexFormat*>;
+
+    bool sameVertexFormats(const VertexFormatList& a, const VertexFormatList& b) {
+        if(a.size() != b.size()) return false;
+        for(size_t i = 0; i < a.size(); ++i) {
+            if(*a[i] != *b[i]) return false;
+        }
+        return true;
+    }
+
+    bool canBeBatched(Mesh* mesh, VertexFormatList& formats) {
+        if(mesh->getDrawMode() != Mesh::DrawMode::TRIANGLES) return false;
+        const IndexBuffer* indexBuffer = mesh->getIndexBuffer();
+        if(indexBuffer && !indexBuffer->canRestoreLocal()) return false;
+
+        formats.clear();
+        for(int t = 0; t < static_cast<int>(AttributeType::FINAL_COUNT_ENTRY); ++t) {
+            VertexBuffer* vBuf = mesh->hasAttribute(static_cast<AttributeType>(t));
+            if(!vBuf || std::find(formats.begin(), formats.end(), &vBuf->getVertexFormat()) != formats.end()) continue;
+            if(!vBuf->canRestoreLocal()) return false;
+            for(auto& attr : vBuf->getVertexFormat().getAttributes()) {
+                if(attr.divisor > 0) return false;
+            }
+            formats.push_back(&vBuf->getVertexFormat());
+        }
+        return formats.size() > 0;
+    }
+
+    SceneNode* batchStaticGeometry(SceneNode& root, float cellSize) {
+        // material, index into formatLists and the grid cell
+        using BatchKey = std::tuple<Material*, size_t, int, int, int>;
+        std::map<BatchKey, std::vector<SceneNode*> > batches;
+        std::vector<VertexFormatList> formatLists;
+        VertexFormatList formats;
+
+        std::stack<SceneNode*> traversalStack;
+        traversalStack.push(&root);
+        while(!traversalStack.empty()) {
+            SceneNode* node = traversalStack.top();
+            traversalStack.pop();
+            for(SceneNode* child = node->getFirstChild(); child; child = child->getNextSibling()) traversalStack.push(child);
+
+            Mesh* mesh = node->getMesh();
+            Material* material = node->getMaterial();
+            if(!node->isStatic() || !mesh || !material || !canBeBatched(mesh, formats)) continue;
+
+            size_t formatIndex = 0;
+            while(formatIndex < formatLists.size() && !sameVertexFormats(formatLists[formatIndex], formats)) ++formatIndex;
+            if(formatIndex == formatLists.size()) formatLists.push_back(formats);
+
+            AABoundingBox bounds = node->getWorldBoundingBox();
+            glm::vec3 cell = glm::floor((bounds.min + bounds.max) * 0.5f / cellSize);
+            BatchKey key(material, formatIndex, static_cast<int>(cell.x), static_cast<int>(cell.y), static_cast<int>(cell.z));
+            batches[key].push_back(node);
+        }
+
+        SceneNode* batchRoot = nullptr;
+        glm::mat4 invRootMatrix = glm::inverse(root.getWorldMatrix());
+        std::vector<const Mesh*> meshes;
+        std::vector<glm::mat4> transforms;
+        for(auto& batch : batches) {
+            std::vector<SceneNode*>& nodes = batch.second;
+            // a single node would only be a copy
+            if(nodes.size() < 2) continue;
+
+            Mesh* merged = new Mesh(Mesh::DrawMode::TRIANGLES);
+            for(auto format : formatLists[std::get<1>(batch.first)]) merged->addVertexBuffer(*format);
+
+            meshes.clear();
+            transforms.clear();
+            for(auto node : nodes) {
+                meshes.push_back(node->getMesh());
+                transforms.push_back(invRootMatrix * node->getWorldMatrix());
+            }
+            if(!merged->merge(meshes, transforms)) {
+                delete merged;
+                continue;
+            }
+
+            if(!batchRoot) {
+                batchRoot = new SceneNode;
+                root.add(*batchRoot);
+            }
+            SceneNode* batchNode = new SceneNode;
+            batchNode->setMesh(merged, true);
+            batchNode->setMaterial(ResourceHandle<Material>(std::get<0>(batch.first)));
+            batchNode->setStatic(true);
+            batchRoot->add(*batchNode);
+
+            for(auto node : nodes) node->setMesh(nullptr);
+        }
+
+        if(batchRoot) {
+            size_t batchCount = 0;
+            for(SceneNode* child = batchRoot->getFirstChild(); child; child = child->getNextSibling()) ++batchCount;
+            LOG_DEBUG("Merged static geometry into %d batches.", static_cast<int>(batchCount));
+        }
+        return batchRoot;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "scenenode.hpp"
+
+namespace ngn {
+    // Merges the meshes of the static nodes (see SceneNode::setStatic) in the subtree of root, that share a material and vertex format
+    // and lie in the same cell of a uniform grid (by the center of their world bounds), so they are drawn with a single draw call each,
+    // but are still split up enough for culling to be effective.
+    // The merged meshes are pre-transformed into the space of root and added to a new child node of root, which is returned
+    // (nullptr if there was nothing to batch). The source nodes keep their transforms, children and light data, but lose their meshes.
+    // Only meshes with DrawMode::TRIANGLES, a local copy of their data and no instanced attributes are considered
+    SceneNode* batchStaticGeometry(SceneNode& root, float cellSize);
+}